@@ -56,8 +56,19 @@
 
 int sendUDP(XPCSocket sock, char buffer[], int len);
 int readUDP(XPCSocket sock, char buffer[], int len);
-int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count);
-int getDREFResponse(XPCSocket sock, float* values[], unsigned char count, int sizes[]);
+int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count, unsigned char flags);
+int getDREFResponse(XPCSocket sock, float* values[], unsigned char count, int sizes[], unsigned int* frame);
+int readDREFRows(char* functionName, unsigned char buffer[], int cur, float* values[], unsigned char count, int sizes[]);
+int readFragments(XPCSocket sock, unsigned char buffer[], int len, unsigned char** payload, unsigned int* total);
+int readDREFFragments(XPCSocket sock, unsigned char buffer[], int len, float* values[], unsigned char count, int sizes[],
+	unsigned int* frame);
+int getPOSIResponse(char* functionName, XPCSocket sock, double values[7], char ac, unsigned int* frame);
+int typeSize(XPC_VALUE_TYPE type);
+int sendStep(XPCSocket sock, unsigned int frames, int query);
+int waitStep(XPCSocket sock, int timeout, unsigned int* frame);
+int sendBarrier(XPCSocket sock, unsigned char command, const void* args, int len);
+int waitMessage(char* functionName, XPCSocket sock, const char* head, unsigned char buffer[], int len, int timeout);
+long currentTimeMs();
 
 void printError(char *functionName, char *format, ...)
 {
@@ -229,6 +240,40 @@ int readUDP(XPCSocket sock, char buffer[], int len)
 	}
 	return status;
 }
+
+int sendFramed(XPCSocket sock, const unsigned char* messages[], const int sizes[], int count)
+{
+	// Setup command
+	// The plugin drops datagrams larger than 4096 bytes.
+	unsigned char buffer[4096] = "XPC2";
+	int pos = 5;
+	int i;
+	for (i = 0; i < count; ++i)
+	{
+		if (sizes[i] < 5)
+		{
+			printError("sendFramed", "Message %d is too short. Must be at least 5 bytes.", i);
+			return -1;
+		}
+		if (pos + 2 + sizes[i] > 4096)
+		{
+			printError("sendFramed", "About to overrun the send buffer!");
+			return -2;
+		}
+		buffer[pos++] = (unsigned char)(sizes[i] & 0xFF);
+		buffer[pos++] = (unsigned char)(sizes[i] >> 8);
+		memcpy(buffer + pos, messages[i], sizes[i]);
+		pos += sizes[i];
+	}
+
+	// Send command
+	if (sendUDP(sock, (char*)buffer, pos) < 0)
+	{
+		printError("sendFramed", "Failed to send command");
+		return -3;
+	}
+	return 0;
+}
 /*****************************************************************************/
 /****                    End Low Level UDP functions                      ****/
 /*****************************************************************************/
@@ -291,6 +336,258 @@ int pauseSim(XPCSocket sock, char pause)
 	}
 	return 0;
 }
+
+long currentTimeMs()
+{
+#ifdef _WIN32
+	return (long)GetTickCount();
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (long)(now.tv_sec * 1000 + now.tv_usec / 1000);
+#endif
+}
+
+int sendStep(XPCSocket sock, unsigned int frames, int query)
+{
+	// Setup command
+	// 5 byte header + 4 byte frame count + query id + response flags
+	unsigned char buffer[11] = "STEP";
+	memcpy(buffer + 5, &frames, 4);
+	int len = 9;
+	if (query >= 0)
+	{
+		buffer[9] = (unsigned char)query;
+		buffer[10] = 4; // Fragmented response, as in getDREFs
+		len = 11;
+	}
+
+	// Send command
+	return sendUDP(sock, buffer, len);
+}
+
+int waitMessage(char* functionName, XPCSocket sock, const char* head, unsigned char buffer[], int len, int timeout)
+{
+	// The plugin may take many times longer than the socket's read timeout to
+	// reply, so wait with select and skip anything else that arrives.
+	long deadline = currentTimeMs() + timeout;
+	long remaining = timeout;
+	while (remaining > 0)
+	{
+		fd_set readFDS;
+		FD_ZERO(&readFDS);
+		FD_SET(sock.sock, &readFDS);
+		struct timeval tv;
+		tv.tv_sec = remaining / 1000;
+		tv.tv_usec = (remaining % 1000) * 1000;
+		int status = select((int)sock.sock + 1, &readFDS, NULL, NULL, &tv);
+		if (status < 0)
+		{
+			printError(functionName, "Select command error");
+			return -1;
+		}
+		if (status > 0)
+		{
+			int result = (int)recv(sock.sock, (char*)buffer, len, 0);
+			if (result >= 4 && strncmp((char*)buffer, head, 4) == 0)
+			{
+				return result;
+			}
+		}
+		remaining = deadline - currentTimeMs();
+	}
+	printError(functionName, "Timed out waiting for a %s message", head);
+	return -2;
+}
+
+int waitStep(XPCSocket sock, int timeout, unsigned int* frame)
+{
+	unsigned char buffer[16];
+	int result = waitMessage("stepSim", sock, "STPD", buffer, sizeof(buffer), timeout);
+	if (result < 0)
+	{
+		// waitMessage will print an error message, so just return.
+		return -1;
+	}
+	if (result < 10)
+	{
+		printError("stepSim", "Unexpected response length (%i)", result);
+		return -2;
+	}
+	if (buffer[5] != 0)
+	{
+		printError("stepSim", "Step rejected by the plugin (%u)", buffer[5]);
+		return -3;
+	}
+	if (frame != NULL)
+	{
+		memcpy(frame, buffer + 6, 4);
+	}
+	return 0;
+}
+
+int stepSim(XPCSocket sock, unsigned int frames, int timeout, unsigned int* frame)
+{
+	// Validate input
+	if (frames < 1)
+	{
+		printError("stepSim", "frames must be at least 1.");
+		return -1;
+	}
+
+	// Send command
+	if (sendStep(sock, frames, -1) < 0)
+	{
+		printError("stepSim", "Failed to send command");
+		return -2;
+	}
+
+	// Wait for the plugin to pause the sim again
+	if (waitStep(sock, timeout, frame) < 0)
+	{
+		// waitStep will print an error message, so just return.
+		return -3;
+	}
+	return 0;
+}
+
+int stepSimDREFs(XPCSocket sock, unsigned int frames, int timeout, unsigned int* frame,
+	unsigned char id, float* values[], unsigned char count, int sizes[])
+{
+	// Validate input
+	if (frames < 1)
+	{
+		printError("stepSimDREFs", "frames must be at least 1.");
+		return -1;
+	}
+
+	// Send command
+	if (sendStep(sock, frames, id) < 0)
+	{
+		printError("stepSimDREFs", "Failed to send command");
+		return -2;
+	}
+
+	// Wait for the plugin to pause the sim again, then read the query it sends
+	if (waitStep(sock, timeout, frame) < 0)
+	{
+		// waitStep will print an error message, so just return.
+		return -3;
+	}
+	if (getDREFResponse(sock, values, count, sizes, NULL) < 0)
+	{
+		// getDREFResponse will print an error message, so just return.
+		return -4;
+	}
+	return 0;
+}
+
+int sendBarrier(XPCSocket sock, unsigned char command, const void* args, int len)
+{
+	// Setup command
+	// 5 byte header + command + up to 8 bytes of arguments
+	unsigned char buffer[14] = "BARR";
+	buffer[5] = command;
+	if (len > 0)
+	{
+		memcpy(buffer + 6, args, len);
+	}
+
+	// Send command
+	return sendUDP(sock, buffer, 6 + len);
+}
+
+int joinBarrier(XPCSocket sock, float timeout, unsigned int frames, unsigned int* frame)
+{
+	// Validate input
+	if (!(timeout > 0) || frames < 1)
+	{
+		printError("joinBarrier", "timeout must be positive and frames must be at least 1.");
+		return -1;
+	}
+
+	// Send command
+	unsigned char args[8];
+	memcpy(args, &timeout, 4);
+	memcpy(args + 4, &frames, 4);
+	if (sendBarrier(sock, 1, args, 8) < 0)
+	{
+		printError("joinBarrier", "Failed to send command");
+		return -2;
+	}
+
+	// Read response
+	unsigned char buffer[16];
+	int result = waitMessage("joinBarrier", sock, "BARD", buffer, sizeof(buffer), 1000);
+	if (result < 0)
+	{
+		// waitMessage will print an error message, so just return.
+		return -3;
+	}
+	if (result < 14 || buffer[5] != 2)
+	{
+		printError("joinBarrier", "Join rejected by the plugin (%u)", buffer[5]);
+		return -4;
+	}
+	if (frame != NULL)
+	{
+		memcpy(frame, buffer + 6, 4);
+	}
+	return 0;
+}
+
+int leaveBarrier(XPCSocket sock)
+{
+	if (sendBarrier(sock, 0, NULL, 0) < 0)
+	{
+		printError("leaveBarrier", "Failed to send command");
+		return -1;
+	}
+	return 0;
+}
+
+int submitActions(XPCSocket sock, unsigned int frame)
+{
+	if (sendBarrier(sock, 2, &frame, 4) < 0)
+	{
+		printError("submitActions", "Failed to send command");
+		return -1;
+	}
+	return 0;
+}
+
+int waitBarrier(XPCSocket sock, int timeout, unsigned int* frame)
+{
+	unsigned char buffer[16];
+	int result = waitMessage("waitBarrier", sock, "BARD", buffer, sizeof(buffer), timeout);
+	if (result < 0)
+	{
+		// waitMessage will print an error message, so just return.
+		return -1;
+	}
+	if (result < 14)
+	{
+		printError("waitBarrier", "Unexpected response length (%i)", result);
+		return -2;
+	}
+	if (frame != NULL)
+	{
+		memcpy(frame, buffer + 6, 4);
+	}
+	switch (buffer[5])
+	{
+	case 0: // Every agent acted
+		return 0;
+	case 1: // Some agents timed out
+		return 1;
+	case 4:
+		printError("waitBarrier", "Actions were submitted for a frame that has already run");
+		return -3;
+	default:
+		printError("waitBarrier", "Unexpected barrier status (%u)", buffer[5]);
+		return -4;
+	}
+}
 /*****************************************************************************/
 /****                    End Configuration functions                      ****/
 /*****************************************************************************/
@@ -428,7 +725,67 @@ int sendDREFs(XPCSocket sock, const char* drefs[], float* values[], int sizes[],
 	return 0;
 }
 
-int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count)
+int typeSize(XPC_VALUE_TYPE type)
+{
+	switch (type)
+	{
+	case XPC_TYPE_FLOAT: return 4;
+	case XPC_TYPE_DOUBLE: return 8;
+	case XPC_TYPE_INT: return 4;
+	case XPC_TYPE_BYTES: return 1;
+	default: return 0;
+	}
+}
+
+int sendTypedDREFs(XPCSocket sock, const char* drefs[], const void* values[], const XPC_VALUE_TYPE types[],
+	int sizes[], int count)
+{
+	// Setup command
+	unsigned char buffer[65536] = "DRFT";
+	int pos = 5;
+	int i; // Iterator
+	for (i = 0; i < count; ++i)
+	{
+		int drefLen = strnlen(drefs[i], 256);
+		int width = typeSize(types[i]);
+		if (drefLen > 255)
+		{
+			printError("sendTypedDREFs", "dref %d is too long. Must be less than 256 characters.", i);
+			return -1;
+		}
+		if (width == 0 || sizes[i] < 0 || sizes[i] > 0xFFFF)
+		{
+			printError("sendTypedDREFs", "dref %d has an invalid type or size.", i);
+			return -2;
+		}
+		if (pos + 1 + drefLen + 3 + sizes[i] * width > 65536)
+		{
+			printError("sendTypedDREFs", "About to overrun the send buffer!");
+			return -4;
+		}
+		// Copy dref to buffer
+		buffer[pos++] = (unsigned char)drefLen;
+		memcpy(buffer + pos, drefs[i], drefLen);
+		pos += drefLen;
+
+		// Copy values to buffer, tagged with their type and count
+		buffer[pos++] = (unsigned char)types[i];
+		buffer[pos++] = (unsigned char)(sizes[i] & 0xFF);
+		buffer[pos++] = (unsigned char)(sizes[i] >> 8);
+		memcpy(buffer + pos, values[i], sizes[i] * width);
+		pos += sizes[i] * width;
+	}
+
+	// Send command
+	if (sendUDP(sock, buffer, pos) < 0)
+	{
+		printError("sendTypedDREFs", "Failed to send command");
+		return -3;
+	}
+	return 0;
+}
+
+int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count, unsigned char flags)
 {
 	// Setup command
 	// 6 byte header + potentially 255 drefs, each 256 chars long.
@@ -449,6 +806,7 @@ int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count)
 		strncpy(buffer + len, drefs[i], drefLen);
 		len += drefLen;
 	}
+	buffer[len++] = flags;
 	// Send Command
 	if (sendUDP(sock, buffer, len) < 0)
 	{
@@ -458,7 +816,7 @@ int sendDREFRequest(XPCSocket sock, const char* drefs[], unsigned char count)
 	return 0;
 }
 
-int getDREFResponse(XPCSocket sock, float* values[], unsigned char count, int sizes[])
+int getDREFResponse(XPCSocket sock, float* values[], unsigned char count, int sizes[], unsigned int* frame)
 {
 	unsigned char buffer[65536];
 	int result = readUDP(sock, buffer, 65536);
@@ -478,21 +836,176 @@ int getDREFResponse(XPCSocket sock, float* values[], unsigned char count, int si
 		printError("getDREFs", "Response was too short. Expected at least 6 bytes, but only got %d.", result);
 		return -2;
 	}
-	if (buffer[5] != count)
+	if (strncmp((char*)buffer, "RESF", 4) == 0)
 	{
-		printError("getDREFs", "Unexpected response size. Expected %d rows, got %d instead.", count, buffer[5]);
+		return readDREFFragments(sock, buffer, result, values, count, sizes, frame);
+	}
+	if (frame != NULL)
+	{
+		printError("getDREFs", "Expected a fragmented response.");
 		return -3;
 	}
+	return readDREFRows("getDREFs", buffer, 5, values, count, sizes);
+}
 
-	int cur = 6;
-    int i; // Iterator
+int readFragments(XPCSocket sock, unsigned char buffer[], int len, unsigned char** payload, unsigned int* total)
+{
+	// Each fragment: [5]=response id, [6]=fragment index, [7]=fragment count, [8-11]=offset,
+	// [12-15]=length of the full response, then the fragment.
+	char head[4];
+	unsigned char received[256];
+	unsigned char id = 0;
+	int remaining = -1;
+	memcpy(head, buffer, 4);
+	*payload = NULL;
+	*total = 0;
+	for (;;)
+	{
+		if (len < 16 || strncmp((char*)buffer, head, 4) != 0)
+		{
+			printError("readFragments", "Unexpected message while reading a fragmented response.");
+			free(*payload);
+			return -3;
+		}
+		// Ids wrap around, so an id up to 127 behind the current one belongs to an older response.
+		unsigned char age = (unsigned char)(id - buffer[5]);
+		if (remaining >= 0 && age != 0 && age < 128)
+		{
+			// A late fragment of an older response. Ignore it.
+		}
+		else
+		{
+			if (remaining < 0 || age != 0)
+			{
+				// Start of a new response. Fragments left over from an earlier response are abandoned.
+				id = buffer[5];
+				remaining = buffer[7];
+				memcpy(total, buffer + 12, 4);
+				free(*payload);
+				*payload = (unsigned char*)malloc(*total > 0 ? *total : 1);
+				if (*payload == NULL)
+				{
+					printError("readFragments", "Failed to allocate %u bytes for the response.", *total);
+					return -4;
+				}
+				memset(received, 0, sizeof(received));
+			}
+
+			unsigned int offset;
+			unsigned int fragmentLen = (unsigned int)(len - 16);
+			memcpy(&offset, buffer + 8, 4);
+			if (offset > *total || fragmentLen > *total - offset)
+			{
+				printError("readFragments", "Fragment %d does not fit in the response.", buffer[6]);
+				free(*payload);
+				return -3;
+			}
+			if (!received[buffer[6]])
+			{
+				received[buffer[6]] = 1;
+				memcpy(*payload + offset, buffer + 16, fragmentLen);
+				--remaining;
+			}
+			if (remaining <= 0)
+			{
+				return 0;
+			}
+		}
+
+		len = readUDP(sock, buffer, 65536);
+		if (len < 0)
+		{
+			printError("readFragments", "Read operation failed with %d fragments missing.", remaining);
+			free(*payload);
+			return -1;
+		}
+	}
+}
+
+int readDREFFragments(XPCSocket sock, unsigned char buffer[], int len, float* values[], unsigned char count, int sizes[],
+	unsigned int* frame)
+{
+	unsigned char* payload;
+	unsigned int total;
+	int result = readFragments(sock, buffer, len, &payload, &total);
+	if (result < 0)
+	{
+		// readFragments will print an error message, so just return.
+		return result;
+	}
+
+	// The full response: [0]=row count, then each row as a 16 bit size followed by the values,
+	// then the frame number if it was requested.
+	if (total < 1 || payload[0] != count)
+	{
+		printError("getDREFs", "Unexpected response size. Expected %d rows, got %d instead.",
+			count, total < 1 ? 0 : payload[0]);
+		free(payload);
+		return -3;
+	}
+	unsigned int cur = 1;
+	int i; // Iterator
 	for (i = 0; i < count; ++i)
 	{
-		int l = buffer[cur++];
+		if (cur + 2 > total)
+		{
+			break;
+		}
+		int l = payload[cur] | (payload[cur + 1] << 8);
+		cur += 2;
+		if (cur + l * sizeof(float) > total)
+		{
+			break;
+		}
 		if (l > sizes[i])
 		{
 			printError("getDREFs", "values is too small. Row had %d values, only room for %d.", l, sizes[i]);
 			// Copy as many values as we can anyway
+			memcpy(values[i], payload + cur, sizes[i] * sizeof(float));
+		}
+		else
+		{
+			memcpy(values[i], payload + cur, l * sizeof(float));
+			sizes[i] = l;
+		}
+		cur += l * sizeof(float);
+	}
+	if (i == count && frame != NULL)
+	{
+		if (cur + 4 > total)
+		{
+			free(payload);
+			printError("getDREFs", "Response did not include the frame number.");
+			return -3;
+		}
+		memcpy(frame, payload + cur, 4);
+	}
+	free(payload);
+	if (i < count)
+	{
+		printError("getDREFs", "Response ended after %d of %d rows.", i, count);
+		return -3;
+	}
+	return 0;
+}
+
+int readDREFRows(char* functionName, unsigned char buffer[], int cur, float* values[], unsigned char count, int sizes[])
+{
+	if (buffer[cur] != count)
+	{
+		printError(functionName, "Unexpected response size. Expected %d rows, got %d instead.", count, buffer[cur]);
+		return -3;
+	}
+
+	cur++;
+	int i; // Iterator
+	for (i = 0; i < count; ++i)
+	{
+		int l = buffer[cur++];
+		if (l > sizes[i])
+		{
+			printError(functionName, "values is too small. Row had %d values, only room for %d.", l, sizes[i]);
+			// Copy as many values as we can anyway
 			memcpy(values[i], buffer + cur, sizes[i] * sizeof(float));
 		}
 		else
@@ -512,8 +1025,21 @@ int getDREF(XPCSocket sock, const char* dref, float values[], int* size)
 
 int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char count, int sizes[])
 {
+	return getDREFsFrame(sock, drefs, values, count, sizes, NULL);
+}
+
+int getDREFsFrame(XPCSocket sock, const char* drefs[], float* values[], unsigned char count, int sizes[],
+	unsigned int* frame)
+{
+	// Allow the response to be split across datagrams, so that large arrays are not truncated.
+	unsigned char flags = 4;
+	if (frame != NULL)
+	{
+		flags |= 16; // Follow the values with the frame they were read in
+	}
+
 	// Send Command
-	int result = sendDREFRequest(sock, drefs, count);
+	int result = sendDREFRequest(sock, drefs, count, flags);
 	if (result < 0)
 	{
 		// A error ocurred while sending.
@@ -522,7 +1048,59 @@ int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char
 	}
 
 	// Read Response
-	if (getDREFResponse(sock, values, count, sizes) < 0)
+	if (getDREFResponse(sock, values, count, sizes, frame) < 0)
+	{
+		// A error ocurred while reading the response.
+		// getDREFResponse will print an error message, so just return.
+		return -2;
+	}
+	return 0;
+}
+
+int prepareDREFs(XPCSocket sock, unsigned char id, const char* drefs[], unsigned char count)
+{
+	// Setup command
+	// 7 byte header + potentially 255 drefs, each 256 chars long.
+	unsigned char buffer[65536] = "PREP";
+	buffer[5] = id;
+	buffer[6] = count;
+	int len = 7;
+	int i; // iterator
+	for (i = 0; i < count; ++i)
+	{
+		size_t drefLen = strnlen(drefs[i], 256);
+		if (drefLen > 255)
+		{
+			printError("prepareDREFs", "dref %d is too long.", i);
+			return -1;
+		}
+		buffer[len++] = (unsigned char)drefLen;
+		strncpy(buffer + len, drefs[i], drefLen);
+		len += drefLen;
+	}
+	// Send Command
+	if (sendUDP(sock, buffer, len) < 0)
+	{
+		printError("prepareDREFs", "Failed to send command");
+		return -2;
+	}
+	return 0;
+}
+
+int getPreparedDREFs(XPCSocket sock, unsigned char id, float* values[], unsigned char count, int sizes[])
+{
+	// Send Command
+	unsigned char buffer[7] = "GETQ";
+	buffer[5] = id;
+	buffer[6] = 4; // Fragmented response, as in getDREFs
+	if (sendUDP(sock, buffer, 7) < 0)
+	{
+		printError("getPreparedDREFs", "Failed to send command");
+		return -1;
+	}
+
+	// Read Response
+	if (getDREFResponse(sock, values, count, sizes, NULL) < 0)
 	{
 		// A error ocurred while reading the response.
 		// getDREFResponse will print an error message, so just return.
@@ -530,6 +1108,245 @@ int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char
 	}
 	return 0;
 }
+
+int getTypedDREFs(XPCSocket sock, const char* drefs[], void* values[], XPC_VALUE_TYPE types[],
+	unsigned char count, int sizes[])
+{
+	// Setup command
+	unsigned char buffer[65536] = "GETD";
+	buffer[5] = count;
+	int len = 6;
+	int i; // iterator
+	for (i = 0; i < count; ++i)
+	{
+		size_t drefLen = strnlen(drefs[i], 256);
+		if (drefLen > 255)
+		{
+			printError("getTypedDREFs", "dref %d is too long.", i);
+			return -1;
+		}
+		buffer[len++] = (unsigned char)drefLen;
+		strncpy(buffer + len, drefs[i], drefLen);
+		len += drefLen;
+	}
+	buffer[len++] = 8; // Typed response
+	if (sendUDP(sock, buffer, len) < 0)
+	{
+		printError("getTypedDREFs", "Failed to send command");
+		return -2;
+	}
+
+	// Read Response
+	len = readUDP(sock, buffer, 65536);
+	if (len < 0)
+	{
+		printError("getTypedDREFs", "Read operation failed.");
+		return -3;
+	}
+	if (len < 16 || strncmp((char*)buffer, "REST", 4) != 0)
+	{
+		printError("getTypedDREFs", "Unexpected response. Expected a REST message.");
+		return -4;
+	}
+	unsigned char* payload;
+	unsigned int total;
+	if (readFragments(sock, buffer, len, &payload, &total) < 0)
+	{
+		// readFragments will print an error message, so just return.
+		return -3;
+	}
+
+	// The full response: [0]=row count, then each row as its type, a 16 bit size and the values.
+	if (total < 1 || payload[0] != count)
+	{
+		printError("getTypedDREFs", "Unexpected response size. Expected %d rows, got %d instead.",
+			count, total < 1 ? 0 : payload[0]);
+		free(payload);
+		return -5;
+	}
+	unsigned int cur = 1;
+	for (i = 0; i < count; ++i)
+	{
+		if (cur + 3 > total)
+		{
+			break;
+		}
+		XPC_VALUE_TYPE type = (XPC_VALUE_TYPE)payload[cur];
+		int l = payload[cur + 1] | (payload[cur + 2] << 8);
+		int width = typeSize(type);
+		cur += 3;
+		if (width == 0 || cur + l * width > total)
+		{
+			break;
+		}
+		types[i] = type;
+		if (l * width > sizes[i])
+		{
+			printError("getTypedDREFs", "values is too small. Row had %d bytes, only room for %d.",
+				l * width, sizes[i]);
+			// Copy as many values as we can anyway
+			memcpy(values[i], payload + cur, sizes[i] - sizes[i] % width);
+			sizes[i] /= width;
+		}
+		else
+		{
+			memcpy(values[i], payload + cur, l * width);
+			sizes[i] = l;
+		}
+		cur += l * width;
+	}
+	free(payload);
+	if (i < count)
+	{
+		printError("getTypedDREFs", "Response ended after %d of %d rows.", i, count);
+		return -5;
+	}
+	return 0;
+}
+
+int getPreparedDREFDeltas(XPCSocket sock, unsigned char id, float* values[], unsigned char count, int sizes[],
+	int refresh)
+{
+	// Send Command
+	unsigned char buffer[65536] = "GETQ";
+	buffer[5] = id;
+	buffer[6] = refresh ? 3 : 1; // Delta response, keyframe
+	if (sendUDP(sock, buffer, 7) < 0)
+	{
+		printError("getPreparedDREFDeltas", "Failed to send command");
+		return -1;
+	}
+
+	// Read Response
+	int result = readUDP(sock, buffer, 65536);
+	if (result < 0)
+	{
+#ifdef _WIN32
+		printError("getPreparedDREFDeltas", "Read operation failed. (%d)", WSAGetLastError());
+#else
+		printError("getPreparedDREFDeltas", "Read operation failed.");
+#endif
+		return -2;
+	}
+	if (result < 7 || strncmp((char*)buffer, "RESD", 4) != 0)
+	{
+		printError("getPreparedDREFDeltas", "Unexpected response. Expected a RESD message of at least 7 bytes.");
+		return -3;
+	}
+	if (buffer[5] & 2)
+	{
+		// Keyframes are laid out exactly like a RESP message.
+		if (readDREFRows("getPreparedDREFDeltas", buffer, 6, values, count, sizes) < 0)
+		{
+			return -4;
+		}
+		return 0;
+	}
+	if (buffer[6] != count)
+	{
+		printError("getPreparedDREFDeltas", "Unexpected response size. Expected %d rows, got %d instead.",
+			count, buffer[6]);
+		return -4;
+	}
+
+	// Apply the changed values on top of the previous response.
+	int cur = 7;
+	int i; // Iterator
+	for (i = 0; i < count; ++i)
+	{
+		int l = buffer[cur++];
+		unsigned char* bitmap = buffer + cur;
+		cur += (l + 7) / 8;
+		int j;
+		for (j = 0; j < l; ++j)
+		{
+			if (bitmap[j / 8] & (1 << (j % 8)))
+			{
+				if (j < sizes[i])
+				{
+					memcpy(values[i] + j, buffer + cur, sizeof(float));
+				}
+				cur += sizeof(float);
+			}
+		}
+		if (l > sizes[i])
+		{
+			printError("getPreparedDREFDeltas", "values is too small. Row had %d values, only room for %d.",
+				l, sizes[i]);
+		}
+		else
+		{
+			sizes[i] = l;
+		}
+	}
+	return 0;
+}
+
+int subscribeDREFs(XPCSocket sock, unsigned char id, const char* drefs[], unsigned char count,
+	SUBS_MODE mode, float rate)
+{
+	// Setup command
+	// 12 byte header + potentially 255 drefs, each 256 chars long.
+	unsigned char buffer[65536] = "SUBS";
+	buffer[5] = id;
+	buffer[6] = (unsigned char)mode;
+	memcpy(buffer + 7, &rate, sizeof(float));
+	buffer[11] = count;
+	int len = 12;
+	int i; // iterator
+	for (i = 0; i < count; ++i)
+	{
+		size_t drefLen = strnlen(drefs[i], 256);
+		if (drefLen > 255)
+		{
+			printError("subscribeDREFs", "dref %d is too long.", i);
+			return -1;
+		}
+		buffer[len++] = (unsigned char)drefLen;
+		strncpy(buffer + len, drefs[i], drefLen);
+		len += drefLen;
+	}
+	// Send Command
+	if (sendUDP(sock, buffer, len) < 0)
+	{
+		printError("subscribeDREFs", "Failed to send command");
+		return -2;
+	}
+	return 0;
+}
+
+int unsubscribeDREFs(XPCSocket sock, unsigned char id)
+{
+	return subscribeDREFs(sock, id, NULL, 0, XPC_SUBS_NONE, 0.0F);
+}
+
+int readSubscription(XPCSocket sock, unsigned char* id, float* values[], unsigned char count, int sizes[])
+{
+	unsigned char buffer[65536];
+	int result = readUDP(sock, buffer, 65536);
+	if (result < 0)
+	{
+#ifdef _WIN32
+		printError("readSubscription", "Read operation failed. (%d)", WSAGetLastError());
+#else
+		printError("readSubscription", "Read operation failed.");
+#endif
+		return -1;
+	}
+	if (result < 7 || strncmp((char*)buffer, "SUBD", 4) != 0)
+	{
+		printError("readSubscription", "Unexpected response. Expected a SUBD message of at least 7 bytes.");
+		return -2;
+	}
+
+	*id = buffer[5];
+	if (readDREFRows("readSubscription", buffer, 6, values, count, sizes) < 0)
+	{
+		// readDREFRows will print an error message, so just return.
+		return -3;
+	}
+	return 0;
+}
 /*****************************************************************************/
 /****                        End DREF functions                           ****/
 /*****************************************************************************/
@@ -537,6 +1354,59 @@ int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char
 /*****************************************************************************/
 /****                          POSI functions                             ****/
 /*****************************************************************************/
+int sendPOSIs(XPCSocket sock, double* values[], int sizes[], char ac[], int count)
+{
+	// Validate input
+	if (count < 1 || count > 20)
+	{
+		printError("sendPOSIs", "count should be a value between 1 and 20.");
+		return -1;
+	}
+
+	// Setup command
+	// 5 byte header + count + 41 byte record per aircraft
+	unsigned char buffer[6 + 20 * 41] = "POSB";
+	buffer[5] = (unsigned char)count;
+	int i, j; // iterators
+	for (i = 0; i < count; i++)
+	{
+		if (ac[i] < 0 || ac[i] > 19)
+		{
+			printError("sendPOSIs", "aircraft should be a value between 0 and 19.");
+			return -1;
+		}
+		if (sizes[i] < 1 || sizes[i] > 7)
+		{
+			printError("sendPOSIs", "size should be a value between 1 and 7.");
+			return -2;
+		}
+
+		unsigned char* record = buffer + 6 + i * 41;
+		record[0] = ac[i];
+		for (j = 0; j < 7; j++)
+		{
+			double val = j < sizes[i] ? values[i][j] : -998;
+			if (j < 3) /* lat/lon/h */
+			{
+				memcpy(record + 1 + j * 8, &val, sizeof(double));
+			}
+			else /* attitude and gear */
+			{
+				float f = (float)val;
+				memcpy(record + 13 + j * 4, &f, sizeof(float));
+			}
+		}
+	}
+
+	// Send Command
+	if (sendUDP(sock, buffer, 6 + count * 41) < 0)
+	{
+		printError("sendPOSIs", "Failed to send command");
+		return -3;
+	}
+	return 0;
+}
+
 int getPOSI(XPCSocket sock, float values[7], char ac)
 {
 	// Setup send command
@@ -570,6 +1440,65 @@ int getPOSI(XPCSocket sock, float values[7], char ac)
 	return 0;
 }
 
+int getPOSIPrecise(XPCSocket sock, double values[7], char ac)
+{
+	return getPOSIResponse("getPOSIPrecise", sock, values, ac, NULL);
+}
+
+int getPOSIFrame(XPCSocket sock, double values[7], char ac, unsigned int* frame)
+{
+	return getPOSIResponse("getPOSIFrame", sock, values, ac, frame);
+}
+
+int getPOSIResponse(char* functionName, XPCSocket sock, double values[7], char ac, unsigned int* frame)
+{
+	// Setup send command
+	unsigned char buffer[7] = "GETP";
+	buffer[5] = ac;
+	buffer[6] = 1; // Send lat/lon/h as doubles
+	if (frame != NULL)
+	{
+		buffer[6] |= 2; // Follow the position with the frame it was read in
+	}
+
+	// Send command
+	if (sendUDP(sock, buffer, 7) < 0)
+	{
+		printError(functionName, "Failed to send command.");
+		return -1;
+	}
+
+	// Get response
+	int expected = frame != NULL ? 50 : 46;
+	unsigned char readBuffer[50];
+	int readResult = readUDP(sock, readBuffer, 50);
+	if (readResult < 0)
+	{
+		printError(functionName, "Failed to read response.");
+		return -2;
+	}
+	if (readResult != expected)
+	{
+		printError(functionName, "Unexpected response length.");
+		return -3;
+	}
+
+	// Copy response into values
+	float orient[4];
+	memcpy(values, readBuffer + 6, 3 * sizeof(double));
+	memcpy(orient, readBuffer + 30, 4 * sizeof(float));
+	int i; // Iterator
+	for (i = 0; i < 4; ++i)
+	{
+		values[3 + i] = orient[i];
+	}
+	if (frame != NULL)
+	{
+		memcpy(frame, readBuffer + 46, 4);
+	}
+	return 0;
+}
+
 int sendPOSI(XPCSocket sock, double values[], int size, char ac)
 {
 	// Validate input
@@ -79,6 +79,21 @@ typedef enum
 	XPC_VIEW_FULLSCREENNOHUD,
 } VIEW_TYPE;
 
+typedef enum
+{
+	XPC_SUBS_NONE = 0,
+	XPC_SUBS_FRAMES = 1,
+	XPC_SUBS_HZ = 2
+} SUBS_MODE;
+
+typedef enum
+{
+	XPC_TYPE_FLOAT = 1,
+	XPC_TYPE_DOUBLE = 2,
+	XPC_TYPE_INT = 3,
+	XPC_TYPE_BYTES = 4
+} XPC_VALUE_TYPE;
+
 // Low Level UDP Functions
 
 /// Opens a new connection to XPC on an OS chosen port.
@@ -100,6 +115,19 @@ XPCSocket aopenUDP(const char *xpIP, unsigned short xpPort, unsigned short port)
 /// \param sock The socket to close.
 void closeUDP(XPCSocket sock);
 
+/// Sends several commands to XPC in a single datagram.
+///
+/// \details Each command must be encoded exactly as it would be sent on its own. The datagram
+///          starts with the header "XPC2" and a reserved 0 byte, and each command is preceded by
+///          its length as a 16 bit little-endian integer. Older versions of the plugin do not
+///          understand this format.
+/// \param sock     The socket to use to send the commands.
+/// \param messages The encoded commands.
+/// \param sizes    The length of each command in bytes.
+/// \param count    The number of commands.
+/// \returns        0 if successful, otherwise a negative value.
+int sendFramed(XPCSocket sock, const unsigned char* messages[], const int sizes[], int count);
+
 // Configuration
 
 /// Sets the port on which the socket sends and receives data.
@@ -116,6 +144,80 @@ int setCONN(XPCSocket* sock, unsigned short port);
 /// \returns    0 if successful, otherwise a negative value.
 int pauseSim(XPCSocket sock, char pause);
 
+/// Runs the simulation for a fixed number of frames, then pauses it again.
+///
+/// \details The plugin unpauses every aircraft, counts flight model frames, and pauses them again
+///          after the last one. This function blocks until the plugin reports that the step is
+///          done, so the caller can advance the sim in lockstep with its own model. Only one step
+///          can run at a time, across all clients.
+/// \param sock    The socket to use to send the command.
+/// \param frames  The number of frames to run, at least 1.
+/// \param timeout The longest time to wait for the step to finish, in milliseconds.
+/// \param frame   If not NULL, set to the total number of frames the plugin has stepped,
+///                including this step. The count keeps increasing across steps.
+/// \returns       0 if successful, otherwise a negative value.
+int stepSim(XPCSocket sock, unsigned int frames, int timeout, unsigned int* frame);
+
+/// Runs the simulation for a fixed number of frames, then gets the values of a prepared query
+/// from the paused sim.
+///
+/// \details Works like stepSim, except that the plugin reads the query as soon as the sim is
+///          paused again, saving a round trip per step.
+/// \param sock    The socket to use to send the command.
+/// \param frames  The number of frames to run, at least 1.
+/// \param timeout The longest time to wait for the step to finish, in milliseconds.
+/// \param frame   If not NULL, set to the total number of frames the plugin has stepped.
+/// \param id      The id of a query registered with prepareDREFs.
+/// \param values  A 2D array in which the values of the datarefs will be stored.
+/// \param count   The number of datarefs in the query.
+/// \param sizes   The number of elements in each row of values. The size of each row will be
+///                set to the actual number of elements copied in for that row.
+/// \returns       0 if successful, otherwise a negative value.
+int stepSimDREFs(XPCSocket sock, unsigned int frames, int timeout, unsigned int* frame,
+	unsigned char id, float* values[], unsigned char count, int sizes[]);
+
+/// Registers this client as an agent in the multi-agent barrier.
+///
+/// \details While any agent is registered, the sim stays paused and only the barrier advances it.
+///          Writes from agents (CTRL, POSI, DREF and so on) are held by the plugin instead of being
+///          applied. Once every agent has called submitActions for the current frame, the plugin
+///          applies all of the held writes in the same flight loop pass, runs the sim for a fixed
+///          number of frames and pauses it again. Use waitBarrier to wait for that to happen.
+///          If some agents have not submitted within the timeout after the first one did, the
+///          plugin advances without them. The sim stays paused after the last agent leaves.
+/// \param sock    The socket to use to send the command.
+/// \param timeout The longest time to wait for the other agents, in seconds. Shared by all agents;
+///                the last agent to join sets it.
+/// \param frames  The number of frames to run each time every agent has acted. Shared by all
+///                agents, like timeout.
+/// \param frame   If not NULL, set to the number of the frame the agents are acting for.
+/// \returns       0 if successful, otherwise a negative value.
+int joinBarrier(XPCSocket sock, float timeout, unsigned int frames, unsigned int* frame);
+
+/// Stops taking part in the multi-agent barrier. Any writes still held for this client are
+/// discarded.
+///
+/// \param sock The socket to use to send the command.
+/// \returns    0 if successful, otherwise a negative value.
+int leaveBarrier(XPCSocket sock);
+
+/// Tells the plugin that this agent has sent all of its actions for a frame.
+///
+/// \param sock  The socket to use to send the command.
+/// \param frame The number of the frame the actions are for, from joinBarrier or waitBarrier.
+/// \returns     0 if successful, otherwise a negative value.
+int submitActions(XPCSocket sock, unsigned int frame);
+
+/// Waits for the multi-agent barrier to advance the sim.
+///
+/// \param sock    The socket to read from.
+/// \param timeout The longest time to wait, in milliseconds.
+/// \param frame   If not NULL, set to the number of the frame the agents should act for next.
+/// \returns       0 if every agent acted, 1 if the sim advanced without the agents that did not
+///                submit in time, otherwise a negative value. -3 means this agent's actions were
+///                submitted for a frame that had already run, and were discarded.
+int waitBarrier(XPCSocket sock, int timeout, unsigned int* frame);
+
 // X-Plane UDP DATA
 
 /// Reads X-Plane data from the specified socket.
@@ -185,6 +287,8 @@ int getDREF(XPCSocket sock, const char* dref, float values[], int* size);
 ///          http://www.xsquawkbox.net/xpsdk/docs/DataRefs.html. The size of values should match
 ///          the size given on that page. XPC currently sends all values as floats regardless of
 ///          the type described on the wiki. This doesn't cause any data loss for most datarefs.
+///          Responses too large for one datagram are split by the plugin and reassembled here,
+///          so arrays are returned in full regardless of their size.
 /// \param sock   The socket to use to send the command.
 /// \param drefs  The names of the datarefs to get.
 /// \param values A 2D array in which the values of the datarefs will be stored.
@@ -194,6 +298,134 @@ int getDREF(XPCSocket sock, const char* dref, float values[], int* size);
 /// \returns      0 if successful, otherwise a negative value.
 int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char count, int sizes[]);
 
+/// Gets the values of the specified datarefs, and the X-Plane frame they were read in.
+///
+/// \details The plugin may answer from a copy of the datarefs taken at the end of the last
+///          frame instead of waiting for the next one. The frame number tells how old the
+///          values are, and whether two responses were read in the same frame.
+/// \param sock   The socket to use to send the command.
+/// \param drefs  The names of the datarefs to get.
+/// \param values A 2D array in which the values of the datarefs will be stored.
+/// \param count  The number of datarefs being requested.
+/// \param size   The number of elements in each row of values. The size of each row will be set
+///               to the actual number of elements copied in for that row.
+/// \param frame  Set to the frame number the values were read in.
+/// \returns      0 if successful, otherwise a negative value.
+int getDREFsFrame(XPCSocket sock, const char* drefs[], float* values[], unsigned char count, int sizes[],
+	unsigned int* frame);
+
+/// Gets the values of the specified datarefs in their native X-Plane types.
+///
+/// \details Unlike getDREFs, values are not converted to float. Double datarefs such as the
+///          aircraft position are returned with full precision, and int arrays and byte
+///          datarefs are returned exactly.
+/// \param sock   The socket to use to send the command.
+/// \param drefs  The names of the datarefs to get.
+/// \param values An array of buffers in which the values of each dataref will be stored.
+/// \param types  An array in which the type of the values of each dataref will be stored.
+/// \param count  The number of datarefs being requested.
+/// \param sizes  The size in bytes of each buffer in values. Each size will be set to the
+///               number of elements copied into that buffer.
+/// \returns      0 if successful, otherwise a negative value.
+int getTypedDREFs(XPCSocket sock, const char* drefs[], void* values[], XPC_VALUE_TYPE types[],
+	unsigned char count, int sizes[]);
+
+/// Registers a list of datarefs with the plugin so they can be read repeatedly by id.
+///
+/// \details The plugin looks up each dataref once when the query is prepared, so reading
+///          the query with getPreparedDREFs is cheaper than repeating the same getDREFs
+///          request. Each client can prepare up to 32 queries at once. Preparing a query with
+///          an id that is already in use replaces it.
+/// \param sock  The socket to use to send the command.
+/// \param id    The id of the query, from 0 to 31.
+/// \param drefs The names of the datarefs in the query.
+/// \param count The number of datarefs in the query.
+/// \returns     0 if successful, otherwise a negative value.
+int prepareDREFs(XPCSocket sock, unsigned char id, const char* drefs[], unsigned char count);
+
+/// Gets the values of the datarefs in a query registered with prepareDREFs.
+///
+/// \param sock   The socket to use to send the command.
+/// \param id     The id of the query.
+/// \param values A 2D array in which the values of the datarefs will be stored.
+/// \param count  The number of datarefs in the query.
+/// \param sizes  The number of elements in each row of values. The size of each row will be set
+///               to the actual number of elements copied in for that row.
+/// \returns      0 if successful, otherwise a negative value.
+int getPreparedDREFs(XPCSocket sock, unsigned char id, float* values[], unsigned char count, int sizes[]);
+
+/// Gets the values of the datarefs in a prepared query, receiving only the values that changed.
+///
+/// \details The plugin remembers the values it last sent for the query and sends only the
+///          values that have changed since, plus a full set of values every 30 responses.
+///          values must still hold the result of the previous call, which the changes are
+///          applied to. Set refresh on the first call for a query, and after any call that
+///          fails, so that the plugin sends every value.
+/// \param sock    The socket to use to send the command.
+/// \param id      The id of the query.
+/// \param values  A 2D array holding the values from the previous call, which will be updated.
+/// \param count   The number of datarefs in the query.
+/// \param sizes   The number of elements in each row of values. The size of each row will be set
+///                to the actual number of elements in that row.
+/// \param refresh Non-zero to request every value instead of only the changed values.
+/// \returns       0 if successful, otherwise a negative value.
+int getPreparedDREFDeltas(XPCSocket sock, unsigned char id, float* values[], unsigned char count, int sizes[],
+	int refresh);
+
+/// Asks the plugin to send the values of a query periodically without being polled.
+///
+/// \details The plugin pushes the values from its flight loop, starting with the frame in
+///          which the subscription is received. Read them with readSubscription. Subscribing
+///          to a query replaces any previous subscription with the same id. The plugin forgets
+///          a client that has sent nothing for five minutes, so long running subscribers should
+///          renew their subscriptions before then.
+/// \param sock  The socket to use to send the command. Values are pushed to the port this
+///              socket is bound to.
+/// \param id    The id of the query, from 0 to 31.
+/// \param drefs The names of the datarefs in the query, or NULL to subscribe to a query
+///              already registered with prepareDREFs.
+/// \param count The number of datarefs in drefs, or 0 to use a prepared query.
+/// \param mode  XPC_SUBS_FRAMES to send the values every rate frames, or XPC_SUBS_HZ to send
+///              them rate times per second. The plugin never sends a query more than once
+///              per frame.
+/// \param rate  The number of frames between updates, or the update rate in Hz.
+/// \returns     0 if successful, otherwise a negative value.
+int subscribeDREFs(XPCSocket sock, unsigned char id, const char* drefs[], unsigned char count,
+	SUBS_MODE mode, float rate);
+
+/// Stops the plugin from sending the values of a query. The query itself stays prepared.
+///
+/// \param sock The socket to use to send the command.
+/// \param id   The id of the query.
+/// \returns    0 if successful, otherwise a negative value.
+int unsubscribeDREFs(XPCSocket sock, unsigned char id);
+
+/// Reads the next set of values pushed by the plugin for a subscription.
+///
+/// \param sock   The socket to read from.
+/// \param id     Set to the id of the query the values belong to.
+/// \param values A 2D array in which the values of the datarefs will be stored.
+/// \param count  The number of datarefs in the query.
+/// \param sizes  The number of elements in each row of values. The size of each row will be set
+///               to the actual number of elements copied in for that row.
+/// \returns      0 if successful, otherwise a negative value.
+int readSubscription(XPCSocket sock, unsigned char* id, float* values[], unsigned char count, int sizes[]);
+
+/// Sets the specified datarefs from values of any type.
+///
+/// \details Values that match the type of their dataref are set without any conversion, so
+///          this function can set doubles and the full range of ints exactly. Other values are
+///          converted to float, as with sendDREFs.
+/// \param sock   The socket to use to send the command.
+/// \param drefs  The names of the datarefs to set.
+/// \param values An array of buffers holding the values for each dataref.
+/// \param types  The type of the values for each dataref.
+/// \param sizes  The number of elements in each buffer in values, at most 65535.
+/// \param count  The number of datarefs to set.
+/// \returns      0 if successful, otherwise a negative value.
+int sendTypedDREFs(XPCSocket sock, const char* drefs[], const void* values[], const XPC_VALUE_TYPE types[],
+	int sizes[], int count);
+
 // Position
 
 /// Gets the position and orientation of the specified aircraft.
@@ -204,6 +436,27 @@ int getDREFs(XPCSocket sock, const char* drefs[], float* values[], unsigned char
 /// \returns      0 if successful, otherwise a negative value.
 int getPOSI(XPCSocket sock, float values[7], char ac);
 
+/// Gets the position and orientation of the specified aircraft, with the position in double
+/// precision.
+///
+/// \param sock   The socket used to send the command and receive the response.
+/// \param values An array to store the position information returned by the
+///               plugin. The format of values is [Lat, Lon, Alt, Pitch, Roll, Yaw, Gear]
+/// \param ac     The aircraft number to get the position of. 0 for the main/player aircraft.
+/// \returns      0 if successful, otherwise a negative value.
+int getPOSIPrecise(XPCSocket sock, double values[7], char ac);
+
+/// Gets the position and orientation of the specified aircraft in double precision, and the
+/// X-Plane frame they were read in.
+///
+/// \param sock   The socket used to send the command and receive the response.
+/// \param values An array to store the position information returned by the
+///               plugin. The format of values is [Lat, Lon, Alt, Pitch, Roll, Yaw, Gear]
+/// \param ac     The aircraft number to get the position of. 0 for the main/player aircraft.
+/// \param frame  Set to the frame number the position was read in.
+/// \returns      0 if successful, otherwise a negative value.
+int getPOSIFrame(XPCSocket sock, double values[7], char ac, unsigned int* frame);
+
 /// Sets the position and orientation of the specified aircraft.
 ///
 /// \param sock   The socket to use to send the command.
@@ -215,6 +468,19 @@ int getPOSI(XPCSocket sock, float values[7], char ac);
 /// \returns      0 if successful, otherwise a negative value.
 int sendPOSI(XPCSocket sock, double values[], int size, char ac);
 
+/// Sets the position and orientation of several aircraft with a single message.
+///
+/// \details This is equivalent to calling sendPOSI for each aircraft, but sends one datagram, so a
+///          full traffic picture can be updated every frame.
+/// \param sock   The socket to use to send the command.
+/// \param values A 2D array with one row of position data per aircraft, in the same format as
+///               sendPOSI.
+/// \param sizes  The number of elements in each row of values.
+/// \param ac     The aircraft number for each row of values. 0 for the player aircraft.
+/// \param count  The number of aircraft to set, from 1 to 20.
+/// \returns      0 if successful, otherwise a negative value.
+int sendPOSIs(XPCSocket sock, double* values[], int sizes[], char ac[], int count);
+
 // Controls
 
 /// Gets the control surface information for the specified aircraft.
@@ -110,6 +110,33 @@ int testGETD_TestFloat()
 	return result;
 }
 
+int testGETD_Large()
+{
+	// The request (about 3KB) fits in the plugin's 4KB receive buffer, but
+	// 100 rows of 40 values (about 16KB) do not fit in a single response,
+	// so it must be split and reassembled without truncating any row.
+	char* drefs[100];
+	int sizes[100];
+	float* expected[100];
+	for (int i = 0; i < 100; ++i)
+	{
+		drefs[i] = "sim/aircraft/view/acf_tailnum"; //byte[40]
+		sizes[i] = 40;
+		expected[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		for (int j = 0; j < sizes[i]; ++j)
+		{
+			expected[i][j] = NAN;
+		}
+	}
+
+	int result = doGETDTest(drefs, expected, 100, sizes);
+	for (int i = 0; i < 100; ++i)
+	{
+		free(expected[i]);
+	}
+	return result;
+}
+
 int testGETD_Types()
 {
 	char* drefs[] =
@@ -171,6 +198,253 @@ int testGETD_Types()
 	return 0;
 }
 
+int testGETD_Typed()
+{
+	const char* drefs[] =
+	{
+		"sim/flightmodel/position/latitude", //double
+		"sim/aircraft/prop/acf_prop_type", //int[8]
+		"sim/aircraft/view/acf_tailnum", //byte[40]
+		"sim/test/test_float" //float
+	};
+	XPC_VALUE_TYPE expected[] = { XPC_TYPE_DOUBLE, XPC_TYPE_INT, XPC_TYPE_BYTES, XPC_TYPE_FLOAT };
+	int expectedSizes[] = { 1, 8, 40, 1 };
+	double latitude;
+	int propType[8];
+	char tailnum[40];
+	float testFloat = 0.0F;
+	void* values[] = { &latitude, propType, tailnum, &testFloat };
+	int sizes[] = { sizeof(latitude), sizeof(propType), sizeof(tailnum), sizeof(testFloat) };
+	XPC_VALUE_TYPE types[4];
+
+	// Set a float value exactly, then read every dataref back in its own type.
+	float value = 1.5F;
+	const void* setValues[] = { &value };
+	XPC_VALUE_TYPE setTypes[] = { XPC_TYPE_FLOAT };
+	int setSizes[] = { 1 };
+	XPCSocket sock = openUDP(IP);
+	int result = sendTypedDREFs(sock, &drefs[3], setValues, setTypes, setSizes, 1);
+	if (result >= 0)
+	{
+		result = getTypedDREFs(sock, drefs, values, types, 4, sizes);
+	}
+	value = 0.0F;
+	sendTypedDREFs(sock, &drefs[3], setValues, setTypes, setSizes, 1);
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (types[i] != expected[i])
+		{
+			return -10 - i;
+		}
+		if (sizes[i] != expectedSizes[i])
+		{
+			return -20 - i;
+		}
+	}
+	if (testFloat != 1.5F)
+	{
+		return -30;
+	}
+	return 0;
+}
+
+int testGETD_Frame()
+{
+	const char* drefs[] =
+	{
+		"sim/cockpit/autopilot/altitude", //float
+		"sim/aircraft/prop/acf_prop_type" //int[8]
+	};
+	float altitude;
+	float propType[8];
+	float* values[] = { &altitude, propType };
+	int sizes[] = { 1, 8 };
+	unsigned int first = 0;
+	unsigned int second = 0;
+
+	// Ask twice. The second request may be answered from the snapshot of the
+	// frame the first one was read in, but never from an earlier frame.
+	XPCSocket sock = openUDP(IP);
+	int result = getDREFsFrame(sock, drefs, values, 2, sizes, &first);
+	if (result >= 0)
+	{
+		result = getDREFsFrame(sock, drefs, values, 2, sizes, &second);
+	}
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	if (sizes[0] != 1 || sizes[1] != 8)
+	{
+		return -10;
+	}
+	if (first == 0 || second < first)
+	{
+		return -20;
+	}
+	return 0;
+}
+
+int testGETQ()
+{
+	char* drefs[] =
+	{
+		"sim/test/test_float",
+		"sim/aircraft/prop/acf_prop_type", //int[8]
+		"sim/cockpit2/switches/panel_brightness_ratio" //float[4]
+	};
+	int sizes[] = { 1, 8, 4 };
+	float* expected[3];
+	float* actual[3];
+	int asizes[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		expected[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		actual[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		for (int j = 0; j < sizes[i]; ++j)
+		{
+			expected[i][j] = NAN;
+		}
+	}
+	expected[0][0] = 0.0F;
+
+	// Execute command. Read the prepared query twice to make sure it is kept.
+	XPCSocket sock = openUDP(IP);
+	int result = prepareDREFs(sock, 3, drefs, 3);
+	for (int n = 0; n < 2 && result >= 0; ++n)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			asizes[i] = sizes[i];
+		}
+		result = getPreparedDREFs(sock, 3, actual, 3, asizes);
+		if (result >= 0)
+		{
+			result = compareArrays(expected, sizes, actual, asizes, 3);
+		}
+	}
+	closeUDP(sock);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		free(expected[i]);
+		free(actual[i]);
+	}
+	return result;
+}
+
+int testGETQDelta()
+{
+	char* drefs[] =
+	{
+		"sim/test/test_float",
+		"sim/cockpit2/switches/panel_brightness_ratio" //float[4]
+	};
+	int sizes[] = { 1, 4 };
+	float* expected[2];
+	float* actual[2];
+	int asizes[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		expected[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		actual[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		for (int j = 0; j < sizes[i]; ++j)
+		{
+			expected[i][j] = NAN;
+		}
+	}
+	expected[0][0] = 0.0F;
+
+	// Execute command. The first read gets every value, later reads only
+	// changes, which must leave the full arrays intact.
+	XPCSocket sock = openUDP(IP);
+	int result = prepareDREFs(sock, 4, drefs, 2);
+	for (int n = 0; n < 3 && result >= 0; ++n)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			asizes[i] = sizes[i];
+		}
+		result = getPreparedDREFDeltas(sock, 4, actual, 2, asizes, n == 0);
+		if (result >= 0)
+		{
+			result = compareArrays(expected, sizes, actual, asizes, 2);
+		}
+	}
+	closeUDP(sock);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		free(expected[i]);
+		free(actual[i]);
+	}
+	return result;
+}
+
+int testSUBS()
+{
+	char* drefs[] =
+	{
+		"sim/test/test_float",
+		"sim/cockpit2/switches/panel_brightness_ratio" //float[4]
+	};
+	int sizes[] = { 1, 4 };
+	float* expected[2];
+	float* actual[2];
+	int asizes[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		expected[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		actual[i] = (float*)malloc(sizeof(float) * sizes[i]);
+		for (int j = 0; j < sizes[i]; ++j)
+		{
+			expected[i][j] = NAN;
+		}
+	}
+	expected[0][0] = 0.0F;
+
+	// Execute command. Read several pushed updates without polling.
+	XPCSocket sock = openUDP(IP);
+	int result = subscribeDREFs(sock, 5, drefs, 2, XPC_SUBS_FRAMES, 1.0F);
+	for (int n = 0; n < 3 && result >= 0; ++n)
+	{
+		unsigned char id = 0;
+		for (int i = 0; i < 2; ++i)
+		{
+			asizes[i] = sizes[i];
+		}
+		result = readSubscription(sock, &id, actual, 2, asizes);
+		if (result >= 0 && id != 5)
+		{
+			result = -10;
+		}
+		if (result >= 0)
+		{
+			result = compareArrays(expected, sizes, actual, asizes, 2);
+		}
+	}
+	if (result >= 0)
+	{
+		result = unsubscribeDREFs(sock, 5);
+	}
+	closeUDP(sock);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		free(expected[i]);
+		free(actual[i]);
+	}
+	return result;
+}
+
 int testDREF()
 {
 	char* drefs[] =
@@ -244,4 +518,54 @@ int testDREF()
 	return doDREFTest(drefs, values, expected, 6, sizes);
 }
 
+int testDREF_Framed()
+{
+	char* drefs[] =
+	{
+		"sim/cockpit/autopilot/altitude", //float
+		"sim/cockpit2/switches/panel_brightness_ratio" //float[4]
+	};
+	// The bytes of the altitude spell "DREF", which the legacy format would
+	// have taken for the start of another message.
+	unsigned char altitude[5 + 1 + 30 + 1 + 4] = "DREF";
+	unsigned char brightness[5 + 1 + 44 + 1 + 16] = "DREF";
+	const unsigned char* messages[2] = { altitude, brightness };
+	int messageSizes[2] = { sizeof(altitude), sizeof(brightness) };
+	float expectedAltitude;
+	float expectedBrightness[4] = { 0.75F, 0.75F, 0.75F, 0.75F };
+	memcpy(&expectedAltitude, "DREF", 4);
+
+	altitude[5] = 30;
+	memcpy(altitude + 6, drefs[0], 30);
+	altitude[36] = 1;
+	memcpy(altitude + 37, &expectedAltitude, 4);
+
+	brightness[5] = 44;
+	memcpy(brightness + 6, drefs[1], 44);
+	brightness[50] = 4;
+	memcpy(brightness + 51, expectedBrightness, 16);
+
+	// Execute command
+	float actualAltitude;
+	float actualBrightness[4];
+	float* actual[2] = { &actualAltitude, actualBrightness };
+	float* expected[2] = { &expectedAltitude, expectedBrightness };
+	int sizes[2] = { 1, 4 };
+	int asizes[2] = { 1, 4 };
+	XPCSocket sock = openUDP(IP);
+	int result = sendFramed(sock, messages, messageSizes, 2);
+	if (result >= 0)
+	{
+		result = getDREFs(sock, drefs, actual, 2, asizes);
+	}
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	// Test sizes and values
+	return compareArrays(expected, sizes, actual, asizes, 2);
+}
+
 #endif
@@ -155,4 +155,103 @@ int testGetPOSI_NonPlayer()
 	return doGETPTest(POSI, 3, POSI);
 }
 
+int testGetPOSI_Precise()
+{
+	// More digits than a float can hold. Set them, then read them back without
+	// losing precision.
+	double POSI[7] = { 37.5241234567, -122.0689912345, 2500.125, 0, 0, 0, 1 };
+	double actual[7];
+	XPCSocket sock = openUDP(IP);
+	int result = sendPOSI(sock, POSI, 7, 0);
+	if (result >= 0)
+	{
+		result = getPOSIPrecise(sock, actual, 0);
+	}
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	if (fabs(POSI[0] - actual[0]) > 1e-8 || fabs(POSI[1] - actual[1]) > 1e-8)
+	{
+		return -10;
+	}
+	if (fabs(POSI[2] - actual[2]) > 1e-3)
+	{
+		return -12;
+	}
+	return 0;
+}
+
+int testGetPOSI_Frame()
+{
+	double POSI[7] = { 37.5241234567, -122.0689912345, 2500.125, 0, 0, 0, 1 };
+	double actual[7];
+	unsigned int first = 0;
+	unsigned int second = 0;
+	XPCSocket sock = openUDP(IP);
+	int result = sendPOSI(sock, POSI, 7, 0);
+	if (result >= 0)
+	{
+		result = getPOSIFrame(sock, actual, 0, &first);
+	}
+	if (result >= 0)
+	{
+		result = getPOSIFrame(sock, actual, 0, &second);
+	}
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	if (fabs(POSI[0] - actual[0]) > 1e-8 || fabs(POSI[1] - actual[1]) > 1e-8)
+	{
+		return -10;
+	}
+	if (first == 0 || second < first)
+	{
+		return -20;
+	}
+	return 0;
+}
+
+int testPOSI_Batch()
+{
+	// Move the player and two multiplayer aircraft with one message, then
+	// read each of them back.
+	double player[7] = { 37.524, -122.06899, 2500, 0, 0, 0, 1 };
+	double plane1[7] = { 37.525, -122.069, 2600, 5, 10, 90, 0 };
+	double plane2[3] = { 37.526, -122.070, 2700 };
+	double* values[] = { player, plane1, plane2 };
+	int sizes[] = { 7, 7, 3 };
+	char ac[] = { 0, 1, 2 };
+	float actual[3][7];
+
+	XPCSocket sock = openUDP(IP);
+	int result = sendPOSIs(sock, values, sizes, ac, 3);
+	for (int i = 0; i < 3 && result >= 0; ++i)
+	{
+		result = getPOSI(sock, actual[i], ac[i]);
+	}
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < sizes[i]; ++j)
+		{
+			if (fabs(values[i][j] - actual[i][j]) > 1e-2)
+			{
+				return -10 * (i + 1) - j;
+			}
+		}
+	}
+	return 0;
+}
+
 #endif
@@ -78,4 +78,127 @@ int testSIMU_Toggle()
 	return 0;
 }
 
+int testSTEP()
+{
+	char* dref = "sim/operation/override/override_planepath";
+	const char* drefs[] = { dref };
+	float pause[20];
+	float* values[] = { pause };
+	int sizes[] = { 20 };
+	unsigned int first = 0;
+	unsigned int second = 0;
+
+	XPCSocket sock = openUDP(IP);
+	int result = prepareDREFs(sock, 5, drefs, 1);
+	if (result >= 0)
+	{
+		result = stepSim(sock, 1, 5000, &first);
+	}
+	if (result >= 0)
+	{
+		result = stepSimDREFs(sock, 10, 5000, &second, 5, values, 1, sizes);
+	}
+	pauseSim(sock, 0);
+	closeUDP(sock);
+	if (result < 0)
+	{
+		return -1;
+	}
+
+	// The frame counter covers every frame stepped, so it must have advanced by
+	// exactly the second step.
+	if (second - first != 10)
+	{
+		return -2;
+	}
+	// The query is read after the sim is paused again.
+	for (int i = 0; i < 20; ++i)
+	{
+		if (!feq(pause[i], 1))
+		{
+			return -100 - i;
+		}
+	}
+	return 0;
+}
+
+int testBARR()
+{
+	char* dref = "sim/test/test_float";
+	float value = 0;
+	float actual = -1;
+	int size = 1;
+	unsigned int frameA = 0;
+	unsigned int frameB = 0;
+
+	XPCSocket observer = openUDP(IP);
+	XPCSocket agentA = openUDP(IP);
+	XPCSocket agentB = openUDP(IP);
+	int result = sendDREF(observer, dref, &value, 1);
+	if (result >= 0)
+	{
+		result = joinBarrier(agentA, 2.0F, 1, &frameA);
+	}
+	if (result >= 0)
+	{
+		result = joinBarrier(agentB, 2.0F, 1, &frameB);
+	}
+
+	// Agent A acts, but the write is held until agent B has acted as well.
+	value = 42.0F;
+	if (result >= 0)
+	{
+		result = sendDREF(agentA, dref, &value, 1);
+	}
+	if (result >= 0)
+	{
+		result = submitActions(agentA, frameA);
+	}
+	if (result >= 0)
+	{
+		result = getDREF(observer, dref, &actual, &size);
+	}
+	if (result >= 0 && feq(actual, 42.0F))
+	{
+		result = -10;
+	}
+
+	if (result >= 0)
+	{
+		result = submitActions(agentB, frameB);
+	}
+	if (result >= 0)
+	{
+		result = waitBarrier(agentA, 2000, &frameA);
+	}
+	if (result == 0)
+	{
+		result = waitBarrier(agentB, 2000, &frameB);
+	}
+	if (result == 0)
+	{
+		result = getDREF(observer, dref, &actual, &size);
+	}
+
+	leaveBarrier(agentA);
+	leaveBarrier(agentB);
+	pauseSim(observer, 0);
+	closeUDP(agentA);
+	closeUDP(agentB);
+	closeUDP(observer);
+	if (result == -10)
+	{
+		return -2;
+	}
+	if (result != 0)
+	{
+		return -1;
+	}
+	if (frameA != frameB || !feq(actual, 42.0F))
+	{
+		return -3;
+	}
+	return 0;
+}
+
 #endif
@@ -36,13 +36,31 @@ int main(int argc, const char * argv[]) {
 	runTest(testGETD_Types, "GETD (types)");
     crossPlatformUSleep(SLEEP_AMOUNT);
 	runTest(testGETD_TestFloat, "GETD (test float)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testGETD_Large, "GETD (large)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testGETD_Typed, "GETD (typed)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testGETD_Frame, "GETD (frame)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testGETQ, "GETQ");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testGETQDelta, "GETQ (delta)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testSUBS, "SUBS");
     crossPlatformUSleep(SLEEP_AMOUNT);
 	runTest(testDREF, "DREF");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+	runTest(testDREF_Framed, "DREF (framed)");
 	// Pause
     crossPlatformUSleep(SLEEP_AMOUNT);
     runTest(testSIMU_Basic, "SIMU");
     crossPlatformUSleep(SLEEP_AMOUNT);
     runTest(testSIMU_Toggle, "SIMU (toggle)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+    runTest(testSTEP, "STEP");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+    runTest(testBARR, "BARR");
 	// CTRL
     crossPlatformUSleep(SLEEP_AMOUNT);
     runTest(testCTRL_Player, "CTRL (player)");
@@ -63,6 +81,12 @@ int main(int argc, const char * argv[]) {
     runTest(testGetPOSI_Player, "GETP (player)");
     crossPlatformUSleep(SLEEP_AMOUNT);
     runTest(testGetPOSI_NonPlayer, "GETP (non-player)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+    runTest(testGetPOSI_Precise, "GETP (precise)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+    runTest(testGetPOSI_Frame, "GETP (frame)");
+    crossPlatformUSleep(SLEEP_AMOUNT);
+    runTest(testPOSI_Batch, "POSB");
 	// Data
     crossPlatformUSleep(SLEEP_AMOUNT);
     runTest(testDATA, "DATA");
@@ -0,0 +1,225 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "ConnectionRegistry.h"
+#include "Log.h"
+#include "UDPSocket.h"
+
+#include <cstring>
+
+namespace XPC
+{
+	// Only the start of the key can be non-zero: sockaddr_in6 is the largest
+	// address a client can send from.
+	static const std::size_t keySize = sizeof(sockaddr_in6);
+
+	const ConnectionRegistry::Handle ConnectionRegistry::invalidHandle;
+	const std::int32_t ConnectionRegistry::emptyEntry;
+	const std::int32_t ConnectionRegistry::deletedEntry;
+
+	ConnectionRegistry::ConnectionRegistry(std::chrono::seconds idleTimeout)
+		: idleTimeout(idleTimeout), lastSweep(std::chrono::steady_clock::now()), nextId(1),
+		  table(64, emptyEntry), liveEntries(0), usedEntries(0)
+	{
+	}
+
+	void ConnectionRegistry::MakeKey(const sockaddr& addr, Key& key)
+	{
+		std::memset(&key, 0, sizeof(Key));
+		switch (addr.sa_family)
+		{
+		case AF_INET:
+		{
+			const sockaddr_in& in = reinterpret_cast<const sockaddr_in&>(addr);
+			sockaddr_in& out = reinterpret_cast<sockaddr_in&>(key.addr);
+			out.sin_family = AF_INET;
+			out.sin_port = in.sin_port;
+			out.sin_addr = in.sin_addr;
+			break;
+		}
+		default:
+			// Other families are stored in a plain sockaddr, so that is all the
+			// address there is to compare.
+			std::memcpy(&key.addr, &addr, sizeof(sockaddr));
+			break;
+		}
+	}
+
+	std::uint32_t ConnectionRegistry::Hash(const Key& key)
+	{
+		// FNV-1a
+		const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(&key.addr);
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < keySize; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	std::size_t ConnectionRegistry::Find(const Key& key) const
+	{
+		std::size_t mask = table.size() - 1;
+		for (std::size_t i = Hash(key) & mask; table[i] != emptyEntry; i = (i + 1) & mask)
+		{
+			if (table[i] != deletedEntry && std::memcmp(&keys[table[i]].addr, &key.addr, keySize) == 0)
+			{
+				return i;
+			}
+		}
+		return table.size();
+	}
+
+	void ConnectionRegistry::Insert(std::uint32_t slot)
+	{
+		// Keep the table at most half full so probe sequences stay short.
+		if ((usedEntries + 1) * 2 > table.size())
+		{
+			Rehash(liveEntries * 4 > table.size() ? table.size() * 2 : table.size());
+		}
+		std::size_t mask = table.size() - 1;
+		std::size_t i = Hash(keys[slot]) & mask;
+		while (table[i] >= 0)
+		{
+			i = (i + 1) & mask;
+		}
+		if (table[i] == emptyEntry)
+		{
+			++usedEntries;
+		}
+		table[i] = (std::int32_t)slot;
+		++liveEntries;
+	}
+
+	void ConnectionRegistry::Remove(std::uint32_t slot)
+	{
+		std::size_t i = Find(keys[slot]);
+		if (i < table.size())
+		{
+			table[i] = deletedEntry;
+			--liveEntries;
+		}
+	}
+
+	void ConnectionRegistry::Free(std::uint32_t slot)
+	{
+		Remove(slot);
+		slots[slot] = Connection(); // Releases the saved queries and clears the id
+		freeSlots.push_back(slot);
+	}
+
+	void ConnectionRegistry::Rehash(std::size_t size)
+	{
+		std::vector<std::int32_t> old(size, emptyEntry);
+		old.swap(table);
+		liveEntries = 0;
+		usedEntries = 0;
+		for (std::size_t i = 0; i < old.size(); ++i)
+		{
+			if (old[i] >= 0)
+			{
+				Insert((std::uint32_t)old[i]);
+			}
+		}
+	}
+
+	ConnectionRegistry::Connection& ConnectionRegistry::Lookup(const sockaddr& source, bool& created)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		Key key;
+		MakeKey(source, key);
+		std::size_t i = Find(key);
+		if (i < table.size())
+		{
+			Connection& conn = slots[table[i]];
+			conn.lastSeen = now;
+			created = false;
+			return conn;
+		}
+
+		// Only new clients grow the registry, so this is where to make room.
+		EvictIdle(now);
+
+		std::uint32_t slot;
+		if (freeSlots.empty())
+		{
+			slot = (std::uint32_t)slots.size();
+			slots.push_back(Connection());
+			keys.push_back(key);
+		}
+		else
+		{
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+			keys[slot] = key;
+		}
+
+		Connection& conn = slots[slot];
+		conn.id = nextId++;
+		conn.slot = slot;
+		conn.addr = source;
+		conn.host = UDPSocket::GetHost(&conn.addr);
+		conn.lastSeen = now;
+		Insert(slot);
+		created = true;
+		return conn;
+	}
+
+	void ConnectionRegistry::Rekey(Connection& conn, const sockaddr& addr)
+	{
+		std::uint32_t slot = conn.slot;
+		Remove(slot);
+		MakeKey(addr, keys[slot]);
+		conn.addr = addr;
+		conn.host = UDPSocket::GetHost(&conn.addr);
+
+		// Another connection may already be using the new address. The
+		// client has told us that address is now its own, so drop the old one.
+		std::size_t i = Find(keys[slot]);
+		if (i < table.size())
+		{
+			std::uint32_t other = (std::uint32_t)table[i];
+			Log::FormatLine(LOG_DEBUG, "CONN", "Replacing connection %u at %s", slots[other].id, conn.host.c_str());
+			Free(other);
+		}
+		Insert(slot);
+	}
+
+	ConnectionRegistry::Handle ConnectionRegistry::GetHandle(const Connection& conn) const
+	{
+		return (Handle)conn.id << 32 | conn.slot;
+	}
+
+	ConnectionRegistry::Connection* ConnectionRegistry::Get(Handle handle)
+	{
+		std::size_t slot = (std::size_t)(handle & 0xFFFFFFFF);
+		std::uint32_t id = (std::uint32_t)(handle >> 32);
+		if (id == 0 || slot >= slots.size() || slots[slot].id != id)
+		{
+			return NULL;
+		}
+		return &slots[slot];
+	}
+
+	std::size_t ConnectionRegistry::Size() const
+	{
+		return liveEntries;
+	}
+
+	void ConnectionRegistry::EvictIdle(std::chrono::steady_clock::time_point now)
+	{
+		if (now - lastSweep < std::chrono::seconds(1))
+		{
+			return;
+		}
+		lastSweep = now;
+		for (std::uint32_t slot = 0; slot < slots.size(); ++slot)
+		{
+			Connection& conn = slots[slot];
+			if (conn.id != 0 && now - conn.lastSeen > idleTimeout)
+			{
+				Log::FormatLine(LOG_INFO, "CONN", "Evicting idle connection %u (%s)", conn.id, conn.host.c_str());
+				Free(slot);
+			}
+		}
+	}
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_CONNECTIONREGISTRY_H_
+#define XPCPLUGIN_CONNECTIONREGISTRY_H_
+
+#include "DataManager.h"
+#include "ISocket.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace XPC
+{
+	/// Tracks the clients that have sent messages to the plugin.
+	///
+	/// \details Connections are looked up by the raw bytes of the sender's
+	///          address in an open-addressing hash table, and are modified in
+	///          place. Connection records never move once created, so a
+	///          pointer returned by Lookup remains valid until the connection
+	///          is evicted. Code that needs to refer to a connection across
+	///          frames should hold a Handle instead, which can be checked for
+	///          eviction with Get.
+	///
+	///          A connection that has not sent a message for longer than the
+	///          idle timeout is evicted the next time a new client connects.
+	class ConnectionRegistry
+	{
+	public:
+		/// Refers to a connection that may have been evicted since.
+		typedef std::uint64_t Handle;
+
+		/// A handle that never refers to a connection.
+		static const Handle invalidHandle = 0;
+
+		/// The number of prepared queries each client can hold.
+		static const int maxQueries = 32;
+
+		/// A list of datarefs that have been resolved so they can be read
+		/// repeatedly without any string lookups.
+		struct Query
+		{
+			std::vector<ResolvedDref> drefs;
+			/// The values in the last delta response sent for this query, one
+			/// row per dataref. Empty until the first keyframe is sent.
+			std::vector<std::vector<float> > sent;
+			/// The number of delta responses sent since the last keyframe.
+			int deltas;
+
+			Query() : deltas(0) {}
+		};
+
+		/// How often a subscribed query is pushed to its client.
+		enum SubscriptionMode
+		{
+			/// The query is not subscribed.
+			SubscribeNone = 0,
+			/// The query is pushed every N frames.
+			SubscribeFrames = 1,
+			/// The query is pushed at a fixed rate in Hz, at most once per frame.
+			SubscribeHz = 2
+		};
+
+		/// The schedule for pushing a prepared query to its client.
+		struct Subscription
+		{
+			SubscriptionMode mode;
+			/// The number of frames between pushes, for SubscribeFrames.
+			int frameInterval;
+			/// The frames left until the next push, for SubscribeFrames.
+			int framesLeft;
+			/// The time between pushes, for SubscribeHz.
+			std::chrono::steady_clock::duration period;
+			/// The time of the next push, for SubscribeHz.
+			std::chrono::steady_clock::time_point nextPush;
+
+			Subscription() : mode(SubscribeNone), frameInterval(0), framesLeft(0), period(0) {}
+		};
+
+		/// The state kept for each client.
+		struct Connection
+		{
+			/// A unique id for this connection. Ids start at 1 and are never reused.
+			std::uint32_t id;
+			/// The index of this record in the registry.
+			std::uint32_t slot;
+			/// The address responses are sent to.
+			sockaddr addr;
+			/// The address as a printable string, for logging.
+			std::string host;
+			/// The time of the last message received from this client.
+			std::chrono::steady_clock::time_point lastSeen;
+			/// The datarefs in the last GETD request.
+			Query lastQuery;
+			/// Queries registered with PREP, indexed by id.
+			Query queries[maxQueries];
+			/// The push schedule for each prepared query, indexed by id.
+			Subscription subscriptions[maxQueries];
+			/// The number of queries with a subscription.
+			int subscriptionCount;
+			/// The id of the last fragmented response, so clients can tell
+			/// the fragments of consecutive responses apart. Unused while a
+			/// Snapshot hands out the ids (see Snapshot::NextResponseId).
+			std::uint8_t responseId;
+
+			Connection() : id(0), slot(0), addr(), subscriptionCount(0), responseId(0) {}
+		};
+
+		/// Initializes an empty registry.
+		///
+		/// \param idleTimeout The time after which a silent client is evicted.
+		explicit ConnectionRegistry(std::chrono::seconds idleTimeout);
+
+		/// Finds the connection for the specified address, creating one if
+		/// the address has not been seen before, and marks it as active.
+		///
+		/// \param source  The address the client sent from.
+		/// \param created Set to true if a new connection was created.
+		/// \returns       The connection record.
+		Connection& Lookup(const sockaddr& source, bool& created);
+
+		/// Moves a connection to a new address, e.g. after the client changes
+		/// its receive port.
+		void Rekey(Connection& conn, const sockaddr& addr);
+
+		/// Gets a handle that refers to the specified connection.
+		Handle GetHandle(const Connection& conn) const;
+
+		/// Gets the connection referred to by a handle.
+		///
+		/// \returns The connection, or NULL if it has been evicted.
+		Connection* Get(Handle handle);
+
+		/// Gets the number of active connections.
+		std::size_t Size() const;
+
+	private:
+		/// A sender address with every byte that does not identify the sender
+		/// (padding, sin_zero, length fields) set to zero.
+		struct Key
+		{
+			sockaddr_storage addr;
+		};
+
+		static const std::int32_t emptyEntry = -1;
+		static const std::int32_t deletedEntry = -2;
+
+		static void MakeKey(const sockaddr& addr, Key& key);
+		static std::uint32_t Hash(const Key& key);
+
+		std::size_t Find(const Key& key) const;
+		void Insert(std::uint32_t slot);
+		void Remove(std::uint32_t slot);
+		void Free(std::uint32_t slot);
+		void Rehash(std::size_t size);
+		void EvictIdle(std::chrono::steady_clock::time_point now);
+
+		std::chrono::seconds idleTimeout;
+		std::chrono::steady_clock::time_point lastSweep;
+		std::uint32_t nextId;
+
+		// Connection records. A deque never moves its elements when it grows.
+		std::deque<Connection> slots;
+		std::vector<Key> keys; // The key of each slot, parallel to slots
+		std::vector<std::uint32_t> freeSlots;
+
+		// Open-addressing hash table of slot indices, with linear probing.
+		std::vector<std::int32_t> table;
+		std::size_t liveEntries;
+		std::size_t usedEntries; // Live and deleted entries
+	};
+}
+#endif
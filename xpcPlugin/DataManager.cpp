@@ -16,181 +16,419 @@
 //     Laminar Research, respectively.
 #include "DataManager.h"
 #include "Log.h"
+#include "NameCache.h"
+#include "Stats.h"
 
 #include "XPLMDataAccess.h"
 #include "XPLMGraphics.h"
+#include "XPLMProcessing.h"
 #include "XPLMUtilities.h"
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
-#include <map>
+#include <cstring>
 
 namespace XPC
 {
 	using namespace std;
 
 	const size_t PLANE_COUNT = 20;
-	static map<DREF, XPLMDataRef> drefs;
-	static map<DREF, XPLMDataRef> mdrefs[PLANE_COUNT];
-	static map<string, XPLMDataRef> sdrefs;
+
+	// The DREF enum is laid out in blocks of 100 values, each starting at a
+	// multiple of 100. These are the number of values used in each block, so
+	// that every DREF can be mapped to a slot in a dense table.
+	static constexpr int blockSizes[] = { 3, 3, 0, 3, 4, 3, 0, 0, 3, 0, 0, 3, 0, 2, 5, 3, 6, 5, 4, 2, 4, 6, 1, 28 };
+
+	constexpr int BlockStart(int block)
+	{
+		return block == 0 ? 0 : BlockStart(block - 1) + blockSizes[block - 1];
+	}
+
+	static constexpr int blockStarts[] =
+	{
+		BlockStart(0), BlockStart(1), BlockStart(2), BlockStart(3), BlockStart(4), BlockStart(5),
+		BlockStart(6), BlockStart(7), BlockStart(8), BlockStart(9), BlockStart(10), BlockStart(11),
+		BlockStart(12), BlockStart(13), BlockStart(14), BlockStart(15), BlockStart(16), BlockStart(17),
+		BlockStart(18), BlockStart(19), BlockStart(20), BlockStart(21), BlockStart(22), BlockStart(23)
+	};
+	static const int DREF_SLOTS = BlockStart(24);
+
+	// Gets the index of a DREF in the dataref tables.
+	constexpr int Slot(DREF dref)
+	{
+		return blockStarts[dref / 100] + dref % 100;
+	}
+
+	// Checks that a DREF falls inside its block. The last value in every block
+	// is checked below, so adding a DREF without updating blockSizes fails to
+	// compile instead of sharing a slot with the next block.
+	constexpr bool InBlock(DREF dref)
+	{
+		return dref / 100 < (int)(sizeof(blockSizes) / sizeof(blockSizes[0])) && dref % 100 < blockSizes[dref / 100];
+	}
+	static_assert(InBlock(DREF_PauseAI) && InBlock(DREF_TimerElapsedtime) && InBlock(DREF_GroundSpeed) &&
+		InBlock(DREF_GForceSide) && InBlock(DREF_WindSpeedKts) && InBlock(DREF_YokeHeading) &&
+		InBlock(DREF_Rudder) && InBlock(DREF_FlapActual) && InBlock(DREF_BrakeRight) && InBlock(DREF_N) &&
+		InBlock(DREF_R) && InBlock(DREF_Quaternion) && InBlock(DREF_VPath) && InBlock(DREF_MagneticVariation) &&
+		InBlock(DREF_AGL) && InBlock(DREF_LocalVZ) && InBlock(DREF_ThrottleSet) && InBlock(DREF_MP7Alt),
+		"blockSizes does not match the DREF enum");
+
+	// Dataref handles for each aircraft, indexed by Slot. Row 0 is the player
+	// aircraft; multiplayer aircraft only have the datarefs X-Plane provides
+	// for them, and NULL everywhere else.
+	static XPLMDataRef drefs[PLANE_COUNT][DREF_SLOTS];
+	// Handles of datarefs looked up by name. The capacity is far more than
+	// any real client uses, but keeps a client scanning names from growing
+	// the cache without bound.
+	static NameCache names(4096, std::chrono::seconds(10));
+
+	// Element counts of the array datarefs in drefs, or -1 if not looked up yet.
+	static int drefSizes[PLANE_COUNT][DREF_SLOTS];
+
+	// Values read from X-Plane during the current flight loop pass, so that
+	// clients polling the same datarefs share one SDK read. The table is
+	// direct-mapped on the handle and the function used to read it; a
+	// collision simply replaces the older value.
+	enum ReadKind { ReadDouble, ReadFloat, ReadInt, ReadFloatArray, ReadIntArray, ReadBytes, ReadKindCount };
+	struct CachedRead
+	{
+		XPLMDataRef xdref;
+		ReadKind kind;
+		std::uint64_t pass;
+		int requested; // The number of elements asked for
+		int count;     // The number of elements X-Plane returned
+		std::vector<unsigned char> data;
+	};
+	static const int READ_CACHE_BITS = 10;
+	static CachedRead readCache[1 << READ_CACHE_BITS];
+	static std::uint64_t readPass = 0; // 0 outside of a flight loop pass
+	static std::uint32_t passCount = 0;
+	// Incremented by Invalidate, so that copies of resolved datarefs can tell
+	// that their metadata is out of date.
+	static std::uint32_t generation = 0;
+	static int readHits = 0;
+	static int readMisses = 0;
+
+	static std::size_t CacheIndex(XPLMDataRef xdref, ReadKind kind)
+	{
+		// Fibonacci hashing
+		std::uint64_t key = (std::uint64_t)reinterpret_cast<std::uintptr_t>(xdref) * ReadKindCount + kind;
+		return (std::size_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - READ_CACHE_BITS));
+	}
+
+	// Finds values read earlier in this pass, or returns NULL if at least
+	// count elements have not been read yet.
+	static const CachedRead* FindRead(XPLMDataRef xdref, ReadKind kind, int count)
+	{
+		const CachedRead& entry = readCache[CacheIndex(xdref, kind)];
+		if (readPass == 0 || !xdref || entry.pass != readPass || entry.xdref != xdref || entry.kind != kind ||
+			entry.requested < count)
+		{
+			++readMisses;
+			return NULL;
+		}
+		++readHits;
+		return &entry;
+	}
+
+	// Remembers values read from X-Plane for the rest of this pass.
+	static void StoreRead(XPLMDataRef xdref, ReadKind kind, int requested, const void* values, int count,
+		std::size_t elementSize)
+	{
+		if (readPass == 0 || !xdref)
+		{
+			return;
+		}
+		CachedRead& entry = readCache[CacheIndex(xdref, kind)];
+		const unsigned char* bytes = static_cast<const unsigned char*>(values);
+		entry.xdref = xdref;
+		entry.kind = kind;
+		entry.pass = readPass;
+		entry.requested = requested;
+		entry.count = std::max(count, 0);
+		entry.data.assign(bytes, bytes + entry.count * elementSize);
+	}
+
+	// Drops every value read from a dataref, so a write is seen by the next read.
+	static void ForgetReads(XPLMDataRef xdref)
+	{
+		for (int kind = 0; kind < ReadKindCount; ++kind)
+		{
+			CachedRead& entry = readCache[CacheIndex(xdref, (ReadKind)kind)];
+			if (entry.xdref == xdref)
+			{
+				entry.pass = 0;
+			}
+		}
+	}
+
+	// Drops every value read in this pass.
+	static void ForgetAllReads()
+	{
+		if (readPass != 0)
+		{
+			readPass = (readPass & 0xFFFFFFFF00000000ull) | ++passCount;
+		}
+	}
+
+	template<typename T>
+	static T ReadScalar(XPLMDataRef xdref, ReadKind kind, T (*read)(XPLMDataRef))
+	{
+		T value;
+		const CachedRead* cached = FindRead(xdref, kind, 1);
+		if (cached && cached->count == 1)
+		{
+			std::memcpy(&value, &cached->data[0], sizeof(T));
+			return value;
+		}
+		value = read(xdref);
+		StoreRead(xdref, kind, 1, &value, 1, sizeof(T));
+		return value;
+	}
+
+	template<typename T>
+	static int ReadArray(XPLMDataRef xdref, ReadKind kind, T* values, int count, int (*read)(XPLMDataRef, T*, int, int))
+	{
+		const CachedRead* cached = FindRead(xdref, kind, count);
+		if (cached)
+		{
+			int result = std::min(count, cached->count);
+			if (result > 0)
+			{
+				std::memcpy(values, &cached->data[0], result * sizeof(T));
+			}
+			return result;
+		}
+		int result = read(xdref, values, 0, count);
+		StoreRead(xdref, kind, count, values, result, sizeof(T));
+		return result;
+	}
+
+	static int GetBytes(XPLMDataRef xdref, char* values, int offset, int count)
+	{
+		return XPLMGetDatab(xdref, values, offset, count);
+	}
+
+	void DataManager::BeginPass()
+	{
+		// The pass count tells apart the passes before and after the flight
+		// model within one cycle.
+		readPass = (std::uint64_t)(std::uint32_t)XPLMGetCycleNumber() << 32 | ++passCount;
+	}
+
+	void DataManager::EndPass()
+	{
+		readPass = 0;
+	}
 
 	DREF XPData[134][8] = { DREF_None };
 
+	void DataManager::PublishStats()
+	{
+		const NameCache::Counters& counters = names.GetCounters();
+		Stats::Publish("dref_cache/hits", &counters.hits);
+		Stats::Publish("dref_cache/negative_hits", &counters.negativeHits);
+		Stats::Publish("dref_cache/misses", &counters.misses);
+		Stats::Publish("dref_cache/evictions", &counters.evictions);
+		Stats::Publish("read_cache/hits", &readHits);
+		Stats::Publish("read_cache/misses", &readMisses);
+	}
+
+	void DataManager::Invalidate()
+	{
+		Log::WriteLine(LOG_DEBUG, "DMAN", "Forgetting cached dataref metadata");
+		names.Clear();
+		++generation;
+		ForgetAllReads();
+		std::fill(&drefSizes[0][0], &drefSizes[0][0] + PLANE_COUNT * DREF_SLOTS, -1);
+	}
+
+	// Gets the handle of a DREF in drefs, or NULL if the aircraft is out of
+	// range.
+	static XPLMDataRef Lookup(DREF dref, char aircraft)
+	{
+		if (aircraft < 0 || aircraft >= (int)PLANE_COUNT)
+		{
+			Log::FormatLine(LOG_ERROR, "DMAN", "ERROR: Aircraft %i is out of range.", aircraft);
+			return NULL;
+		}
+		return drefs[(int)aircraft][Slot(dref)];
+	}
+
+	// Gets the element count of an array dataref in drefs, asking X-Plane
+	// only the first time.
+	static int GetArraySize(DREF dref, char aircraft, bool ints)
+	{
+		if (aircraft < 0 || aircraft >= (int)PLANE_COUNT)
+		{
+			return 0;
+		}
+		int& size = drefSizes[(int)aircraft][Slot(dref)];
+		if (size < 0)
+		{
+			XPLMDataRef xdref = drefs[(int)aircraft][Slot(dref)];
+			size = ints ? XPLMGetDatavi(xdref, NULL, 0, 0) : XPLMGetDatavf(xdref, NULL, 0, 0);
+		}
+		return size;
+	}
+
 	void DataManager::Initialize()
 	{
 		Log::WriteLine(LOG_TRACE, "DMAN", "Initializing drefs");
-
-		drefs.insert(make_pair(DREF_None, XPLMFindDataRef("sim/test/test_float")));
-
-		drefs.insert(make_pair(DREF_Pause, XPLMFindDataRef("sim/operation/override/override_planepath")));
-		drefs.insert(make_pair(DREF_PauseAI, XPLMFindDataRef("sim/operation/override/override_plane_ai_autopilot")));
-
-		drefs.insert(make_pair(DREF_TotalRuntime, XPLMFindDataRef("sim/time/total_running_time_sec")));
-		drefs.insert(make_pair(DREF_TotalFlighttime, XPLMFindDataRef("sim/time/total_flight_time_sec")));
-		drefs.insert(make_pair(DREF_TimerElapsedtime, XPLMFindDataRef("sim/time/timer_elapsed_time_sec")));
-
-		drefs.insert(make_pair(DREF_IndicatedAirspeed, XPLMFindDataRef("sim/flightmodel/position/indicated_airspeed")));
-		drefs.insert(make_pair(DREF_TrueAirspeed, XPLMFindDataRef("sim/flightmodel/position/true_airspeed")));
-		drefs.insert(make_pair(DREF_GroundSpeed, XPLMFindDataRef("sim/flightmodel/position/groundspeed")));
-
-		drefs.insert(make_pair(DREF_MachNumber, XPLMFindDataRef("sim/flightmodel/misc/machno")));
-		drefs.insert(make_pair(DREF_GForceNormal, XPLMFindDataRef("sim/flightmodel2/misc/gforce_normal")));
-		drefs.insert(make_pair(DREF_GForceAxial, XPLMFindDataRef("sim/flightmodel2/misc/gforce_axial")));
-		drefs.insert(make_pair(DREF_GForceSide, XPLMFindDataRef("sim/flightmodel2/misc/gforce_side")));
-
-		drefs.insert(make_pair(DREF_BarometerSealevelInHg, XPLMFindDataRef("sim/weather/barometer_sealevel_inhg")));
-		drefs.insert(make_pair(DREF_TemperaturSealevelC, XPLMFindDataRef("sim/weather/temperature_sealevel_c")));
-		drefs.insert(make_pair(DREF_WindSpeedKts, XPLMFindDataRef("sim/cockpit2/gauges/indicators/wind_speed_kts")));
-
-		drefs.insert(make_pair(DREF_YokePitch, XPLMFindDataRef("sim/joystick/yoke_pitch_ratio")));
-		drefs.insert(make_pair(DREF_YokeRoll, XPLMFindDataRef("sim/joystick/yoke_roll_ratio")));
-		drefs.insert(make_pair(DREF_YokeHeading, XPLMFindDataRef("sim/joystick/yoke_heading_ratio")));
-
-		drefs.insert(make_pair(DREF_Elevator, XPLMFindDataRef("sim/cockpit2/controls/yoke_pitch_ratio")));
-		drefs.insert(make_pair(DREF_Aileron, XPLMFindDataRef("sim/cockpit2/controls/yoke_roll_ratio")));
-		drefs.insert(make_pair(DREF_Rudder, XPLMFindDataRef("sim/cockpit2/controls/yoke_heading_ratio")));
-
-		drefs.insert(make_pair(DREF_FlapSetting, XPLMFindDataRef("sim/flightmodel/controls/flaprqst")));
-		drefs.insert(make_pair(DREF_FlapActual, XPLMFindDataRef("sim/flightmodel/controls/flaprat")));
-
-		drefs.insert(make_pair(DREF_SpeedBrakeSet, XPLMFindDataRef("sim/flightmodel/controls/sbrkrqst")));
-		drefs.insert(make_pair(DREF_SpeedBrakeActual, XPLMFindDataRef("sim/flightmodel/controls/sbrkrat")));
-
-		drefs.insert(make_pair(DREF_GearDeploy, XPLMFindDataRef("sim/aircraft/parts/acf_gear_deploy")));
-		drefs.insert(make_pair(DREF_GearHandle, XPLMFindDataRef("sim/cockpit/switches/gear_handle_status")));
-		drefs.insert(make_pair(DREF_BrakeParking, XPLMFindDataRef("sim/flightmodel/controls/parkbrakel")));
-		drefs.insert(make_pair(DREF_BrakeLeft, XPLMFindDataRef("sim/cockpit2/controls/left_brake_ratio")));
-		drefs.insert(make_pair(DREF_BrakeRight, XPLMFindDataRef("sim/cockpit2/controls/right_brake_ratio")));
-
-		drefs.insert(make_pair(DREF_M, XPLMFindDataRef("sim/flightmodel/position/M")));
-		drefs.insert(make_pair(DREF_L, XPLMFindDataRef("sim/flightmodel/position/L")));
-		drefs.insert(make_pair(DREF_N, XPLMFindDataRef("sim/flightmodel/position/N")));
-
-		drefs.insert(make_pair(DREF_QRad, XPLMFindDataRef("sim/flightmodel/position/Qrad")));
-		drefs.insert(make_pair(DREF_PRad, XPLMFindDataRef("sim/flightmodel/position/Prad")));
-		drefs.insert(make_pair(DREF_RRad, XPLMFindDataRef("sim/flightmodel/position/Rrad")));
-		drefs.insert(make_pair(DREF_Q, XPLMFindDataRef("sim/flightmodel/position/Q")));
-		drefs.insert(make_pair(DREF_P, XPLMFindDataRef("sim/flightmodel/position/P")));
-		drefs.insert(make_pair(DREF_R, XPLMFindDataRef("sim/flightmodel/position/R")));
-
-		drefs.insert(make_pair(DREF_Pitch, XPLMFindDataRef("sim/flightmodel/position/theta")));
-		drefs.insert(make_pair(DREF_Roll, XPLMFindDataRef("sim/flightmodel/position/phi")));
-		drefs.insert(make_pair(DREF_HeadingTrue, XPLMFindDataRef("sim/flightmodel/position/psi")));
-		drefs.insert(make_pair(DREF_HeadingMag, XPLMFindDataRef("sim/flightmodel/position/magpsi")));
-		drefs.insert(make_pair(DREF_Quaternion, XPLMFindDataRef("sim/flightmodel/position/q")));
-
-		drefs.insert(make_pair(DREF_AngleOfAttack, XPLMFindDataRef("sim/flightmodel/position/alpha")));
-		drefs.insert(make_pair(DREF_Sideslip, XPLMFindDataRef("sim/cockpit2/gauges/indicators/sideslip_degrees")));
-		drefs.insert(make_pair(DREF_HPath, XPLMFindDataRef("sim/flightmodel/position/hpath")));
-		drefs.insert(make_pair(DREF_VPath, XPLMFindDataRef("sim/flightmodel/position/vpath")));
-
-		drefs.insert(make_pair(DREF_MagneticVariation, XPLMFindDataRef("sim/flightmodel/position/magnetic_variation")));
-
-		drefs.insert(make_pair(DREF_Latitude, XPLMFindDataRef("sim/flightmodel/position/latitude")));
-		drefs.insert(make_pair(DREF_Longitude, XPLMFindDataRef("sim/flightmodel/position/longitude")));
-		drefs.insert(make_pair(DREF_AGL, XPLMFindDataRef("sim/flightmodel/position/y_agl")));
-		drefs.insert(make_pair(DREF_Elevation, XPLMFindDataRef("sim/flightmodel/position/elevation")));
-
-		drefs.insert(make_pair(DREF_LocalX, XPLMFindDataRef("sim/flightmodel/position/local_x")));
-		drefs.insert(make_pair(DREF_LocalY, XPLMFindDataRef("sim/flightmodel/position/local_y")));
-		drefs.insert(make_pair(DREF_LocalZ, XPLMFindDataRef("sim/flightmodel/position/local_z")));
-		drefs.insert(make_pair(DREF_LocalVX, XPLMFindDataRef("sim/flightmodel/position/local_vx")));
-		drefs.insert(make_pair(DREF_LocalVY, XPLMFindDataRef("sim/flightmodel/position/local_vy")));
-		drefs.insert(make_pair(DREF_LocalVZ, XPLMFindDataRef("sim/flightmodel/position/local_vz")));
-
-		drefs.insert(make_pair(DREF_ThrottleSet, XPLMFindDataRef("sim/flightmodel/engine/ENGN_thro")));
-		drefs.insert(make_pair(DREF_ThrottleActual, XPLMFindDataRef("sim/flightmodel2/engines/throttle_used_ratio")));
-
-		drefs.insert(make_pair(DREF_MP1Lat, XPLMFindDataRef("sim/multiplayer/position/plane1_lat")));
-		drefs.insert(make_pair(DREF_MP2Lat, XPLMFindDataRef("sim/multiplayer/position/plane2_lat")));
-		drefs.insert(make_pair(DREF_MP3Lat, XPLMFindDataRef("sim/multiplayer/position/plane3_lat")));
-		drefs.insert(make_pair(DREF_MP4Lat, XPLMFindDataRef("sim/multiplayer/position/plane4_lat")));
-		drefs.insert(make_pair(DREF_MP5Lat, XPLMFindDataRef("sim/multiplayer/position/plane5_lat")));
-		drefs.insert(make_pair(DREF_MP6Lat, XPLMFindDataRef("sim/multiplayer/position/plane6_lat")));
-		drefs.insert(make_pair(DREF_MP7Lat, XPLMFindDataRef("sim/multiplayer/position/plane7_lat")));
-
-		drefs.insert(make_pair(DREF_MP1Lon, XPLMFindDataRef("sim/multiplayer/position/plane1_lon")));
-		drefs.insert(make_pair(DREF_MP2Lon, XPLMFindDataRef("sim/multiplayer/position/plane2_lon")));
-		drefs.insert(make_pair(DREF_MP3Lon, XPLMFindDataRef("sim/multiplayer/position/plane3_lon")));
-		drefs.insert(make_pair(DREF_MP4Lon, XPLMFindDataRef("sim/multiplayer/position/plane4_lon")));
-		drefs.insert(make_pair(DREF_MP5Lon, XPLMFindDataRef("sim/multiplayer/position/plane5_lon")));
-		drefs.insert(make_pair(DREF_MP6Lon, XPLMFindDataRef("sim/multiplayer/position/plane6_lon")));
-		drefs.insert(make_pair(DREF_MP7Lon, XPLMFindDataRef("sim/multiplayer/position/plane7_lon")));
-
-		drefs.insert(make_pair(DREF_MP1Alt, XPLMFindDataRef("sim/multiplayer/position/plane1_el")));
-		drefs.insert(make_pair(DREF_MP2Alt, XPLMFindDataRef("sim/multiplayer/position/plane2_el")));
-		drefs.insert(make_pair(DREF_MP3Alt, XPLMFindDataRef("sim/multiplayer/position/plane3_el")));
-		drefs.insert(make_pair(DREF_MP4Alt, XPLMFindDataRef("sim/multiplayer/position/plane4_el")));
-		drefs.insert(make_pair(DREF_MP5Alt, XPLMFindDataRef("sim/multiplayer/position/plane5_el")));
-		drefs.insert(make_pair(DREF_MP6Alt, XPLMFindDataRef("sim/multiplayer/position/plane6_el")));
-		drefs.insert(make_pair(DREF_MP7Alt, XPLMFindDataRef("sim/multiplayer/position/plane7_el")));
+		std::fill(&drefSizes[0][0], &drefSizes[0][0] + PLANE_COUNT * DREF_SLOTS, -1);
+
+		drefs[0][Slot(DREF_None)] = XPLMFindDataRef("sim/test/test_float");
+
+		drefs[0][Slot(DREF_Pause)] = XPLMFindDataRef("sim/operation/override/override_planepath");
+		drefs[0][Slot(DREF_PauseAI)] = XPLMFindDataRef("sim/operation/override/override_plane_ai_autopilot");
+
+		drefs[0][Slot(DREF_TotalRuntime)] = XPLMFindDataRef("sim/time/total_running_time_sec");
+		drefs[0][Slot(DREF_TotalFlighttime)] = XPLMFindDataRef("sim/time/total_flight_time_sec");
+		drefs[0][Slot(DREF_TimerElapsedtime)] = XPLMFindDataRef("sim/time/timer_elapsed_time_sec");
+
+		drefs[0][Slot(DREF_IndicatedAirspeed)] = XPLMFindDataRef("sim/flightmodel/position/indicated_airspeed");
+		drefs[0][Slot(DREF_TrueAirspeed)] = XPLMFindDataRef("sim/flightmodel/position/true_airspeed");
+		drefs[0][Slot(DREF_GroundSpeed)] = XPLMFindDataRef("sim/flightmodel/position/groundspeed");
+
+		drefs[0][Slot(DREF_MachNumber)] = XPLMFindDataRef("sim/flightmodel/misc/machno");
+		drefs[0][Slot(DREF_GForceNormal)] = XPLMFindDataRef("sim/flightmodel2/misc/gforce_normal");
+		drefs[0][Slot(DREF_GForceAxial)] = XPLMFindDataRef("sim/flightmodel2/misc/gforce_axial");
+		drefs[0][Slot(DREF_GForceSide)] = XPLMFindDataRef("sim/flightmodel2/misc/gforce_side");
+
+		drefs[0][Slot(DREF_BarometerSealevelInHg)] = XPLMFindDataRef("sim/weather/barometer_sealevel_inhg");
+		drefs[0][Slot(DREF_TemperaturSealevelC)] = XPLMFindDataRef("sim/weather/temperature_sealevel_c");
+		drefs[0][Slot(DREF_WindSpeedKts)] = XPLMFindDataRef("sim/cockpit2/gauges/indicators/wind_speed_kts");
+
+		drefs[0][Slot(DREF_YokePitch)] = XPLMFindDataRef("sim/joystick/yoke_pitch_ratio");
+		drefs[0][Slot(DREF_YokeRoll)] = XPLMFindDataRef("sim/joystick/yoke_roll_ratio");
+		drefs[0][Slot(DREF_YokeHeading)] = XPLMFindDataRef("sim/joystick/yoke_heading_ratio");
+
+		drefs[0][Slot(DREF_Elevator)] = XPLMFindDataRef("sim/cockpit2/controls/yoke_pitch_ratio");
+		drefs[0][Slot(DREF_Aileron)] = XPLMFindDataRef("sim/cockpit2/controls/yoke_roll_ratio");
+		drefs[0][Slot(DREF_Rudder)] = XPLMFindDataRef("sim/cockpit2/controls/yoke_heading_ratio");
+
+		drefs[0][Slot(DREF_FlapSetting)] = XPLMFindDataRef("sim/flightmodel/controls/flaprqst");
+		drefs[0][Slot(DREF_FlapActual)] = XPLMFindDataRef("sim/flightmodel/controls/flaprat");
+
+		drefs[0][Slot(DREF_SpeedBrakeSet)] = XPLMFindDataRef("sim/flightmodel/controls/sbrkrqst");
+		drefs[0][Slot(DREF_SpeedBrakeActual)] = XPLMFindDataRef("sim/flightmodel/controls/sbrkrat");
+
+		drefs[0][Slot(DREF_GearDeploy)] = XPLMFindDataRef("sim/aircraft/parts/acf_gear_deploy");
+		drefs[0][Slot(DREF_GearHandle)] = XPLMFindDataRef("sim/cockpit/switches/gear_handle_status");
+		drefs[0][Slot(DREF_BrakeParking)] = XPLMFindDataRef("sim/flightmodel/controls/parkbrakel");
+		drefs[0][Slot(DREF_BrakeLeft)] = XPLMFindDataRef("sim/cockpit2/controls/left_brake_ratio");
+		drefs[0][Slot(DREF_BrakeRight)] = XPLMFindDataRef("sim/cockpit2/controls/right_brake_ratio");
+
+		drefs[0][Slot(DREF_M)] = XPLMFindDataRef("sim/flightmodel/position/M");
+		drefs[0][Slot(DREF_L)] = XPLMFindDataRef("sim/flightmodel/position/L");
+		drefs[0][Slot(DREF_N)] = XPLMFindDataRef("sim/flightmodel/position/N");
+
+		drefs[0][Slot(DREF_QRad)] = XPLMFindDataRef("sim/flightmodel/position/Qrad");
+		drefs[0][Slot(DREF_PRad)] = XPLMFindDataRef("sim/flightmodel/position/Prad");
+		drefs[0][Slot(DREF_RRad)] = XPLMFindDataRef("sim/flightmodel/position/Rrad");
+		drefs[0][Slot(DREF_Q)] = XPLMFindDataRef("sim/flightmodel/position/Q");
+		drefs[0][Slot(DREF_P)] = XPLMFindDataRef("sim/flightmodel/position/P");
+		drefs[0][Slot(DREF_R)] = XPLMFindDataRef("sim/flightmodel/position/R");
+
+		drefs[0][Slot(DREF_Pitch)] = XPLMFindDataRef("sim/flightmodel/position/theta");
+		drefs[0][Slot(DREF_Roll)] = XPLMFindDataRef("sim/flightmodel/position/phi");
+		drefs[0][Slot(DREF_HeadingTrue)] = XPLMFindDataRef("sim/flightmodel/position/psi");
+		drefs[0][Slot(DREF_HeadingMag)] = XPLMFindDataRef("sim/flightmodel/position/magpsi");
+		drefs[0][Slot(DREF_Quaternion)] = XPLMFindDataRef("sim/flightmodel/position/q");
+
+		drefs[0][Slot(DREF_AngleOfAttack)] = XPLMFindDataRef("sim/flightmodel/position/alpha");
+		drefs[0][Slot(DREF_Sideslip)] = XPLMFindDataRef("sim/cockpit2/gauges/indicators/sideslip_degrees");
+		drefs[0][Slot(DREF_HPath)] = XPLMFindDataRef("sim/flightmodel/position/hpath");
+		drefs[0][Slot(DREF_VPath)] = XPLMFindDataRef("sim/flightmodel/position/vpath");
+
+		drefs[0][Slot(DREF_MagneticVariation)] = XPLMFindDataRef("sim/flightmodel/position/magnetic_variation");
+
+		drefs[0][Slot(DREF_Latitude)] = XPLMFindDataRef("sim/flightmodel/position/latitude");
+		drefs[0][Slot(DREF_Longitude)] = XPLMFindDataRef("sim/flightmodel/position/longitude");
+		drefs[0][Slot(DREF_AGL)] = XPLMFindDataRef("sim/flightmodel/position/y_agl");
+		drefs[0][Slot(DREF_Elevation)] = XPLMFindDataRef("sim/flightmodel/position/elevation");
+
+		drefs[0][Slot(DREF_LocalX)] = XPLMFindDataRef("sim/flightmodel/position/local_x");
+		drefs[0][Slot(DREF_LocalY)] = XPLMFindDataRef("sim/flightmodel/position/local_y");
+		drefs[0][Slot(DREF_LocalZ)] = XPLMFindDataRef("sim/flightmodel/position/local_z");
+		drefs[0][Slot(DREF_LocalVX)] = XPLMFindDataRef("sim/flightmodel/position/local_vx");
+		drefs[0][Slot(DREF_LocalVY)] = XPLMFindDataRef("sim/flightmodel/position/local_vy");
+		drefs[0][Slot(DREF_LocalVZ)] = XPLMFindDataRef("sim/flightmodel/position/local_vz");
+
+		drefs[0][Slot(DREF_ThrottleSet)] = XPLMFindDataRef("sim/flightmodel/engine/ENGN_thro");
+		drefs[0][Slot(DREF_ThrottleActual)] = XPLMFindDataRef("sim/flightmodel2/engines/throttle_used_ratio");
+
+		drefs[0][Slot(DREF_MP1Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane1_lat");
+		drefs[0][Slot(DREF_MP2Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane2_lat");
+		drefs[0][Slot(DREF_MP3Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane3_lat");
+		drefs[0][Slot(DREF_MP4Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane4_lat");
+		drefs[0][Slot(DREF_MP5Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane5_lat");
+		drefs[0][Slot(DREF_MP6Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane6_lat");
+		drefs[0][Slot(DREF_MP7Lat)] = XPLMFindDataRef("sim/multiplayer/position/plane7_lat");
+
+		drefs[0][Slot(DREF_MP1Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane1_lon");
+		drefs[0][Slot(DREF_MP2Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane2_lon");
+		drefs[0][Slot(DREF_MP3Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane3_lon");
+		drefs[0][Slot(DREF_MP4Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane4_lon");
+		drefs[0][Slot(DREF_MP5Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane5_lon");
+		drefs[0][Slot(DREF_MP6Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane6_lon");
+		drefs[0][Slot(DREF_MP7Lon)] = XPLMFindDataRef("sim/multiplayer/position/plane7_lon");
+
+		drefs[0][Slot(DREF_MP1Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane1_el");
+		drefs[0][Slot(DREF_MP2Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane2_el");
+		drefs[0][Slot(DREF_MP3Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane3_el");
+		drefs[0][Slot(DREF_MP4Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane4_el");
+		drefs[0][Slot(DREF_MP5Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane5_el");
+		drefs[0][Slot(DREF_MP6Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane6_el");
+		drefs[0][Slot(DREF_MP7Alt)] = XPLMFindDataRef("sim/multiplayer/position/plane7_el");
 
 		char multi[256];
 		for (int i = 1; i < PLANE_COUNT; i++)
 		{
 			sprintf(multi, "sim/multiplayer/position/plane%i_x", i);
-			mdrefs[i][DREF_LocalX] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_LocalX)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_y", i);
-			mdrefs[i][DREF_LocalY] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_LocalY)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_z", i);
-			mdrefs[i][DREF_LocalZ] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_LocalZ)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_lat", i);
-			mdrefs[i][DREF_Latitude] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Latitude)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_lon", i);
-			mdrefs[i][DREF_Longitude] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Longitude)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_el", i);
-			mdrefs[i][DREF_Elevation] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Elevation)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_the", i);
-			mdrefs[i][DREF_Pitch] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Pitch)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_phi", i);
-			mdrefs[i][DREF_Roll] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Roll)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_psi", i);
-			mdrefs[i][DREF_HeadingTrue] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_HeadingTrue)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_gear_deploy", i);
-			mdrefs[i][DREF_GearDeploy] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_GearDeploy)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_flap_ratio", i);
-			mdrefs[i][DREF_FlapActual] = XPLMFindDataRef(multi);
-			mdrefs[i][DREF_FlapSetting] = mdrefs[i][DREF_FlapActual]; // Can't set the actual flap setting on npc aircraft
+			drefs[i][Slot(DREF_FlapActual)] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_FlapSetting)] = drefs[i][Slot(DREF_FlapActual)]; // Can't set the actual flap setting on npc aircraft
 			sprintf(multi, "sim/multiplayer/position/plane%i_flap_ratio2", i);
-			mdrefs[i][DREF_FlapActual2] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_FlapActual2)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_spoiler_ratio", i);
-			mdrefs[i][DREF_Spoiler] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Spoiler)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_speedbrake_ratio", i);
-			mdrefs[i][DREF_SpeedBrakeSet] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_SpeedBrakeSet)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_slat_ratio", i);
-			mdrefs[i][DREF_Slats] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Slats)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_wing_sweep", i);
-			mdrefs[i][DREF_Sweep] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_Sweep)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_throttle", i);
-			mdrefs[i][DREF_ThrottleActual] = XPLMFindDataRef(multi);
-			mdrefs[i][DREF_ThrottleSet] = mdrefs[i][DREF_ThrottleActual]; // No throttle set for multiplayer planes.
+			drefs[i][Slot(DREF_ThrottleActual)] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_ThrottleSet)] = drefs[i][Slot(DREF_ThrottleActual)]; // No throttle set for multiplayer planes.
 			sprintf(multi, "sim/multiplayer/position/plane%i_yolk_pitch", i);
-			mdrefs[i][DREF_YokePitch] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_YokePitch)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_yolk_roll", i);
-			mdrefs[i][DREF_YokeRoll] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_YokeRoll)] = XPLMFindDataRef(multi);
 			sprintf(multi, "sim/multiplayer/position/plane%i_yolk_yaw", i);
-			mdrefs[i][DREF_YokeHeading] = XPLMFindDataRef(multi);
+			drefs[i][Slot(DREF_YokeHeading)] = XPLMFindDataRef(multi);
 		}
 
 		// Row 0: Frame Rates
@@ -308,71 +546,130 @@ namespace XPC
 	int DataManager::Get(const string& dref, float values[], int size)
 	{
 		Log::WriteLine(LOG_TRACE, "DMAN", "Entered Get(string, float*, int)");
-		XPLMDataRef& xdref = sdrefs[dref];
-		if (xdref == NULL)
+		ResolvedDref rdref = Resolve(dref);
+		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %s (x:%X) Type: %i", dref.c_str(), rdref.xdref, rdref.type);
+		return Get(rdref, values, size);
+	}
+
+	// Looks up the type, size and writability of a dataref that has a handle.
+	static void Describe(ResolvedDref& rdref, const string& dref)
+	{
+		XPLMDataRef xdref = rdref.xdref;
+		rdref.size = 0;
+		rdref.writable = XPLMCanWriteDataRef(xdref) != 0;
+
+		// XPLMDataTypeID is a bit flag, so it may contain more than one of the
+		// following types. We prefer types as close to float as possible.
+		XPLMDataTypeID dataType = XPLMGetDataRefTypes(xdref);
+		rdref.types = dataType;
+		if ((dataType & xplmType_Float) == xplmType_Float)
 		{
-			xdref = XPLMFindDataRef(dref.c_str());
+			rdref.type = xplmType_Float;
+			rdref.size = 1;
 		}
-		if (!xdref) // DREF does not exist
+		else if ((dataType & xplmType_FloatArray) == xplmType_FloatArray)
+		{
+			rdref.type = xplmType_FloatArray;
+			rdref.size = XPLMGetDatavf(xdref, NULL, 0, 0);
+		}
+		else if ((dataType & xplmType_Double) == xplmType_Double)
+		{
+			rdref.type = xplmType_Double;
+			rdref.size = 1;
+		}
+		else if ((dataType & xplmType_Int) == xplmType_Int)
+		{
+			rdref.type = xplmType_Int;
+			rdref.size = 1;
+		}
+		else if ((dataType & xplmType_IntArray) == xplmType_IntArray)
+		{
+			rdref.type = xplmType_IntArray;
+			rdref.size = XPLMGetDatavi(xdref, NULL, 0, 0);
+		}
+		else if ((dataType & xplmType_Data) == xplmType_Data)
+		{
+			rdref.type = xplmType_Data;
+			rdref.size = XPLMGetDatab(xdref, NULL, 0, 0);
+		}
+		else
+		{
+			Log::FormatLine(LOG_ERROR, "DMAN", "ERROR: Unrecognized data type for %s (x:%X).", dref.c_str(), xdref);
+		}
+		rdref.generation = generation;
+	}
+
+	ResolvedDref DataManager::Resolve(const string& dref)
+	{
+		ResolvedDref& rdref = names.Find(dref);
+		if (!rdref.xdref) // DREF does not exist
 		{
 			Log::FormatLine(LOG_ERROR, "DMAN", "ERROR: invalid DREF %s", dref.c_str());
+			rdref.generation = generation;
+			return rdref;
+		}
+		if (rdref.size < 0)
+		{
+			Describe(rdref, dref);
+		}
+		return rdref;
+	}
+
+	bool DataManager::Refresh(ResolvedDref& dref)
+	{
+		if (dref.generation == generation)
+		{
+			return false;
+		}
+		if (dref.xdref)
+		{
+			Describe(dref, "a prepared dataref");
+		}
+		dref.generation = generation;
+		return true;
+	}
+
+	int DataManager::Get(const ResolvedDref& dref, float values[], int size)
+	{
+		XPLMDataRef xdref = dref.xdref;
+		if (!xdref || size < 1)
+		{
 			return 0;
 		}
+		int drefSize = dref.size;
+		if (drefSize > size)
+		{
+			Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than available space");
+			Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Available size : %i", drefSize, size);
+			drefSize = size;
+		}
 
-		XPLMDataTypeID dataType = XPLMGetDataRefTypes(xdref);
-		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %s (x:%X) Type: %i", dref.c_str(), xdref, dataType);
-		// XPLMDataTypeID is a bit flag, so it may contain more than one of the
-		// following types. We prefer types as close to float as possible.
-		if ((dataType & 2) == 2) // Float
+		switch (dref.type)
 		{
-			values[0] = XPLMGetDataf(xdref);
+		case xplmType_Float:
+			values[0] = ReadScalar(xdref, ReadFloat, XPLMGetDataf);
 			Log::FormatLine(LOG_INFO, "DMAN", " -- value was %f", values[0]);
 			return 1;
-		}
-		if ((dataType & 8) == 8) // Float array
-		{
-			int drefSize = XPLMGetDatavf(xdref, NULL, 0, 0);
-			if (drefSize > size)
-			{
-				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than available space");
-				Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Available size : %i", drefSize, size);
-				drefSize = size;
-			}
-			XPLMGetDatavf(xdref, values, 0, drefSize);
+		case xplmType_FloatArray:
+			drefSize = ReadArray(xdref, ReadFloatArray, values, drefSize, XPLMGetDatavf);
 			Log::FormatLine(LOG_INFO, "DMAN", " -- value count was %i", drefSize);
 			return drefSize;
-		}
-		if ((dataType & 4) == 4) // Double
-		{
-			values[0] = (float)XPLMGetDatad(xdref);
+		case xplmType_Double:
+			values[0] = (float)ReadScalar(xdref, ReadDouble, XPLMGetDatad);
 			Log::FormatLine(LOG_INFO, "DMAN", " -- value was %f", values[0]);
 			return 1;
-		}
-		if ((dataType & 1) == 1) // Integer
+		case xplmType_Int:
 		{
-			int iValue = XPLMGetDatai(xdref);
+			int iValue = ReadScalar(xdref, ReadInt, XPLMGetDatai);
 			values[0] = (float)iValue;
 			Log::FormatLine(LOG_INFO, "DMAN", " -- Real value was %i, cast to %f", iValue, values[0]);
 			return 1;
 		}
-		if ((dataType & 16) == 16) // Integer array
+		case xplmType_IntArray:
 		{
-			const std::size_t TMP_SIZE = 200;
-			int iValues[TMP_SIZE];
-			int drefSize = XPLMGetDatavi(xdref, NULL, 0, 0);
-			if (drefSize > size)
-			{
-				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than available space");
-				Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Available size : %i", drefSize, size);
-				drefSize = size;
-			}
-			if (drefSize > TMP_SIZE)
-			{
-				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than temp buffer");
-				Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Temp buffer size: %u", drefSize, TMP_SIZE);
-				drefSize = TMP_SIZE;
-			}
-			XPLMGetDatavi(xdref, iValues, 0, drefSize);
+			static std::vector<int> iValues;
+			iValues.resize(std::max(drefSize, 1));
+			drefSize = ReadArray(xdref, ReadIntArray, &iValues[0], drefSize, XPLMGetDatavi);
 			for (int i = 0; i < drefSize; ++i)
 			{
 				values[i] = (float)iValues[i];
@@ -380,24 +677,11 @@ namespace XPC
 			Log::FormatLine(LOG_INFO, "DMAN", " -- value count was %i", drefSize);
 			return drefSize;
 		}
-		if ((dataType & 32) == 32) // Byte array
+		case xplmType_Data:
 		{
-			const std::size_t TMP_SIZE = 1024;
-			char bValues[TMP_SIZE];
-			int drefSize = XPLMGetDatab(xdref, NULL, 0, 0);
-			if (drefSize > size)
-			{
-				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than available space");
-				Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Available size : %i", drefSize, size);
-				drefSize = size;
-			}
-			if (drefSize > TMP_SIZE)
-			{
-				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than temp buffer");
-				Log::FormatLine(LOG_DEBUG, "DMAN", "Actual dref size : %i, Temp buffer size: %u", drefSize, TMP_SIZE);
-				drefSize = TMP_SIZE;
-			}
-			XPLMGetDatab(xdref, bValues, 0, drefSize);
+			static std::vector<char> bValues;
+			bValues.resize(std::max(drefSize, 1));
+			drefSize = ReadArray(xdref, ReadBytes, &bValues[0], drefSize, GetBytes);
 			for (int i = 0; i < drefSize; ++i)
 			{
 				values[i] = (float)bValues[i];
@@ -405,16 +689,87 @@ namespace XPC
 			Log::FormatLine(LOG_INFO, "DMAN", " -- value count was %i", drefSize);
 			return drefSize;
 		}
+		default:
+			// No match
+			Log::WriteLine(LOG_ERROR, "DMAN", "ERROR: Unrecognized data type.");
+			return 0;
+		}
+	}
+
+	template<typename T>
+	static void Append(std::vector<unsigned char>& out, const T* values, int count)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+		out.insert(out.end(), bytes, bytes + count * sizeof(T));
+	}
+
+	int DataManager::GetTyped(const ResolvedDref& dref, std::vector<unsigned char>& values, WireType& type)
+	{
+		XPLMDataRef xdref = dref.xdref;
+		type = WireFloat;
+		if (!xdref)
+		{
+			return 0;
+		}
+
+		// Prefer the most precise type X-Plane offers, rather than the type
+		// closest to float as Resolve does.
+		XPLMDataTypeID types = dref.types;
+		if ((types & xplmType_Double) == xplmType_Double)
+		{
+			double value = ReadScalar(xdref, ReadDouble, XPLMGetDatad);
+			type = WireDouble;
+			Append(values, &value, 1);
+			return 1;
+		}
+		if ((types & xplmType_Float) == xplmType_Float)
+		{
+			float value = ReadScalar(xdref, ReadFloat, XPLMGetDataf);
+			Append(values, &value, 1);
+			return 1;
+		}
+		if ((types & xplmType_Int) == xplmType_Int)
+		{
+			int value = ReadScalar(xdref, ReadInt, XPLMGetDatai);
+			type = WireInt;
+			Append(values, &value, 1);
+			return 1;
+		}
+		if ((types & xplmType_FloatArray) == xplmType_FloatArray)
+		{
+			static std::vector<float> fValues;
+			fValues.resize(std::max(dref.size, 1));
+			int count = ReadArray(xdref, ReadFloatArray, &fValues[0], dref.size, XPLMGetDatavf);
+			Append(values, &fValues[0], count);
+			return count;
+		}
+		if ((types & xplmType_IntArray) == xplmType_IntArray)
+		{
+			static std::vector<int> iValues;
+			iValues.resize(std::max(dref.size, 1));
+			int count = ReadArray(xdref, ReadIntArray, &iValues[0], dref.size, XPLMGetDatavi);
+			type = WireInt;
+			Append(values, &iValues[0], count);
+			return count;
+		}
+		if ((types & xplmType_Data) == xplmType_Data)
+		{
+			std::size_t start = values.size();
+			values.resize(start + dref.size);
+			int count = dref.size == 0 ? 0 : ReadArray(xdref, ReadBytes, (char*)&values[start], dref.size, GetBytes);
+			values.resize(start + count);
+			type = WireBytes;
+			return count;
+		}
 
-		// No match
 		Log::WriteLine(LOG_ERROR, "DMAN", "ERROR: Unrecognized data type.");
 		return 0;
 	}
 
 	double DataManager::GetDouble(DREF dref, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
-		double value = XPLMGetDatad(xdref);
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		double value = ReadScalar(xdref, ReadDouble, XPLMGetDatad);
 		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %i (x:%X) result %f for a/c %i",
 			dref, xdref, value, aircraft);
 		return value;
@@ -422,8 +777,8 @@ namespace XPC
 
 	float DataManager::GetFloat(DREF dref, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
-		float value = XPLMGetDataf(xdref);
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		float value = ReadScalar(xdref, ReadFloat, XPLMGetDataf);
 		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %i (x:%X) result %f for a/c %i",
 			dref, xdref, value, aircraft);
 		return value;
@@ -431,8 +786,8 @@ namespace XPC
 
 	int DataManager::GetInt(DREF dref, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
-		int value = XPLMGetDatai(xdref);
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		int value = ReadScalar(xdref, ReadInt, XPLMGetDatai);
 		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %i (x:%X) result %i for a/c %i",
 			dref, xdref, value, aircraft);
 		return value;
@@ -440,8 +795,8 @@ namespace XPC
 
 	int DataManager::GetFloatArray(DREF dref, float values[], int size, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
-		int resultSize = XPLMGetDatavf(xdref, values, 0, size);
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		int resultSize = ReadArray(xdref, ReadFloatArray, values, size, XPLMGetDatavf);
 		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %i (x:%X) result size %i for a/c %i",
 			dref, xdref, resultSize, aircraft);
 		return resultSize;
@@ -449,8 +804,8 @@ namespace XPC
 
 	int DataManager::GetIntArray(DREF dref, int values[], int size, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
-		int resultSize = XPLMGetDatavi(xdref, values, 0, size);
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		int resultSize = ReadArray(xdref, ReadIntArray, values, size, XPLMGetDatavi);
 		Log::FormatLine(LOG_INFO, "DMAN", "Get DREF %i (x:%X) result size %i for a/c %i",
 			dref, xdref, resultSize, aircraft);
 		return resultSize;
@@ -458,7 +813,8 @@ namespace XPC
 
 	void DataManager::Set(DREF dref, double value, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		ForgetReads(xdref);
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %i (x:%X) to %f for a/c %i",
 			dref, xdref, value, aircraft);
 		XPLMSetDatad(xdref, value);
@@ -466,7 +822,8 @@ namespace XPC
 
 	void DataManager::Set(DREF dref, float value, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		ForgetReads(xdref);
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %i (x:%X) to %f for a/c %i",
 			dref, xdref, value, aircraft);
 		XPLMSetDataf(xdref, value);
@@ -474,7 +831,8 @@ namespace XPC
 
 	void DataManager::Set(DREF dref, int value, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		ForgetReads(xdref);
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %i (x:%X) to %i for a/c %i",
 			dref, xdref, value, aircraft);
 		XPLMSetDatai(xdref, value);
@@ -482,10 +840,11 @@ namespace XPC
 
 	void DataManager::Set(DREF dref, float values[], int size, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		ForgetReads(xdref);
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %i (x:%X) (%i values) for a/c %i",
 			dref, xdref, size, aircraft);
-		int drefSize = XPLMGetDatavf(xdref, NULL, 0, 0);
+		int drefSize = GetArraySize(dref, aircraft, false);
 		if (drefSize < size)
 		{
 			Log::FormatLine(LOG_WARN, "DMAN", "Warning: Too many values when setting DREF %i. Expected %i, got %i",
@@ -497,10 +856,11 @@ namespace XPC
 
 	void DataManager::Set(DREF dref, int values[], int size, char aircraft)
 	{
-		const XPLMDataRef& xdref = aircraft == 0 ? drefs[dref] : mdrefs[aircraft][dref];
+		XPLMDataRef xdref = Lookup(dref, aircraft);
+		ForgetReads(xdref);
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %i (x:%X) (%i values) for a/c %i",
 			dref, xdref, size, aircraft);
-		int drefSize = XPLMGetDatavi(xdref, NULL, 0, 0);
+		int drefSize = GetArraySize(dref, aircraft, true);
 		if (drefSize < size)
 		{
 			Log::FormatLine(LOG_WARN, "DMAN", "Warning: Too many values when setting DREF %i. Expected %i, got %i",
@@ -512,24 +872,21 @@ namespace XPC
 
 	void DataManager::Set(const string& dref, float values[], int size)
 	{
-		XPLMDataRef& xdref = sdrefs[dref];
-		if (xdref == NULL)
-		{
-			xdref = XPLMFindDataRef(dref.c_str());
-		}
+		ResolvedDref rdref = Resolve(dref);
+		XPLMDataRef xdref = rdref.xdref;
 		if (!xdref)
 		{
-			// DREF does not exist
-			Log::FormatLine(LOG_ERROR, "DMAN", "ERROR: invalid DREF %s", dref.c_str());
+			// DREF does not exist. Resolve has already logged it.
 			return;
 		}
+		ForgetReads(xdref);
         if (std::isnan(values[0]))
 		{
 			Log::WriteLine(LOG_ERROR, "DMAN", "ERROR: Value must be a number (NaN received)");
 			return;
 		}
 
-		XPLMDataTypeID dataType = XPLMGetDataRefTypes(xdref);
+		XPLMDataTypeID dataType = rdref.types;
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %s (x:%X) Type: %i", dref.c_str(), xdref, dataType);
 		if ((dataType & 2) == 2) // Float
 		{
@@ -538,7 +895,7 @@ namespace XPC
 		}
 		else if ((dataType & 8) == 8) // Float Array
 		{
-			int drefSize = XPLMGetDatavf(xdref, NULL, 0, 0);
+			int drefSize = rdref.size;
 			if (size > drefSize)
 			{
 				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than actual dref size");
@@ -563,7 +920,7 @@ namespace XPC
 		{
 			const std::size_t TMP_SIZE = 200;
 			int iValues[TMP_SIZE];
-			int drefSize = XPLMGetDatavi(xdref, NULL, 0, 0);
+			int drefSize = rdref.size;
 			if (size > drefSize)
 			{
 				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than actual dref size");
@@ -589,7 +946,7 @@ namespace XPC
 		{
 			const std::size_t TMP_SIZE = 1024;
 			char bValues[TMP_SIZE];
-			int drefSize = XPLMGetDatab(xdref, NULL, 0, 0);
+			int drefSize = rdref.size;
 			if (size > drefSize)
 			{
 				Log::WriteLine(LOG_WARN, "DMAN", "Warning: dref size is larger than actual dref size");
@@ -617,12 +974,106 @@ namespace XPC
 		}
 
 
-		if (!XPLMCanWriteDataRef(xdref))
+		if (!rdref.writable)
 		{
 			Log::WriteLine(LOG_WARN, "DMAN", "WARN: dref is not writable. The write operation probably failed.");
 		}
 	}
 
+	template<typename T>
+	static std::vector<T>& Unpack(const unsigned char* values, int count)
+	{
+		static std::vector<T> out;
+		out.resize(std::max(count, 1));
+		std::memcpy(&out[0], values, count * sizeof(T));
+		return out;
+	}
+
+	void DataManager::SetTyped(const string& dref, WireType type, const unsigned char* values, int count)
+	{
+		ResolvedDref rdref = Resolve(dref);
+		XPLMDataRef xdref = rdref.xdref;
+		if (!xdref || count < 1)
+		{
+			return;
+		}
+		ForgetReads(xdref);
+
+		XPLMDataTypeID types = rdref.types;
+		Log::FormatLine(LOG_INFO, "DMAN", "Setting DREF %s (x:%X) Type: %i, Wire type: %i",
+			dref.c_str(), xdref, types, type);
+		bool scalar = count == 1;
+		switch (type)
+		{
+		case WireDouble:
+			if (scalar && (types & xplmType_Double) == xplmType_Double)
+			{
+				XPLMSetDatad(xdref, Unpack<double>(values, 1)[0]);
+				return;
+			}
+			break;
+		case WireFloat:
+			if (scalar && (types & xplmType_Float) == xplmType_Float)
+			{
+				XPLMSetDataf(xdref, Unpack<float>(values, 1)[0]);
+				return;
+			}
+			if ((types & xplmType_FloatArray) == xplmType_FloatArray)
+			{
+				XPLMSetDatavf(xdref, &Unpack<float>(values, count)[0], 0, std::min(count, rdref.size));
+				return;
+			}
+			break;
+		case WireInt:
+			if (scalar && (types & xplmType_Int) == xplmType_Int)
+			{
+				XPLMSetDatai(xdref, Unpack<int>(values, 1)[0]);
+				return;
+			}
+			if ((types & xplmType_IntArray) == xplmType_IntArray)
+			{
+				XPLMSetDatavi(xdref, &Unpack<int>(values, count)[0], 0, std::min(count, rdref.size));
+				return;
+			}
+			break;
+		case WireBytes:
+			if ((types & xplmType_Data) == xplmType_Data)
+			{
+				XPLMSetDatab(xdref, const_cast<unsigned char*>(values), 0, std::min(count, rdref.size));
+				return;
+			}
+			break;
+		default:
+			Log::FormatLine(LOG_ERROR, "DMAN", "ERROR: Unknown wire type %i.", type);
+			return;
+		}
+
+		// The dataref has a different type. Fall back on the float conversions.
+		std::vector<float> fValues(count);
+		switch (type)
+		{
+		case WireDouble:
+		{
+			const std::vector<double>& dValues = Unpack<double>(values, count);
+			std::copy(dValues.begin(), dValues.begin() + count, fValues.begin());
+			break;
+		}
+		case WireInt:
+		{
+			const std::vector<int>& iValues = Unpack<int>(values, count);
+			std::copy(iValues.begin(), iValues.begin() + count, fValues.begin());
+			break;
+		}
+		case WireFloat:
+			fValues = Unpack<float>(values, count);
+			break;
+		default:
+			std::copy(values, values + count, fValues.begin());
+			break;
+		}
+		Set(dref, &fValues[0], count);
+	}
+
 	void DataManager::SetGear(float gear, bool immediate, char aircraft)
 	{
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting gear (value:%f, immediate:%i) for aircraft %i",
@@ -659,37 +1110,31 @@ namespace XPC
 		}
 	}
 
-	void DataManager::SetPosition(double pos[3], char aircraft)
+	// Moves an aircraft without touching its orientation. Returns false if
+	// the position is invalid.
+	static bool SetLocation(double pos[3], char aircraft)
 	{
 		Log::FormatLine(LOG_INFO, "DMAN", "Setting position (%f, %f, %f) for aircraft %i",
 			pos[0], pos[1], pos[2], aircraft);
 		if (std::isnan(pos[0] + pos[1] + pos[2]))
 		{
 			Log::WriteLine(LOG_ERROR, "DMAN", "ERROR: Position must be a number (NaN received)");
-			return;
+			return false;
 		}
 
-		if (IsDefault(pos[0]))
+		if (DataManager::IsDefault(pos[0]))
 		{
-			pos[0] = GetDouble(DREF_Latitude, aircraft);
+			pos[0] = DataManager::GetDouble(DREF_Latitude, aircraft);
 		}
-		if (IsDefault(pos[1]))
+		if (DataManager::IsDefault(pos[1]))
 		{
-			pos[1] = GetDouble(DREF_Longitude, aircraft);
+			pos[1] = DataManager::GetDouble(DREF_Longitude, aircraft);
 		}
-		if (IsDefault(pos[2]))
+		if (DataManager::IsDefault(pos[2]))
 		{
-			pos[2] = GetDouble(DREF_Elevation, aircraft);
+			pos[2] = DataManager::GetDouble(DREF_Elevation, aircraft);
 		}
 
-		// See: http://www.xsquawkbox.net/xpsdk/mediawiki/MovingThePlane
-		// Need to get the aircraft's current orientation before moving and
-		// reset the orientation after moving to update the quaternion
-		float orient[3];
-		orient[0] = GetFloat(DREF_Pitch, aircraft);
-		orient[1] = GetFloat(DREF_Roll, aircraft);
-		orient[2] = GetFloat(DREF_HeadingTrue, aircraft);
-
 		// Now set the aircraft's position. Need to set world position for
 		// "long" moves, but since there isn't an easy way to calculate "long",
 		// we just set it every time.
@@ -697,15 +1142,38 @@ namespace XPC
 		XPLMWorldToLocal(pos[0], pos[1], pos[2], &local[0], &local[1], &local[2]);
 		// If the sim is paused, setting global position won't update the
 		// local position, so set them just in case.
-		Set(DREF_LocalX, local[0], aircraft);
-		Set(DREF_LocalY, local[1], aircraft);
-		Set(DREF_LocalZ, local[2], aircraft);
+		DataManager::Set(DREF_LocalX, local[0], aircraft);
+		DataManager::Set(DREF_LocalY, local[1], aircraft);
+		DataManager::Set(DREF_LocalZ, local[2], aircraft);
 		// If the sim is unpaused, this will override the above settings.
-		Set(DREF_Latitude,  pos[0], aircraft);
-		Set(DREF_Longitude, pos[1], aircraft);
-		Set(DREF_Elevation, pos[2], aircraft);
+		DataManager::Set(DREF_Latitude,  pos[0], aircraft);
+		DataManager::Set(DREF_Longitude, pos[1], aircraft);
+		DataManager::Set(DREF_Elevation, pos[2], aircraft);
+		return true;
+	}
 
-		// Now reset orientation to update q
+	void DataManager::SetPosition(double pos[3], char aircraft)
+	{
+		// See: http://www.xsquawkbox.net/xpsdk/mediawiki/MovingThePlane
+		// Need to get the aircraft's current orientation before moving and
+		// reset the orientation after moving to update the quaternion
+		float orient[3];
+		orient[0] = GetFloat(DREF_Pitch, aircraft);
+		orient[1] = GetFloat(DREF_Roll, aircraft);
+		orient[2] = GetFloat(DREF_HeadingTrue, aircraft);
+
+		if (SetLocation(pos, aircraft))
+		{
+			// Now reset orientation to update q
+			SetOrientation(orient, aircraft);
+		}
+	}
+
+	void DataManager::SetPose(double pos[3], float orient[3], char aircraft)
+	{
+		// Setting the new orientation after moving updates the quaternion, so
+		// there is no need to save and restore the old one as SetPosition does.
+		SetLocation(pos, aircraft);
 		SetOrientation(orient, aircraft);
 	}
 
@@ -794,6 +1262,8 @@ namespace XPC
 		}
 
 		XPLMCommandOnce(xcref);
+		// A command can change any dataref.
+		ForgetAllReads();
 	}
 
 	float DataManager::GetDefaultValue()
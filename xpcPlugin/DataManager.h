@@ -3,7 +3,11 @@
 #ifndef XPCPLUGIN_DATAMANAGER_H_
 #define XPCPLUGIN_DATAMANAGER_H_
 
+#include <cstdint>
 #include <string>
+#include <vector>
+
+#include "XPLMDataAccess.h"
 
 namespace XPC
 {
@@ -139,6 +143,36 @@ namespace XPC
 	/// Maps X-Plane dataref lines to XPC DREF values.
 	extern DREF XPData[134][8];
 
+	/// A dataref whose X-Plane handle, type and size have been looked up once,
+	/// so that it can be read repeatedly without any string lookups.
+	struct ResolvedDref
+	{
+		/// The X-Plane handle, or NULL if the dataref does not exist.
+		XPLMDataRef xdref;
+		/// The type the dataref is read as. This is a single xplmType flag,
+		/// chosen to be as close to float as the dataref allows.
+		XPLMDataTypeID type;
+		/// The number of elements in the dataref. Always 1 for scalars.
+		int size;
+		/// Every type X-Plane reports for the dataref, as xplmType flags.
+		XPLMDataTypeID types;
+		/// Whether X-Plane allows the dataref to be written.
+		bool writable;
+		/// The number of calls to DataManager::Invalidate before the above
+		/// were looked up. See DataManager::Refresh.
+		std::uint32_t generation;
+	};
+
+	/// The encodings of values in typed messages. Values are sent in the
+	/// native type of their dataref so that no precision is lost.
+	enum WireType
+	{
+		WireFloat = 1,  // 32-bit float
+		WireDouble = 2, // 64-bit float
+		WireInt = 3,    // 32-bit signed integer
+		WireBytes = 4   // Raw bytes
+	};
+
 	/// Contains methods to martial data between the plugin and X-Plane.
 	///
 	/// \author Jason Watkins
@@ -153,6 +187,38 @@ namespace XPC
 		/// into X-Plane internal data.
 		static void Initialize();
 
+		/// Publishes the counters of the dataref name cache to the stats
+		/// endpoint.
+		static void PublishStats();
+
+		/// Forgets the cached handles, types and sizes of datarefs, so they
+		/// are looked up again the next time they are used. Call this when an
+		/// aircraft is loaded, since its plugins may register datarefs with
+		/// different types or sizes.
+		///
+		/// \remarks Prepared queries keep their own copies of resolved
+		///          datarefs. Their handles remain valid, since X-Plane never
+		///          reuses a handle for a different name, but their types and
+		///          sizes must be looked up again with Refresh.
+		static void Invalidate();
+
+		/// Looks up the type, size and writability of a resolved dataref
+		/// again if Invalidate has been called since it was resolved.
+		///
+		/// \param dref The dataref to update.
+		/// \returns    true if the dataref was looked up again.
+		static bool Refresh(ResolvedDref& dref);
+
+		/// Starts a new flight loop pass. Each dataref is read from X-Plane at
+		/// most once per pass; later reads in the same pass reuse the value
+		/// unless the dataref has been written since. Reads before the first
+		/// pass are never cached.
+		static void BeginPass();
+
+		/// Ends the current flight loop pass. Reads between passes, such as
+		/// those made while handling plugin messages, are not cached.
+		static void EndPass();
+
 		/// Gets a dataref based on its name.
 		///
 		/// \param dref   The name of the dref to get.
@@ -176,6 +242,37 @@ namespace XPC
 		///          strongly typed methods instead.
 		static int Get(const std::string& dref, float values[], int size);
 
+		/// Looks up the X-Plane handle, type and size of a dataref.
+		///
+		/// \param dref The name of the dataref.
+		/// \returns    The resolved dataref. If the dataref does not exist, the
+		///             xdref member is NULL.
+		///
+		/// \remarks The metadata is looked up the first time a name is resolved
+		///          and cached until Invalidate is called.
+		static ResolvedDref Resolve(const std::string& dref);
+
+		/// Gets a dataref that has already been resolved.
+		///
+		/// \param dref   The resolved dataref to get.
+		/// \param values An array in which the result of the operation will be stored.
+		/// \param size   The size of the values array.
+		/// \returns      The number of elements placed in the values array. This
+		///               is the lesser of size and the size of the dataref when it
+		///               was resolved, or 0 if the dataref does not exist.
+		static int Get(const ResolvedDref& dref, float values[], int size);
+
+		/// Gets a dataref that has already been resolved in its native type.
+		///
+		/// \param dref   The resolved dataref to get.
+		/// \param values A buffer to which the values are appended, in host byte order.
+		/// \param type   Set to the encoding of the values.
+		/// \returns      The number of elements appended to values.
+		///
+		/// \remarks Unlike the float overloads, this method never converts values.
+		///          Scalars that X-Plane offers as a double are read as a double.
+		static int GetTyped(const ResolvedDref& dref, std::vector<unsigned char>& values, WireType& type);
+
 		/// Gets the value of a double dataref.
 		///
 		/// \param dref     The dataref to get.
@@ -296,6 +393,18 @@ namespace XPC
 		///          strongly typed methods instead.
 		static void Set(const std::string& dref, float values[], int size);
 
+		/// Sets a dataref based on its name, from values in any wire type.
+		///
+		/// \param dref   The name of the dataref to set.
+		/// \param type   The encoding of values.
+		/// \param values The values, in host byte order. Need not be aligned.
+		/// \param count  The number of elements in values.
+		///
+		/// \remarks Values whose type matches the dataref are passed to X-Plane
+		///          unchanged. Other values are converted to float and set with
+		///          the float overload.
+		static void SetTyped(const std::string& dref, WireType type, const unsigned char* values, int count);
+
 		/// Sets the value of a double dataref.
 		///
 		/// \param dref     The dataref to set.
@@ -405,6 +514,16 @@ namespace XPC
 		/// \param aircraft The aircraft to set the orientation of.
 		static void SetOrientation(float orient[3], char aircraft = 0);
 
+		/// Sets the position and orientation of the specified aircraft together.
+		///
+		/// \details Equivalent to SetPosition followed by SetOrientation, except
+		///          that the current orientation is not read back and restored
+		///          in between, since it is about to be replaced anyway.
+		/// \param pos      Latitude, longitude and altitude, as for SetPosition.
+		/// \param orient   Pitch, roll and yaw, as for SetOrientation.
+		/// \param aircraft The aircraft to move.
+		static void SetPose(double pos[3], float orient[3], char aircraft = 0);
+
 		/// Sets flaps on the the player aircraft.
 		///
 		/// \param value The flaps settings. Should be between 0.0 (no flaps) and 1.0 (full flaps).
@@ -16,7 +16,7 @@
 
 class ISocket {
 public:
-	virtual void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) const = 0;
+	virtual void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) = 0;
 
 	virtual int Read(unsigned char* buffer, int size, sockaddr* remoteAddr) = 0;
 };
@@ -9,47 +9,117 @@
 #include <sstream>
 #include <string>
 
-#include <list>
-
 namespace XPC
 {
-	Message::Message() {}
+	Message::Message()
+		: buffer(NULL), size(0), datagram(NULL), pool(NULL) {}
 
-	std::list<Message> Message::ReadFrom(ISocket& sock)
-	{
+	Message::Message(const UDPSocket::Datagram* datagram, ReceivePool* pool, std::size_t offset, std::size_t size,
+		std::chrono::steady_clock::time_point received)
+		: buffer(datagram->data + offset), size(size), datagram(datagram), pool(pool), received(received) {}
 
-		static const std::size_t bufferSize = 4096;
-		unsigned char buffer[bufferSize];
-		sockaddr addr;
-		int len = sock.Read(buffer, bufferSize, &addr);
-		if (len <= 0) return {};
+	int Message::Parse(const UDPSocket::Datagram* datagram, ReceivePool& pool, Message msgs[], int count)
+	{
+		const unsigned char* buffer = datagram->data;
+		int len = datagram->size;
+		if (len <= 0) return 0;
+		if (len > (int)UDPSocket::Datagram::capacity)
+		{
+			Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Datagram too large (%i bytes)", len);
+			return 0;
+		}
 
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (len >= 5 && memcmp(buffer, "XPC2", 4) == 0)
+		{
+			return ParseFramed(datagram, pool, now, msgs, count);
+		}
+		return ParseLegacy(datagram, pool, now, msgs, count);
+	}
 
-		std::list<Message> arr = {};
+	int Message::ParseFramed(const UDPSocket::Datagram* datagram, ReceivePool& pool,
+		std::chrono::steady_clock::time_point received, Message msgs[], int count)
+	{
+		const unsigned char* buffer = datagram->data;
+		int len = datagram->size;
+		if (buffer[4] != 0)
+		{
+			Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Reserved header byte is %u, expected 0", buffer[4]);
+			return 0;
+		}
+		int n = 0;
+		int cur = 5;
+		while (cur < len)
+		{
+			if (n == count)
+			{
+				Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Too many messages in datagram (max %i)", count);
+				break;
+			}
+			if (cur + 2 > len)
+			{
+				Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Truncated frame header at offset %i", cur);
+				break;
+			}
+			int frameLen = buffer[cur] | (buffer[cur + 1] << 8);
+			cur += 2;
+			if (frameLen < 5 || cur + frameLen > len)
+			{
+				Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Invalid frame length %i at offset %i", frameLen, cur - 2);
+				break;
+			}
+			msgs[n] = Message(datagram, &pool, cur, frameLen, received);
+			Log::FormatLine(LOG_TRACE, "MESG", "Read framed message with length %i", frameLen);
+			++n;
+			cur += frameLen;
+		}
+		return n;
+	}
 
+	int Message::ParseLegacy(const UDPSocket::Datagram* datagram, ReceivePool& pool,
+		std::chrono::steady_clock::time_point received, Message msgs[], int count)
+	{
+		// Legacy datagrams have no framing. Split them wherever one of the
+		// message types that clients are known to concatenate appears.
+		const unsigned char* buffer = datagram->data;
+		int len = datagram->size;
+		int n = 0;
 		int msgStart = 0;
 		for (int i = 4; i < len-4; i++) {
-			std::string potentialCommand = { (char)buffer[i], (char)buffer[i + 1], (char)buffer[i + 2], (char)buffer[i + 3] };
-
-			if (potentialCommand == "DREF" || potentialCommand == "WYPT" || potentialCommand == "TEXT") {
-				Message m;
-				memcpy(m.buffer, buffer + msgStart, i + 1 - msgStart);
-				m.source = addr;
-				m.size = i + 1 - msgStart;
-				Log::FormatLine(LOG_TRACE, "MESG", "Read message with length %i", m.size);
+			if (n == count - 1)
+			{
+				Log::FormatLine(LOG_ERROR, "MESG", "ERROR: Too many messages in datagram (max %i)", count);
+				break;
+			}
+			if (memcmp(buffer + i, "DREF", 4) == 0 || memcmp(buffer + i, "WYPT", 4) == 0 || memcmp(buffer + i, "TEXT", 4) == 0) {
+				msgs[n] = Message(datagram, &pool, msgStart, i + 1 - msgStart, received);
+				Log::FormatLine(LOG_TRACE, "MESG", "Read message with length %i", msgs[n].size);
+				++n;
 				msgStart = i;
-				arr.push_back(m);
 			}
 		}
 
-		Message m;
-		memcpy(m.buffer, buffer + msgStart, len - msgStart);
-		m.source = addr;
-		m.size = len - msgStart;
-		Log::FormatLine(LOG_TRACE, "MESG", "Read message with length %i", m.size);
-		arr.push_back(m);
+		msgs[n] = Message(datagram, &pool, msgStart, len - msgStart, received);
+		Log::FormatLine(LOG_TRACE, "MESG", "Read message with length %i", msgs[n].size);
+		return n + 1;
+	}
+
+	void Message::Release()
+	{
+		if (pool != NULL)
+		{
+			pool->Release(datagram);
+			pool = NULL;
+		}
+	}
 
-		return arr;
+	Message Message::Share() const
+	{
+		if (pool != NULL)
+		{
+			pool->AddRef(datagram);
+		}
+		return *this;
 	}
 
 	std::string Message::GetHead() const
@@ -58,6 +128,11 @@ namespace XPC
 		return val;
 	}
 
+	std::uint32_t Message::GetOpcode() const
+	{
+		return size < 4 ? 0 : Opcode((const char*)buffer);
+	}
+
 	const unsigned char* Message::GetBuffer() const
 	{
 		const unsigned char* val = size == 0 ? NULL : buffer;
@@ -69,13 +144,23 @@ namespace XPC
 		return size;
 	}
 
+	std::chrono::steady_clock::time_point Message::GetReceiveTime() const
+	{
+		return received;
+	}
+
 	struct sockaddr Message::GetSource() const
 	{
-		return source;
+		return datagram->addr;
 	}
 
 	void Message::PrintToLog() const
 	{
+		if (LOG_LEVEL < LOG_DEBUG)
+		{
+			return; // Nothing below would be written
+		}
+
 		using namespace std;
 		stringstream ss;
 
@@ -87,14 +172,14 @@ namespace XPC
 		}
 		Log::WriteLine(LOG_TRACE, "DBUG", ss.str());
 
-		std::string head = GetHead();
+		std::uint32_t opcode = GetOpcode();
 		ss.str("");
-		ss << "Head: " << head << std::dec << " Size: " << GetSize();
-		if (head == "CONN" || head == "WYPT" || head == "TEXT")
+		ss << "Head: " << GetHead() << std::dec << " Size: " << GetSize();
+		if (opcode == Opcode("CONN") || opcode == Opcode("WYPT") || opcode == Opcode("TEXT"))
 		{
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "CTRL")
+		else if (opcode == Opcode("CTRL"))
 		{
 			// Parse message data
 			float pitch = *((float*)(buffer + 5));
@@ -112,7 +197,7 @@ namespace XPC
 			ss << " Thr:" << thr << " Gear:" << (int)gear << " Flaps:" << flaps;
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "DATA")
+		else if (opcode == Opcode("DATA"))
 		{
 			size_t numCols = (size - 5) / 36;
 			float values[32][9];
@@ -134,7 +219,7 @@ namespace XPC
 				Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 			}
 		}
-		else if (head == "DREF")
+		else if (opcode == Opcode("DREF"))
 		{
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 			string dref((char*)buffer + 6, buffer[5]);
@@ -148,12 +233,12 @@ namespace XPC
 			}
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "GETC" || head == "GETP")
+		else if (opcode == Opcode("GETC") || opcode == Opcode("GETP"))
 		{
 			ss << " Aircraft:" << (int)buffer[5];
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "GETD")
+		else if (opcode == Opcode("GETD"))
 		{
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 			int cur = 6;
@@ -165,7 +250,7 @@ namespace XPC
 				cur += 1 + buffer[cur];
 			}
 		}
-		else if (head == "POSI")
+		else if (opcode == Opcode("POSI"))
 		{
 			char aircraft = buffer[5];
 			float gear = *((float*)(buffer + 30));
@@ -179,17 +264,17 @@ namespace XPC
 			ss << gear;
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "SIMU")
+		else if (opcode == Opcode("SIMU"))
 		{
 			ss << ' ' << (int)buffer[5];
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "VIEW")
+		else if (opcode == Opcode("VIEW"))
 		{
 			ss << "Type:" << *((unsigned long*)(buffer + 5));
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
 		}
-		else if (head == "COMM")
+		else if (opcode == Opcode("COMM"))
 		{
 			ss << "Type:" << *((unsigned long*)(buffer + 5));
 			Log::WriteLine(LOG_DEBUG, "DBUG", ss.str());
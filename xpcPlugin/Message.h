@@ -3,14 +3,31 @@
 #ifndef XPCPLUGIN_MESSAGE_H_
 #define XPCPLUGIN_MESSAGE_H_
 
-#include "ISocket.h"
+#include "ReceivePool.h"
+#include "UDPSocket.h"
 
-#include <list>
+#include <chrono>
+#include <cstdint>
 
 namespace XPC
 {
+	/// Packs a four character message header into the integer returned by
+	/// Message::GetOpcode, so that headers can be used as case labels.
+	///
+	/// \param head A string of at least four characters.
+	/// \returns    The opcode for the first four characters of head.
+	constexpr std::uint32_t Opcode(const char* head)
+	{
+		return (std::uint32_t)(unsigned char)head[0] << 24 | (std::uint32_t)(unsigned char)head[1] << 16 |
+			(std::uint32_t)(unsigned char)head[2] << 8 | (std::uint32_t)(unsigned char)head[3];
+	}
+
 	/// Represents a message received from an XPC client.
 	///
+	/// \details A message is a lightweight view of part of a datagram held in
+	///          a ReceivePool. Copying a message does not copy its contents,
+	///          and the contents remain valid until Release is called.
+	///
 	/// \author Jason Watkins
 	/// \version 1.1
 	/// \since 1.0
@@ -19,18 +36,54 @@ namespace XPC
 	class Message
 	{
 	public:
-		/// Reads a datagram from the specified socket and interprets it as a
-		/// message.
+		/// The maximum number of messages parsed from a single datagram.
+		static const int maxPerDatagram = 256;
+
+		/// Initializes an empty message.
+		Message();
+
+		/// Interprets a datagram that has already been read into a pool buffer
+		/// as one or more messages.
+		///
+		/// \details Two datagram formats are supported. A legacy datagram is a
+		///          single message, or several DREF, WYPT or TEXT messages
+		///          concatenated together. A version 2 datagram starts with
+		///          the 5 byte header "XPC2" followed by a reserved 0 byte,
+		///          and then carries any number of messages of any type, each
+		///          encoded exactly as it would be on its own and preceded by
+		///          its length as a 16 bit little-endian integer. Version 2
+		///          datagrams with a non-zero reserved byte are dropped.
 		///
-		/// \param sock The socket to read from.
-		/// \returns    A message parsed from the data read from sock. If no
-		///             data was read or an error occurs, returns a message
-		///             with the size set to 0.
-		static std::list<Message> ReadFrom(ISocket& sock);
+		///          Parsing neither allocates nor copies the datagram. The
+		///          caller is responsible for calling ReceivePool::Retain with
+		///          the number of messages returned, or ReceivePool::Recycle
+		///          if none are kept.
+		/// \param datagram The datagram to parse.
+		/// \param pool     The pool that datagram was acquired from.
+		/// \param msgs     The array to store the messages in.
+		/// \param count    The number of elements in msgs.
+		/// \returns        The number of messages stored in msgs. If the
+		///                 datagram is empty, returns 0.
+		static int Parse(const UDPSocket::Datagram* datagram, ReceivePool& pool, Message msgs[], int count);
+
+		/// Releases this message's reference to the underlying datagram. The
+		/// message must not be used afterward.
+		void Release();
+
+		/// Gets another reference to this message, so it can be kept after
+		/// this one is released. The copy must be released separately, from
+		/// the same thread.
+		Message Share() const;
 
 		/// Gets the message header.
 		std::string GetHead() const;
 
+		/// Gets the message header as an integer without allocating.
+		///
+		/// \returns The opcode of the message header, or 0 if the message is
+		///          too short to have a header.
+		std::uint32_t GetOpcode() const;
+
 		/// Gets the buffer underlying the message.
 		const unsigned char* GetBuffer() const;
 
@@ -40,16 +93,26 @@ namespace XPC
 		/// Gets the address this message was read from.
 		struct sockaddr GetSource() const;
 
+		/// Gets the time at which the datagram containing this message was parsed.
+		std::chrono::steady_clock::time_point GetReceiveTime() const;
+
 		/// Prints the contents of the message to the XPC log.
 		void PrintToLog() const;
 
 	private:
-		Message();
+		static int ParseFramed(const UDPSocket::Datagram* datagram, ReceivePool& pool,
+			std::chrono::steady_clock::time_point received, Message msgs[], int count);
+		static int ParseLegacy(const UDPSocket::Datagram* datagram, ReceivePool& pool,
+			std::chrono::steady_clock::time_point received, Message msgs[], int count);
+
+		Message(const UDPSocket::Datagram* datagram, ReceivePool* pool, std::size_t offset, std::size_t size,
+			std::chrono::steady_clock::time_point received);
 
-		static const std::size_t bufferSize = 4096;
-		unsigned char buffer[bufferSize];
+		const unsigned char* buffer;
 		std::size_t size;
-		struct sockaddr source;
+		const UDPSocket::Datagram* datagram;
+		ReceivePool* pool;
+		std::chrono::steady_clock::time_point received;
 	};
 }
 #endif
@@ -18,11 +18,15 @@
 #include "DataManager.h"
 #include "Drawing.h"
 #include "Log.h"
+#include "Snapshot.h"
+#include "WriteStage.h"
 
 #include "XPLMUtilities.h"
 #include "XPLMGraphics.h"
+#include "XPLMProcessing.h"
 
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <cstdint>
@@ -31,16 +35,26 @@
 
 #define MULTICAST_GROUP "239.255.1.1"
 #define MULITCAST_PORT 49710
+#define CONNECTION_IDLE_TIMEOUT 300 // Seconds without a message before a client is forgotten
+#define DELTA_KEYFRAME_INTERVAL 30 // Delta responses between full responses
+#define MAX_FRAGMENT_SIZE 1472 // The largest UDP payload that fits in a 1500 byte Ethernet frame
+#define MAX_HELD_MESSAGES 64 // Writes held for each barrier agent
+// Writes held for all barrier agents together. Each one keeps a receive buffer
+// from being reused, so this stays far below the 1024 buffers in the pool.
+#define MAX_HELD_TOTAL 256
 
 
 namespace XPC
 {
-	std::map<std::string, MessageHandlers::ConnectionInfo> MessageHandlers::connections;
-	std::map<std::string, MessageHandler> MessageHandlers::handlers;
-
-	std::string MessageHandlers::connectionKey;
-	MessageHandlers::ConnectionInfo MessageHandlers::connection;
+	ConnectionRegistry MessageHandlers::connections(std::chrono::seconds(CONNECTION_IDLE_TIMEOUT));
+	ConnectionRegistry::Connection* MessageHandlers::connection;
+	std::vector<ConnectionRegistry::Handle> MessageHandlers::subscribers;
+	MessageHandlers::Step MessageHandlers::step = { ConnectionRegistry::invalidHandle, 0, -1, 0, false };
+	MessageHandlers::Barrier MessageHandlers::barrier;
+	std::uint32_t MessageHandlers::steppedFrames = 0;
 	ISocket* MessageHandlers::sock;
+	ISocket* MessageHandlers::beaconSock;
+	Snapshot* MessageHandlers::snapshot = NULL;
 	
 	static sockaddr multicast_address = UDPSocket::GetAddr(MULTICAST_GROUP, MULITCAST_PORT);
 
@@ -50,96 +64,218 @@ namespace XPC
 		MessageHandlers::sock = socket;
 	}
 
-	void MessageHandlers::HandleMessage(Message& msg)
+	void MessageHandlers::SetBeaconSocket(ISocket* socket)
 	{
-		if (handlers.size() == 0)
-		{
-			Log::WriteLine(LOG_TRACE, "MSGH", "Initializing handlers");
-			// Common messages
-			handlers.insert(std::make_pair("CONN", MessageHandlers::HandleConn));
-			handlers.insert(std::make_pair("CTRL", MessageHandlers::HandleCtrl));
-			handlers.insert(std::make_pair("DATA", MessageHandlers::HandleData));
-			handlers.insert(std::make_pair("DREF", MessageHandlers::HandleDref));
-			handlers.insert(std::make_pair("GETD", MessageHandlers::HandleGetD));
-			handlers.insert(std::make_pair("POSI", MessageHandlers::HandlePosi));
-			handlers.insert(std::make_pair("SIMU", MessageHandlers::HandleSimu));
-			handlers.insert(std::make_pair("TEXT", MessageHandlers::HandleText));
-			handlers.insert(std::make_pair("WYPT", MessageHandlers::HandleWypt));
-			handlers.insert(std::make_pair("VIEW", MessageHandlers::HandleView));
-			handlers.insert(std::make_pair("GETC", MessageHandlers::HandleGetC));
-			handlers.insert(std::make_pair("GETP", MessageHandlers::HandleGetP));
-			handlers.insert(std::make_pair("COMM", MessageHandlers::HandleComm));
-			// X-Plane data messages
-			handlers.insert(std::make_pair("DSEL", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("USEL", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("DCOC", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("UCOC", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("MOUS", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("CHAR", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("MENU", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("SOUN", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("FAIL", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("RECO", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("PAPT", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("VEHN", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("VEH1", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("VEHA", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("GSET", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("OBJN", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("OBJL", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("GSET", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("ISET", MessageHandlers::HandleXPlaneData));
-			handlers.insert(std::make_pair("BOAT", MessageHandlers::HandleXPlaneData));
-		}
+		Log::WriteLine(LOG_TRACE, "MSGH", "Setting beacon socket");
+		MessageHandlers::beaconSock = socket;
+	}
+
+	void MessageHandlers::SetSnapshot(Snapshot* snapshot)
+	{
+		MessageHandlers::snapshot = snapshot;
+	}
 
+	void MessageHandlers::HandleMessage(Message& msg)
+	{
 		// Make sure we really have a message to handle.
-		std::string head = msg.GetHead();
-		if (head == "")
+		std::uint32_t opcode = msg.GetOpcode();
+		if (opcode == 0)
 		{
 			Log::WriteLine(LOG_WARN, "MSGH", "Warning: HandleMessage called with empty message.");
 			return; // No Message to handle
 		}
 
-		// Set current connection
-		sockaddr sourceaddr = msg.GetSource();
-		connectionKey = UDPSocket::GetHost(&sourceaddr);
-		Log::FormatLine(LOG_INFO, "MSGH", "Handling message from %s", connectionKey.c_str());
-		std::map<std::string, ConnectionInfo>::iterator conn = connections.find(connectionKey);
-		if (conn == connections.end()) // New connection
-		{
-			connection = MessageHandlers::ConnectionInfo();
-			// If this is a new connection, that means we just added an elment
-			// to connections. As long as we never remove elements, the size of
-			// connections will serve as a unique id.
-			connection.id = static_cast<unsigned char>(connections.size());
-			connection.addr = sourceaddr;
-			connection.getdCount = 0;
-			connections[connectionKey] = connection;
-			Log::FormatLine(LOG_DEBUG, "MSGH", "New connection. ID=%u, Remote=%s",
-				connection.id, connectionKey.c_str());
+		SetConnection(msg);
+		msg.PrintToLog();
+		if (HoldForBarrier(msg))
+		{
+			return;
 		}
-		else
+
+		// Dispatch to the handler for this message type, or to the unknown
+		// message handler if there isn't one.
+		switch (opcode)
 		{
-			connection = (*conn).second;
-			Log::FormatLine(LOG_DEBUG, "MSGH", "Existing connection. ID=%u, Remote=%s",
-				connection.id, connectionKey.c_str());
+		// Common messages
+		case Opcode("BARR"): HandleBarr(msg); break;
+		case Opcode("CONN"): HandleConn(msg); break;
+		case Opcode("CTRL"): HandleCtrl(msg); break;
+		case Opcode("DATA"): HandleData(msg); break;
+		case Opcode("DREF"): HandleDref(msg); break;
+		case Opcode("DRFT"): HandleDrft(msg); break;
+		case Opcode("GETD"): HandleGetD(msg); break;
+		case Opcode("PREP"): HandlePrep(msg); break;
+		case Opcode("GETQ"): HandleGetQ(msg); break;
+		case Opcode("SUBS"): HandleSubs(msg); break;
+		case Opcode("POSI"): HandlePosi(msg); break;
+		case Opcode("POSB"): HandlePosb(msg); break;
+		case Opcode("SIMU"): HandleSimu(msg); break;
+		case Opcode("STEP"): HandleStep(msg); break;
+		case Opcode("TEXT"): HandleText(msg); break;
+		case Opcode("WYPT"): HandleWypt(msg); break;
+		case Opcode("VIEW"): HandleView(msg); break;
+		case Opcode("GETC"): HandleGetC(msg); break;
+		case Opcode("GETP"): HandleGetP(msg); break;
+		case Opcode("COMM"): HandleComm(msg); break;
+		// X-Plane data messages
+		case Opcode("DSEL"):
+		case Opcode("USEL"):
+		case Opcode("DCOC"):
+		case Opcode("UCOC"):
+		case Opcode("MOUS"):
+		case Opcode("CHAR"):
+		case Opcode("MENU"):
+		case Opcode("SOUN"):
+		case Opcode("FAIL"):
+		case Opcode("RECO"):
+		case Opcode("PAPT"):
+		case Opcode("VEHN"):
+		case Opcode("VEH1"):
+		case Opcode("VEHA"):
+		case Opcode("GSET"):
+		case Opcode("OBJN"):
+		case Opcode("OBJL"):
+		case Opcode("ISET"):
+		case Opcode("BOAT"):
+			HandleXPlaneData(msg);
+			break;
+		default:
+			HandleUnknown(msg);
+			break;
 		}
+	}
+	
+	void MessageHandlers::SetConnection(const Message& msg)
+	{
+		bool created;
+		connection = &connections.Lookup(msg.GetSource(), created);
+		Log::FormatLine(LOG_INFO, "MSGH", "Handling message from %s", connection->host.c_str());
+		Log::FormatLine(LOG_DEBUG, "MSGH", "%s connection. ID=%u, Remote=%s",
+			created ? "New" : "Existing", connection->id, connection->host.c_str());
+	}
 
-		msg.PrintToLog();
-		// Check if there is a handler for this message type. If so, execute
-		// that handler. Otherwise, execute the unknown message handler.
-		std::map<std::string, MessageHandler>::iterator iter = handlers.find(head);
-		if (iter != handlers.end())
+	bool MessageHandlers::HoldForBarrier(const Message& msg)
+	{
+		// Writes from barrier agents wait until every agent has acted.
+		if (barrier.agents.empty() || barrier.releasing || msg.GetOpcode() == Opcode("BARR") || !IsWrite(msg))
 		{
-			MessageHandler handler = (*iter).second;
-			handler(msg);
+			return false;
 		}
-		else
+		Agent* agent = FindAgent(connections.GetHandle(*connection));
+		if (agent == NULL)
 		{
-			MessageHandlers::HandleUnknown(msg);
+			return false;
 		}
+		if (agent->held.size() >= MAX_HELD_MESSAGES || barrier.held >= MAX_HELD_TOTAL)
+		{
+			Log::FormatLine(LOG_ERROR, "BARR", "ERROR: Too many actions from connection %u. Dropping message.",
+				connection->id);
+			return true;
+		}
+		agent->held.push_back(msg.Share());
+		++barrier.held;
+		return true;
 	}
-	
+
+	int MessageHandlers::ApplyStagedWrites(WriteStage& stage, void (*taken)(const Message& msg, bool held))
+	{
+		int messages = 0;
+		Message msg;
+		int count;
+		while (stage.Next(msg, count))
+		{
+			SetConnection(msg);
+			// A held message is decoded again when the barrier releases it.
+			bool held = HoldForBarrier(msg);
+			for (int i = 0; i < count; ++i)
+			{
+				if (!held)
+				{
+					ApplyStaged(*stage.Front());
+				}
+				stage.Pop();
+			}
+			taken(msg, held);
+			if (!held)
+			{
+				++messages;
+			}
+			msg.Release();
+		}
+		return messages;
+	}
+
+	void MessageHandlers::RecordAnswered(const Message& msg)
+	{
+		SetConnection(msg);
+		const unsigned char* buffer = msg.GetBuffer();
+		if (msg.GetOpcode() == Opcode("GETD") && buffer[5] != 0)
+		{
+			ReadQuery(buffer + 6, msg.GetSize() - 6, buffer[5], connection->lastQuery);
+		}
+	}
+
+	void MessageHandlers::ApplyStaged(const StagedWrite& write)
+	{
+		switch (write.kind)
+		{
+		case StagedFloat:
+			DataManager::Set(write.dref, write.values[0], write.aircraft);
+			break;
+		case StagedInt:
+			DataManager::Set(write.dref, (int)write.values[0], write.aircraft);
+			break;
+		case StagedFloats:
+		{
+			float values[10];
+			std::copy(write.values, write.values + write.count, values);
+			DataManager::Set(write.dref, values, write.count, write.aircraft);
+			break;
+		}
+		case StagedNamed:
+		{
+			const float* data = write.data != NULL ? write.data : write.values;
+			DataManager::Set(std::string(write.name, write.nameLength), const_cast<float*>(data), write.count);
+			break;
+		}
+		case StagedPose:
+		{
+			double pos[3];
+			float orient[3];
+			std::copy(write.position, write.position + 3, pos);
+			std::copy(write.values, write.values + 3, orient);
+			DataManager::SetPose(pos, orient, write.aircraft);
+			break;
+		}
+		case StagedOverrideAI:
+			OverrideAI(&write.aircraft, 1);
+			break;
+		default:
+			Log::FormatLine(LOG_ERROR, "MSGH", "ERROR: Unexpected staged write %i", write.kind);
+			break;
+		}
+	}
+
+	bool MessageHandlers::IsWrite(const Message& msg)
+	{
+		switch (msg.GetOpcode())
+		{
+		case Opcode("CTRL"):
+		case Opcode("DATA"):
+		case Opcode("DREF"):
+		case Opcode("DRFT"):
+		case Opcode("POSI"):
+		case Opcode("POSB"):
+		case Opcode("SIMU"):
+		case Opcode("STEP"):
+		case Opcode("BARR"):
+		case Opcode("COMM"):
+			return true;
+		default:
+			return false;
+		}
+	}
+
 	void MessageHandlers::SendBeacon(const std::string& pluginVersion, unsigned short  pluginReceivePort, int xplaneVersion) {
 		
 		unsigned char response[128] = "BECN";
@@ -159,7 +295,7 @@ namespace XPC
 		memcpy(response + cur, pluginVersion.c_str(), len);
 		cur += strlen(pluginVersion.c_str()) + len;
 		
-		sock->SendTo(response, cur, &multicast_address);
+		beaconSock->SendTo(response, cur, &multicast_address);
 	}
 
 	void MessageHandlers::HandleConn(const Message& msg)
@@ -168,7 +304,8 @@ namespace XPC
 
 		// Store new port
 		unsigned short port = *((unsigned short*)(buffer + 5));
-		sockaddr* sa = &connection.addr;
+		sockaddr addr = connection->addr;
+		sockaddr* sa = &addr;
 		switch (sa->sa_family)
 		{
 		case AF_INET: // IPV4 address
@@ -187,26 +324,24 @@ namespace XPC
 			Log::WriteLine(LOG_ERROR, "CONN", "ERROR: Unknown address type.");
 			return;
 		}
-		connections.erase(connectionKey);
-		connectionKey = UDPSocket::GetHost(&connection.addr);
-		connections[connectionKey] = connection;
+		connections.Rekey(*connection, addr);
 
 		// Create response
 		unsigned char response[6] = "CONF";
-		response[5] = connection.id;
+		response[5] = (unsigned char)connection->id; // The wire format only has room for the low byte
 
 		// Update log
 		Log::FormatLine(LOG_TRACE, "CONN", "ID: %u New destination port: %u",
-			connection.id, port);
+			connection->id, port);
 
 		// Send response
-		sock->SendTo(response, 6, &connection.addr);
+		sock->SendTo(response, 6, &connection->addr);
 	}
 
 	void MessageHandlers::HandleCtrl(const Message& msg)
 	{
 		// Update Log
-		Log::FormatLine(LOG_TRACE, "CTRL", "Message Received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "CTRL", "Message Received (Conn %i)", connection->id);
 
 		const unsigned char* buffer = msg.GetBuffer();
 		std::size_t size = msg.GetSize();
@@ -287,11 +422,11 @@ namespace XPC
 		std::size_t numCols = (size - 5) / 36;
 		if (numCols > 0)
 		{
-			Log::FormatLine(LOG_TRACE, "DATA", "Message Received (Conn %i)", connection.id);
+			Log::FormatLine(LOG_TRACE, "DATA", "Message Received (Conn %i)", connection->id);
 		}
 		else
 		{
-			Log::FormatLine(LOG_WARN, "DATA", "WARNING: Empty data packet received (Conn %i)", connection.id);
+			Log::FormatLine(LOG_WARN, "DATA", "WARNING: Empty data packet received (Conn %i)", connection->id);
 			return;
 		}
 
@@ -431,7 +566,7 @@ namespace XPC
 
 	void MessageHandlers::HandleDref(const Message& msg)
 	{
-		Log::FormatLine(LOG_TRACE, "DREF", "Request to set DREF value received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "DREF", "Request to set DREF value received (Conn %i)", connection->id);
 		const unsigned char* buffer = msg.GetBuffer();
 		std::size_t size = msg.GetSize();
 		std::size_t pos = 5;
@@ -462,122 +597,521 @@ namespace XPC
 		}
 	}
 
+	void MessageHandlers::HandleDrft(const Message& msg)
+	{
+		// Format: repeated [name length][name][WireType][16-bit count][values],
+		// where each value takes the size of its type.
+		Log::FormatLine(LOG_TRACE, "DRFT", "Request to set typed DREF values received (Conn %i)", connection->id);
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		std::size_t pos = 5;
+		while (pos < size)
+		{
+			unsigned char len = buffer[pos++];
+			if (pos + len + 3 > size)
+			{
+				break;
+			}
+			std::string dref = std::string((char*)buffer + pos, len);
+			pos += len;
+
+			WireType type = (WireType)buffer[pos];
+			int count = buffer[pos + 1] | (buffer[pos + 2] << 8);
+			pos += 3;
+			std::size_t width;
+			switch (type)
+			{
+			case WireFloat: width = sizeof(float); break;
+			case WireDouble: width = sizeof(double); break;
+			case WireInt: width = sizeof(std::int32_t); break;
+			case WireBytes: width = 1; break;
+			default:
+				Log::FormatLine(LOG_ERROR, "DRFT", "ERROR: Unknown value type %u for %s.", type, dref.c_str());
+				return;
+			}
+			if (pos + width * count > size)
+			{
+				break;
+			}
+			DataManager::SetTyped(dref, type, buffer + pos, count);
+			pos += width * count;
+			Log::FormatLine(LOG_DEBUG, "DRFT", "Set %d values for %s", count, dref.c_str());
+		}
+		if (pos != size)
+		{
+			Log::WriteLine(LOG_ERROR, "DRFT", "ERROR: Command did not terminate at the expected position.");
+		}
+	}
+
 	void MessageHandlers::HandleGetC(const Message& msg)
 	{
 		const unsigned char* buffer = msg.GetBuffer();
 		std::size_t size = msg.GetSize();
-		if (size != 6)
+		if (size != 6 && size != 7)
 		{
 			Log::FormatLine(LOG_ERROR, "GCTL", "Unexpected message length: %u", size);
 			return;
 		}
 		unsigned char aircraft = buffer[5];
+		// Newer clients follow the aircraft with a byte of StateFlags.
+		unsigned char flags = size == 7 ? buffer[6] : 0;
 		// TODO(jason-watkins): Get proper printf specifier for unsigned char
 		Log::FormatLine(LOG_TRACE, "GCTL", "Getting control information for aircraft %u", aircraft);
 
-		float throttle[8];
-		unsigned char response[31] = "CTRL";
-		*((float*)(response + 5)) = DataManager::GetFloat(DREF_Elevator, aircraft);
-		*((float*)(response + 9)) = DataManager::GetFloat(DREF_Aileron, aircraft);
-		*((float*)(response + 13)) = DataManager::GetFloat(DREF_Rudder, aircraft);
-		DataManager::GetFloatArray(DREF_ThrottleSet, throttle, 8, aircraft);
-		*((float*)(response + 17)) = throttle[0];
-		if (aircraft == 0)
-		{
-			response[21] = (char)DataManager::GetInt(DREF_GearHandle, aircraft);
-		}
-		else
-		{
-			float mpGear[10];
-			DataManager::GetFloatArray(DREF_GearDeploy, mpGear, 10, aircraft);
-			response[21] = mpGear[0] > 0.5 ? 1 : 0;
-		}
-		*((float*)(response + 22)) = DataManager::GetFloat(DREF_FlapSetting, aircraft);
-		response[26] = aircraft;
-		*((float*)(response + 27)) = DataManager::GetFloat(DREF_SpeedBrakeSet, aircraft);
-
-		sock->SendTo(response, 31, &connection.addr);
+		ControlState state;
+		Snapshot::ReadControls(state, aircraft);
+		unsigned char response[35];
+		std::size_t len = Snapshot::FormatControls(state, aircraft, flags, (std::uint32_t)XPLMGetCycleNumber(), response);
+		sock->SendTo(response, len, &connection->addr);
 	}
 
 	void MessageHandlers::HandleGetD(const Message& msg)
 	{
 		const unsigned char* buffer = msg.GetBuffer();
 		unsigned char drefCount = buffer[5];
+		std::size_t end = 6;
 		if (drefCount == 0) // Use last request
 		{
 			Log::FormatLine(LOG_TRACE, "GETD",
 				"DATA Requested: Repeat last request from connection %i (%i data refs)",
-				connection.id, connection.getdCount);
-			if (connection.getdCount == 0) // No previous request to use
+				connection->id, (int)connection->lastQuery.drefs.size());
+			if (connection->lastQuery.drefs.empty()) // No previous request to use
 			{
 				Log::FormatLine(LOG_ERROR, "GETD", "ERROR: No previous requests from connection %i.",
-					connection.id);
+					connection->id);
 				return;
 			}
 		}
 		else // New request
 		{
 			Log::FormatLine(LOG_TRACE, "GETD", "DATA Requested: New Request for connection %i (%i data refs)",
-				connection.id, drefCount);
-			std::size_t ptr = 6;
-			for (int i = 0; i < drefCount; ++i)
+				connection->id, drefCount);
+			end += ReadQuery(buffer + 6, msg.GetSize() - 6, drefCount, connection->lastQuery);
+			if (snapshot != NULL)
 			{
-				unsigned char len = buffer[ptr];
-				connection.getdRequest[i] = std::string((char*)buffer + 1 + ptr, len);
-				ptr += 1 + len;
+				// Capture these datarefs from now on, so the next request for
+				// them can be answered without waiting for the flight loop.
+				for (std::size_t ptr = 6; ptr < end; ptr += 1 + buffer[ptr])
+				{
+					snapshot->Watch(std::string((char*)buffer + ptr + 1, buffer[ptr]));
+				}
 			}
-			connection.getdCount = drefCount;
-			connections[connectionKey] = connection;
 		}
 
-		unsigned char response[4096] = "RESP";
-		response[5] = drefCount;
-		std::size_t cur = 6;
+		// Newer clients follow the dataref names with a byte of ResponseFlags.
+		unsigned char flags = msg.GetSize() > end ? buffer[end] : 0;
+		SendQuery(connection->lastQuery, *connection, flags);
+	}
+
+	void MessageHandlers::HandlePrep(const Message& msg)
+	{
+		const unsigned char* buffer = msg.GetBuffer();
+		unsigned char id = buffer[5];
+		unsigned char drefCount = buffer[6];
+		if (id >= ConnectionRegistry::maxQueries)
+		{
+			Log::FormatLine(LOG_ERROR, "PREP", "ERROR: Query id %u is out of range (max %i).",
+				id, ConnectionRegistry::maxQueries - 1);
+			return;
+		}
+
+		Log::FormatLine(LOG_TRACE, "PREP", "Preparing query %u for connection %i (%i data refs)",
+			id, connection->id, drefCount);
+		ReadQuery(buffer + 7, msg.GetSize() - 7, drefCount, connection->queries[id]);
+	}
+
+	void MessageHandlers::HandleGetQ(const Message& msg)
+	{
+		const unsigned char* buffer = msg.GetBuffer();
+		unsigned char id = buffer[5];
+		if (id >= ConnectionRegistry::maxQueries || connection->queries[id].drefs.empty())
+		{
+			Log::FormatLine(LOG_ERROR, "GETQ", "ERROR: Query %u has not been prepared by connection %i.",
+				id, connection->id);
+			return;
+		}
+
+		Log::FormatLine(LOG_TRACE, "GETQ", "DATA Requested: Query %u for connection %i", id, connection->id);
+		unsigned char flags = msg.GetSize() > 6 ? buffer[6] : 0; // Optional, as in GETD
+		SendQuery(connection->queries[id], *connection, flags);
+	}
+
+	void MessageHandlers::HandleSubs(const Message& msg)
+	{
+		// Format: [5]=query id, [6]=mode, [7-10]=rate, [11]=dref count, then
+		// the dataref names as in PREP. A dref count of 0 subscribes to a
+		// query that has already been prepared.
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		if (size < 12)
+		{
+			Log::FormatLine(LOG_ERROR, "SUBS", "ERROR: Unexpected message length (%u)", (unsigned int)size);
+			return;
+		}
+		unsigned char id = buffer[5];
+		unsigned char mode = buffer[6];
+		float rate;
+		memcpy(&rate, buffer + 7, sizeof(float));
+		unsigned char drefCount = buffer[11];
+		if (id >= ConnectionRegistry::maxQueries)
+		{
+			Log::FormatLine(LOG_ERROR, "SUBS", "ERROR: Query id %u is out of range (max %i).",
+				id, ConnectionRegistry::maxQueries - 1);
+			return;
+		}
+
+		ConnectionRegistry::Subscription& sub = connection->subscriptions[id];
+		bool subscribed = sub.mode != ConnectionRegistry::SubscribeNone;
+		if (mode == ConnectionRegistry::SubscribeNone)
+		{
+			Log::FormatLine(LOG_TRACE, "SUBS", "Cancelling subscription %u for connection %i", id, connection->id);
+			if (subscribed)
+			{
+				sub = ConnectionRegistry::Subscription();
+				if (--connection->subscriptionCount == 0)
+				{
+					ConnectionRegistry::Handle handle = connections.GetHandle(*connection);
+					subscribers.erase(std::find(subscribers.begin(), subscribers.end(), handle));
+				}
+			}
+			return;
+		}
+		if ((mode != ConnectionRegistry::SubscribeFrames && mode != ConnectionRegistry::SubscribeHz) || !(rate > 0))
+		{
+			Log::FormatLine(LOG_ERROR, "SUBS", "ERROR: Invalid subscription rate (mode %u, rate %f).", mode, rate);
+			return;
+		}
+
+		if (drefCount > 0)
+		{
+			ReadQuery(buffer + 12, size - 12, drefCount, connection->queries[id]);
+		}
+		if (connection->queries[id].drefs.empty())
+		{
+			Log::FormatLine(LOG_ERROR, "SUBS", "ERROR: Query %u has not been prepared by connection %i.",
+				id, connection->id);
+			return;
+		}
+
+		// The first push goes out at the end of this frame.
+		sub.mode = (ConnectionRegistry::SubscriptionMode)mode;
+		if (sub.mode == ConnectionRegistry::SubscribeFrames)
+		{
+			sub.frameInterval = std::max(1, (int)(rate + 0.5F));
+			sub.framesLeft = 0;
+			Log::FormatLine(LOG_TRACE, "SUBS", "Subscribing connection %i to query %u every %i frames",
+				connection->id, id, sub.frameInterval);
+		}
+		else
+		{
+			sub.period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<float>(1.0F / rate));
+			sub.nextPush = std::chrono::steady_clock::now();
+			Log::FormatLine(LOG_TRACE, "SUBS", "Subscribing connection %i to query %u at %.1f Hz",
+				connection->id, id, rate);
+		}
+		if (!subscribed && connection->subscriptionCount++ == 0)
+		{
+			subscribers.push_back(connections.GetHandle(*connection));
+		}
+	}
+
+	void MessageHandlers::SendSubscriptions()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < subscribers.size();)
+		{
+			ConnectionRegistry::Connection* conn = connections.Get(subscribers[i]);
+			if (conn == NULL)
+			{
+				// The client went idle and was evicted along with its subscriptions.
+				subscribers[i] = subscribers.back();
+				subscribers.pop_back();
+				continue;
+			}
+
+			for (int id = 0; id < ConnectionRegistry::maxQueries; ++id)
+			{
+				ConnectionRegistry::Subscription& sub = conn->subscriptions[id];
+				switch (sub.mode)
+				{
+				case ConnectionRegistry::SubscribeFrames:
+					if (--sub.framesLeft > 0)
+					{
+						continue;
+					}
+					sub.framesLeft = sub.frameInterval;
+					break;
+				case ConnectionRegistry::SubscribeHz:
+					if (now < sub.nextPush)
+					{
+						continue;
+					}
+					// Keep to the requested rate on average, but don't try to
+					// catch up after a long frame.
+					sub.nextPush += sub.period;
+					if (sub.nextPush <= now)
+					{
+						sub.nextPush = now + sub.period;
+					}
+					break;
+				default:
+					continue;
+				}
+				RefreshQuery(conn->queries[id]);
+				SendResponse(conn->queries[id], *conn, id);
+			}
+			++i;
+		}
+	}
+
+	std::size_t MessageHandlers::ReadQuery(const unsigned char* buffer, std::size_t size, unsigned char drefCount,
+		ConnectionRegistry::Query& query)
+	{
+		query = ConnectionRegistry::Query();
+		std::size_t ptr = 0;
 		for (int i = 0; i < drefCount; ++i)
 		{
+			if (ptr >= size || ptr + 1 + buffer[ptr] > size)
+			{
+				Log::FormatLine(LOG_ERROR, "MSGH", "ERROR: Request ended after %i of %i data refs.", i, drefCount);
+				break;
+			}
+			unsigned char len = buffer[ptr];
+			query.drefs.push_back(DataManager::Resolve(std::string((char*)buffer + 1 + ptr, len)));
+			ptr += 1 + len;
+		}
+		return ptr;
+	}
+
+	void MessageHandlers::RefreshQuery(ConnectionRegistry::Query& query)
+	{
+		for (std::size_t i = 0; i < query.drefs.size(); ++i)
+		{
+			DataManager::Refresh(query.drefs[i]);
+		}
+	}
+
+	void MessageHandlers::SendQuery(ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn,
+		unsigned char flags)
+	{
+		RefreshQuery(query);
+		bool frame = (flags & FrameResponse) != 0;
+		if (flags & (FragmentedResponse | TypedResponse))
+		{
+			SendFragments(query, conn, (flags & TypedResponse) != 0, frame);
+		}
+		else if (flags & DeltaResponse)
+		{
+			SendDelta(query, conn, (flags & DeltaKeyframe) != 0);
+		}
+		else
+		{
+			SendResponse(query, conn, -1, frame);
+		}
+	}
+
+	void MessageHandlers::SendResponse(const ConnectionRegistry::Query& query,
+		ConnectionRegistry::Connection& conn, int subscription, bool frame)
+	{
+		unsigned char response[4096] = "RESP";
+		std::size_t cur = 5;
+		if (subscription >= 0)
+		{
+			memcpy(response, "SUBD", 4);
+			response[cur++] = (unsigned char)subscription;
+		}
+		response[cur++] = (unsigned char)query.drefs.size();
+		std::size_t rows = query.drefs.size();
+		for (std::size_t i = 0; i < rows; ++i)
+		{
+			// Never write past the end of the response, even for a request
+			// whose values add up to more than fits in one datagram. Keep a
+			// byte for the size of each remaining row, and room for the frame.
+			int space = std::max(0, (int)(sizeof(response) - cur - (rows - i) - (frame ? 4 : 0)) / (int)sizeof(float));
+			if (space < query.drefs[i].size)
+			{
+				Log::FormatLine(LOG_ERROR, "MSGH", "ERROR: Response too large. Truncating data ref %u.", (unsigned int)i);
+			}
 			float values[255];
-			int count = DataManager::Get(connection.getdRequest[i], values, 255);
+			int count = DataManager::Get(query.drefs[i], values, std::min(space, 255));
 			response[cur++] = count;
 			memcpy(response + cur, values, count * sizeof(float));
 			cur += count * sizeof(float);
 		}
+		if (frame)
+		{
+			std::uint32_t cycle = (std::uint32_t)XPLMGetCycleNumber();
+			memcpy(response + cur, &cycle, 4);
+			cur += 4;
+		}
 
-		sock->SendTo(response, cur, &connection.addr);
+		sock->SendTo(response, cur, &conn.addr);
+	}
+
+	void MessageHandlers::SendDelta(ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn, bool keyframe)
+	{
+		// Format: [5]=flags, [6]=row count, then one row per dataref. Every
+		// row starts with its size. A keyframe row continues with every value,
+		// as in RESP. Other rows continue with a bitmap of the values that
+		// changed since the last response, followed by only those values.
+		unsigned char response[4096] = "RESD";
+		keyframe = keyframe || query.sent.size() != query.drefs.size() || query.deltas >= DELTA_KEYFRAME_INTERVAL;
+		if (keyframe)
+		{
+			query.sent.resize(query.drefs.size());
+			query.deltas = 0;
+		}
+		else
+		{
+			++query.deltas;
+		}
+		response[5] = keyframe ? DeltaKeyframe : 0;
+		response[6] = (unsigned char)query.drefs.size();
+		int cur = 7;
+		int rows = (int)query.drefs.size();
+		for (int i = 0; i < rows; ++i)
+		{
+			// Leave room for the size of each remaining row and a full bitmap,
+			// so that a truncated row still fits.
+			int space = std::max(0, ((int)sizeof(response) - cur - (rows - i) - 32) / (int)sizeof(float));
+			if (space < query.drefs[i].size)
+			{
+				Log::FormatLine(LOG_ERROR, "MSGH", "ERROR: Response too large. Truncating data ref %u.", (unsigned int)i);
+			}
+			float values[255];
+			int count = DataManager::Get(query.drefs[i], values, std::min(space, 255));
+			std::vector<float>& sent = query.sent[i];
+			response[cur++] = count;
+			if (keyframe)
+			{
+				memcpy(response + cur, values, count * sizeof(float));
+				cur += count * sizeof(float);
+			}
+			else
+			{
+				// A row that changed size is sent in full, with every bit set.
+				unsigned char* bitmap = response + cur;
+				cur += (count + 7) / 8;
+				memset(bitmap, 0, (count + 7) / 8);
+				for (int j = 0; j < count; ++j)
+				{
+					// Compare bits so that NaN values only count as changed once.
+					if (j >= (int)sent.size() || memcmp(&values[j], &sent[j], sizeof(float)) != 0)
+					{
+						bitmap[j / 8] |= 1 << (j % 8);
+						memcpy(response + cur, &values[j], sizeof(float));
+						cur += sizeof(float);
+					}
+				}
+			}
+			sent.assign(values, values + count);
+		}
+
+		sock->SendTo(response, cur, &conn.addr);
+	}
+
+	void MessageHandlers::SendFragments(const ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn,
+		bool typed, bool frame)
+	{
+		// The response is built in full and then split across as many
+		// datagrams as it takes. The full response is: [0]=row count, then
+		// for each dataref a 16-bit row size followed by that many values.
+		// Typed responses also start each row with the WireType of its values.
+		static std::vector<unsigned char> payload;
+		static std::vector<float> values;
+		payload.assign(1, (unsigned char)query.drefs.size());
+		for (std::size_t i = 0; i < query.drefs.size(); ++i)
+		{
+			std::size_t cur = payload.size();
+			int count;
+			if (typed)
+			{
+				payload.resize(cur + 3);
+				WireType type;
+				count = DataManager::GetTyped(query.drefs[i], payload, type);
+				if (count > 0xFFFF)
+				{
+					std::size_t width = (payload.size() - cur - 3) / count;
+					count = 0xFFFF;
+					payload.resize(cur + 3 + count * width);
+				}
+				payload[cur++] = (unsigned char)type;
+			}
+			else
+			{
+				int size = std::min(query.drefs[i].size, 0xFFFF);
+				values.resize(std::max(size, 1));
+				count = DataManager::Get(query.drefs[i], &values[0], size);
+				payload.resize(cur + 2);
+				payload.insert(payload.end(), (unsigned char*)&values[0], (unsigned char*)&values[0] + count * sizeof(float));
+			}
+			payload[cur] = (unsigned char)(count & 0xFF);
+			payload[cur + 1] = (unsigned char)(count >> 8);
+		}
+		if (frame)
+		{
+			std::uint32_t cycle = (std::uint32_t)XPLMGetCycleNumber();
+			payload.insert(payload.end(), (unsigned char*)&cycle, (unsigned char*)&cycle + 4);
+		}
+
+		// Each datagram: [5]=response id, [6]=fragment index, [7]=fragment
+		// count, [8-11]=offset of the fragment, [12-15]=length of the full
+		// response, then the fragment itself.
+		const std::size_t header = 16;
+		const std::size_t fragmentSize = MAX_FRAGMENT_SIZE - header;
+		std::size_t fragments = (payload.size() + fragmentSize - 1) / fragmentSize;
+		if (fragments > 255)
+		{
+			Log::FormatLine(LOG_ERROR, "MSGH", "ERROR: Response of %u bytes is too large to send.",
+				(unsigned int)payload.size());
+			return;
+		}
+
+		unsigned char response[MAX_FRAGMENT_SIZE];
+		memcpy(response, typed ? "REST" : "RESF", 5);
+		// Answers from the snapshot go to the same client, so they share its ids.
+		response[5] = snapshot != NULL ? snapshot->NextResponseId(conn.addr) : ++conn.responseId;
+		response[7] = (unsigned char)fragments;
+		std::uint32_t total = (std::uint32_t)payload.size();
+		memcpy(response + 12, &total, 4);
+		for (std::size_t i = 0; i < fragments; ++i)
+		{
+			std::uint32_t offset = (std::uint32_t)(i * fragmentSize);
+			std::size_t len = std::min(fragmentSize, payload.size() - offset);
+			response[6] = (unsigned char)i;
+			memcpy(response + 8, &offset, 4);
+			memcpy(response + header, &payload[offset], len);
+			sock->SendTo(response, header + len, &conn.addr);
+		}
 	}
 
 	void MessageHandlers::HandleGetP(const Message& msg)
 	{
 		const unsigned char* buffer = msg.GetBuffer();
 		std::size_t size = msg.GetSize();
-		if (size != 6)
+		if (size != 6 && size != 7)
 		{
 			Log::FormatLine(LOG_ERROR, "GPOS", "Unexpected message length: %u", size);
 			return;
 		}
 		unsigned char aircraft = buffer[5];
+		// Newer clients set [6] to a combination of StateFlags, e.g. 1 to
+		// get lat/lon/h as doubles.
+		unsigned char flags = size == 7 ? buffer[6] : 0;
 		Log::FormatLine(LOG_TRACE, "GPOS", "Getting position information for aircraft %u", aircraft);
 
-		unsigned char response[34] = "POSI";
-		response[5] = (char)DataManager::GetInt(DREF_GearHandle, aircraft);
-		// TODO change lat/lon/h to double?
-		*((float*)(response + 6)) = (float)DataManager::GetDouble(DREF_Latitude, aircraft);
-		*((float*)(response + 10)) = (float)DataManager::GetDouble(DREF_Longitude, aircraft);
-		*((float*)(response + 14)) = (float)DataManager::GetDouble(DREF_Elevation, aircraft);
-		*((float*)(response + 18)) = DataManager::GetFloat(DREF_Pitch, aircraft);
-		*((float*)(response + 22)) = DataManager::GetFloat(DREF_Roll, aircraft);
-		*((float*)(response + 26)) = DataManager::GetFloat(DREF_HeadingTrue, aircraft);
-
-		float gear[10];
-		DataManager::GetFloatArray(DREF_GearDeploy, gear, 10, aircraft);
-		*((float*)(response + 30)) = gear[0];
-
-		sock->SendTo(response, 34, &connection.addr);
+		PositionState state;
+		Snapshot::ReadPosition(state, aircraft);
+		unsigned char response[50];
+		std::size_t len = Snapshot::FormatPosition(state, flags, (std::uint32_t)XPLMGetCycleNumber(), response);
+		sock->SendTo(response, len, &connection->addr);
 	}
 
 	void MessageHandlers::HandlePosi(const Message& msg)
 	{
 		// Update log
-		Log::FormatLine(LOG_TRACE, "POSI", "Message Received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "POSI", "Message Received (Conn %i)", connection->id);
 
 		const unsigned char* buffer = msg.GetBuffer();
 		const std::size_t size = msg.GetSize();
@@ -606,30 +1140,88 @@ namespace XPC
 		}
 
 		/* convert float to double */
-		DataManager::SetPosition(posd, aircraftNumber);
-		DataManager::SetOrientation(orient, aircraftNumber);
+		DataManager::SetPose(posd, orient, aircraftNumber);
 		if (gear >= 0)
 		{
 			DataManager::SetGear(gear, true, aircraftNumber);
 		}
-
 		if (aircraftNumber > 0)
 		{
 			// Enable AI for the aircraftNumber we are setting
-			float ai[20];
-			std::size_t result = DataManager::GetFloatArray(DREF_PauseAI, ai, 20);
-			if (result == 20) // Only set values if they were retrieved successfully.
+			OverrideAI(&aircraftNumber, 1);
+		}
+	}
+
+	void MessageHandlers::HandlePosb(const Message& msg)
+	{
+		// Format: [5]=count, then count records of
+		//   [0]=aircraft, [1-24]=lat/lon/h as doubles, [25-36]=pitch/roll/heading, [37-40]=gear
+		const std::size_t recordSize = 41;
+		const unsigned char* buffer = msg.GetBuffer();
+		const std::size_t size = msg.GetSize();
+		std::size_t count = size < 6 ? 0 : buffer[5];
+		if (count == 0 || size != 6 + count * recordSize)
+		{
+			Log::FormatLine(LOG_ERROR, "POSB", "ERROR: Unexpected size %u for %u aircraft",
+				(unsigned int)size, (unsigned int)count);
+			return;
+		}
+		Log::FormatLine(LOG_TRACE, "POSB", "Setting %u aircraft (Conn %i)", (unsigned int)count, connection->id);
+
+		char aircraft[256];
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const unsigned char* record = buffer + 6 + i * recordSize;
+			double pos[3];
+			float orient[3];
+			float gear;
+			aircraft[i] = (char)record[0];
+			if (aircraft[i] < 0 || aircraft[i] >= 20)
+			{
+				Log::FormatLine(LOG_ERROR, "POSB", "ERROR: Invalid aircraft %i", aircraft[i]);
+				aircraft[i] = 0;
+				continue;
+			}
+			memcpy(pos, record + 1, 24);
+			memcpy(orient, record + 25, 12);
+			memcpy(&gear, record + 37, 4);
+
+			DataManager::SetPose(pos, orient, aircraft[i]);
+			if (gear >= 0)
 			{
-				ai[aircraftNumber] = 1;
-				DataManager::Set(DREF_PauseAI, ai, 0, 20);
+				DataManager::SetGear(gear, true, aircraft[i]);
 			}
 		}
+		OverrideAI(aircraft, (int)count);
+	}
+
+	void MessageHandlers::OverrideAI(const char aircraft[], int count)
+	{
+		float ai[20];
+		std::size_t result = DataManager::GetFloatArray(DREF_PauseAI, ai, 20);
+		if (result != 20) // Only set values if they were retrieved successfully.
+		{
+			return;
+		}
+		bool changed = false;
+		for (int i = 0; i < count; ++i)
+		{
+			if (aircraft[i] > 0 && aircraft[i] < 20 && ai[(int)aircraft[i]] != 1)
+			{
+				ai[(int)aircraft[i]] = 1;
+				changed = true;
+			}
+		}
+		if (changed)
+		{
+			DataManager::Set(DREF_PauseAI, ai, 20);
+		}
 	}
 
 	void MessageHandlers::HandleSimu(const Message& msg)
 	{
 		// Update log
-		Log::FormatLine(LOG_TRACE, "SIMU", "Message Received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "SIMU", "Message Received (Conn %i)", connection->id);
 
 		unsigned char v = msg.GetBuffer()[5];
 		if (v < 0 || (v > 2 && v < 100) || (v > 119 && v < 200) || v > 219)
@@ -691,10 +1283,326 @@ namespace XPC
 
 	}
 
+	void MessageHandlers::HandleStep(const Message& msg)
+	{
+		// Format: [5-8]=frame count, then optionally [9]=id of a prepared query
+		// to send when the step is done and [10]=ResponseFlags for it.
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		if (size < 9)
+		{
+			Log::FormatLine(LOG_ERROR, "STEP", "ERROR: Unexpected message length (%u)", (unsigned int)size);
+			SendStepDone(*connection, StepInvalid);
+			return;
+		}
+		std::uint32_t frames;
+		memcpy(&frames, buffer + 5, 4);
+		int query = size > 9 ? buffer[9] : -1;
+		if (frames == 0 || query >= ConnectionRegistry::maxQueries
+			|| (query >= 0 && connection->queries[query].drefs.empty()))
+		{
+			Log::FormatLine(LOG_ERROR, "STEP", "ERROR: Invalid step of %u frames (query %i)", frames, query);
+			SendStepDone(*connection, StepInvalid);
+			return;
+		}
+		if (!barrier.agents.empty())
+		{
+			Log::WriteLine(LOG_ERROR, "STEP", "ERROR: The barrier controls the sim while agents are registered");
+			SendStepDone(*connection, StepBusy);
+			return;
+		}
+		if (step.remaining > 0)
+		{
+			Log::FormatLine(LOG_ERROR, "STEP", "ERROR: Step already in progress, %u frames left", step.remaining);
+			SendStepDone(*connection, StepBusy);
+			return;
+		}
+
+		Log::FormatLine(LOG_TRACE, "STEP", "Stepping %u frames for connection %i", frames, connection->id);
+		step.client = connections.GetHandle(*connection);
+		step.remaining = frames;
+		step.query = query;
+		step.flags = size > 10 ? buffer[10] : 0;
+		step.barrier = false;
+		SetPaused(false);
+	}
+
+	void MessageHandlers::AdvanceStep()
+	{
+		if (step.remaining == 0)
+		{
+			return;
+		}
+		++steppedFrames;
+		if (--step.remaining > 0)
+		{
+			return;
+		}
+
+		SetPaused(true);
+		if (step.barrier)
+		{
+			for (std::size_t i = 0; i < barrier.agents.size(); ++i)
+			{
+				ConnectionRegistry::Connection* conn = connections.Get(barrier.agents[i].client);
+				if (conn != NULL)
+				{
+					SendBarrierStatus(*conn, barrier.timedOut ? BarrierTimedOut : BarrierAdvanced);
+				}
+			}
+			return;
+		}
+		ConnectionRegistry::Connection* conn = connections.Get(step.client);
+		if (conn == NULL)
+		{
+			Log::WriteLine(LOG_WARN, "STEP", "Step finished after its client was evicted");
+			return;
+		}
+		SendStepDone(*conn, StepDone);
+		if (step.query >= 0)
+		{
+			SendQuery(conn->queries[step.query], *conn, step.flags);
+		}
+	}
+
+	void MessageHandlers::SendStepDone(ConnectionRegistry::Connection& conn, unsigned char status)
+	{
+		// Format: [5]=status, [6-9]=frames stepped since the plugin started
+		unsigned char response[10] = "STPD";
+		response[5] = status;
+		memcpy(response + 6, &steppedFrames, 4);
+		sock->SendTo(response, 10, &conn.addr);
+	}
+
+	void MessageHandlers::SetPaused(bool paused)
+	{
+		int value[20];
+		for (int i = 0; i < 20; ++i)
+		{
+			value[i] = paused ? 1 : 0;
+		}
+		DataManager::Set(DREF_Pause, value, 20);
+	}
+
+	void MessageHandlers::HandleBarr(const Message& msg)
+	{
+		// Format: [5]=BarrierCommand, then
+		//   join:   [6-9]=timeout in seconds (float), [10-13]=frames to run per release
+		//   submit: [6-9]=the frame the agent has acted for
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		if (size < 6)
+		{
+			Log::FormatLine(LOG_ERROR, "BARR", "ERROR: Unexpected message length (%u)", (unsigned int)size);
+			SendBarrierStatus(*connection, BarrierInvalid);
+			return;
+		}
+
+		ConnectionRegistry::Handle client = connections.GetHandle(*connection);
+		Agent* agent = FindAgent(client);
+		switch (buffer[5])
+		{
+		case BarrierJoin:
+		{
+			float timeout = 0;
+			std::uint32_t frames = 0;
+			if (size >= 14)
+			{
+				memcpy(&timeout, buffer + 6, 4);
+				memcpy(&frames, buffer + 10, 4);
+			}
+			if (!(timeout > 0) || frames == 0)
+			{
+				Log::FormatLine(LOG_ERROR, "BARR", "ERROR: Invalid barrier settings (%f s, %u frames)", timeout, frames);
+				SendBarrierStatus(*connection, BarrierInvalid);
+				return;
+			}
+			// The settings are shared by every agent, so the last one to join wins.
+			barrier.timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<float>(timeout));
+			barrier.frames = frames;
+			if (agent == NULL)
+			{
+				if (barrier.agents.empty() && step.remaining == 0)
+				{
+					// Nothing advances the sim from now on except the barrier.
+					SetPaused(true);
+				}
+				Agent added = { client, std::vector<Message>(), false };
+				barrier.agents.push_back(added);
+				Log::FormatLine(LOG_INFO, "BARR", "Connection %u joined the barrier (%u agents)",
+					connection->id, (unsigned int)barrier.agents.size());
+			}
+			SendBarrierStatus(*connection, BarrierJoined);
+			break;
+		}
+		case BarrierLeave:
+			if (agent != NULL)
+			{
+				DropAgent(agent - &barrier.agents[0]);
+				Log::FormatLine(LOG_INFO, "BARR", "Connection %u left the barrier (%u agents)",
+					connection->id, (unsigned int)barrier.agents.size());
+			}
+			SendBarrierStatus(*connection, BarrierLeft);
+			// The agents still waiting may have been waiting for this one.
+			AdvanceBarrier();
+			break;
+		case BarrierSubmit:
+		{
+			std::uint32_t frame;
+			if (agent == NULL || size < 10)
+			{
+				Log::FormatLine(LOG_ERROR, "BARR", "ERROR: Invalid submit from connection %u", connection->id);
+				SendBarrierStatus(*connection, BarrierInvalid);
+				return;
+			}
+			memcpy(&frame, buffer + 6, 4);
+			if (frame != barrier.frame)
+			{
+				// Too late. Whatever the agent sent was meant for a state that is gone.
+				Log::FormatLine(LOG_WARN, "BARR", "Connection %u submitted frame %u during frame %u",
+					connection->id, frame, barrier.frame);
+				for (std::size_t i = 0; i < agent->held.size(); ++i)
+				{
+					agent->held[i].Release();
+				}
+				barrier.held -= (int)agent->held.size();
+				agent->held.clear();
+				SendBarrierStatus(*connection, BarrierStale);
+				return;
+			}
+			agent->submitted = true;
+			if (!barrier.armed)
+			{
+				barrier.armed = true;
+				barrier.deadline = std::chrono::steady_clock::now() + barrier.timeout;
+			}
+			AdvanceBarrier();
+			break;
+		}
+		default:
+			Log::FormatLine(LOG_ERROR, "BARR", "ERROR: Unknown command %u", buffer[5]);
+			SendBarrierStatus(*connection, BarrierInvalid);
+			break;
+		}
+	}
+
+	void MessageHandlers::AdvanceBarrier()
+	{
+		// Forget agents whose connections were evicted, so they can't hold up
+		// the others forever.
+		for (std::size_t i = barrier.agents.size(); i-- > 0;)
+		{
+			if (connections.Get(barrier.agents[i].client) == NULL)
+			{
+				Log::WriteLine(LOG_WARN, "BARR", "Dropping agent whose connection was evicted");
+				DropAgent(i);
+			}
+		}
+		if (!barrier.armed)
+		{
+			return;
+		}
+
+		bool all = true;
+		for (std::size_t i = 0; i < barrier.agents.size(); ++i)
+		{
+			all = all && barrier.agents[i].submitted;
+		}
+		if (all)
+		{
+			ReleaseBarrier(false);
+		}
+		else if (std::chrono::steady_clock::now() >= barrier.deadline)
+		{
+			Log::FormatLine(LOG_WARN, "BARR", "Timed out waiting for agents in frame %u", barrier.frame);
+			ReleaseBarrier(true);
+		}
+	}
+
+	MessageHandlers::Agent* MessageHandlers::FindAgent(ConnectionRegistry::Handle client)
+	{
+		for (std::size_t i = 0; i < barrier.agents.size(); ++i)
+		{
+			if (barrier.agents[i].client == client)
+			{
+				return &barrier.agents[i];
+			}
+		}
+		return NULL;
+	}
+
+	void MessageHandlers::DropAgent(std::size_t index)
+	{
+		Agent& agent = barrier.agents[index];
+		for (std::size_t i = 0; i < agent.held.size(); ++i)
+		{
+			agent.held[i].Release();
+		}
+		barrier.held -= (int)agent.held.size();
+		barrier.agents.erase(barrier.agents.begin() + index);
+		if (barrier.agents.empty())
+		{
+			barrier.armed = false;
+		}
+	}
+
+	void MessageHandlers::ReleaseBarrier(bool timedOut)
+	{
+		if (step.remaining > 0)
+		{
+			// Still running the last frame. AdvanceBarrier tries again once it is done.
+			return;
+		}
+
+		// Apply every agent's actions in the same pass, in the order the agents
+		// joined. Agents that did not submit keep their writes for the next frame.
+		barrier.releasing = true;
+		for (std::size_t i = 0; i < barrier.agents.size(); ++i)
+		{
+			Agent& agent = barrier.agents[i];
+			if (!agent.submitted)
+			{
+				continue;
+			}
+			for (std::size_t j = 0; j < agent.held.size(); ++j)
+			{
+				HandleMessage(agent.held[j]);
+				agent.held[j].Release();
+			}
+			barrier.held -= (int)agent.held.size();
+			agent.held.clear();
+			agent.submitted = false;
+		}
+		barrier.releasing = false;
+
+		Log::FormatLine(LOG_TRACE, "BARR", "Releasing frame %u%s", barrier.frame, timedOut ? " after timeout" : "");
+		++barrier.frame;
+		barrier.armed = false;
+		barrier.timedOut = timedOut;
+		step.client = ConnectionRegistry::invalidHandle;
+		step.remaining = barrier.frames;
+		step.query = -1;
+		step.flags = 0;
+		step.barrier = true;
+		SetPaused(false);
+	}
+
+	void MessageHandlers::SendBarrierStatus(ConnectionRegistry::Connection& conn, unsigned char status)
+	{
+		// Format: [5]=BarrierStatus, [6-9]=the frame agents should act for next,
+		// [10-13]=frames stepped since the plugin started
+		unsigned char response[14] = "BARD";
+		response[5] = status;
+		memcpy(response + 6, &barrier.frame, 4);
+		memcpy(response + 10, &steppedFrames, 4);
+		sock->SendTo(response, 14, &conn.addr);
+	}
+
 	void MessageHandlers::HandleText(const Message& msg)
 	{
 		// Update Log
-		Log::FormatLine(LOG_TRACE, "TEXT", "Message Received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "TEXT", "Message Received (Conn %i)", connection->id);
 
 		std::size_t len = msg.GetSize();
 		const unsigned char*  buffer = msg.GetBuffer();
@@ -724,7 +1632,7 @@ namespace XPC
 	void MessageHandlers::HandleView(const Message& msg)
 	{
 		// Update Log
-		Log::FormatLine(LOG_TRACE, "VIEW", "Message Received(Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "VIEW", "Message Received(Conn %i)", connection->id);
 
 		int enable_camera_location = 0;
 		
@@ -829,7 +1737,7 @@ namespace XPC
 
 	void MessageHandlers::HandleComm(const Message& msg)
 	{
-		Log::FormatLine(LOG_TRACE, "COMM", "Request to execute COMM command received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "COMM", "Request to execute COMM command received (Conn %i)", connection->id);
 		const unsigned char* buffer = msg.GetBuffer();
 		std::size_t size = msg.GetSize();
 		std::size_t pos = 5;
@@ -855,7 +1763,7 @@ namespace XPC
 	void MessageHandlers::HandleWypt(const Message& msg)
 	{
 		// Update Log
-		Log::FormatLine(LOG_TRACE, "WYPT", "Message Received (Conn %i)", connection.id);
+		Log::FormatLine(LOG_TRACE, "WYPT", "Message Received (Conn %i)", connection->id);
 
 		// Parse data
 		const unsigned char* buffer = msg.GetBuffer();
@@ -2,10 +2,11 @@
 // National Aeronautics and Space Administration. All Rights Reserved.
 #ifndef XPCPLUGIN_MESSAGEHANDLERS_H_
 #define XPCPLUGIN_MESSAGEHANDLERS_H_
+#include "ConnectionRegistry.h"
 #include "Message.h"
 
 #include <string>
-#include <map>
+#include <vector>
 
 #include "XPLMCamera.h"
 
@@ -14,8 +15,9 @@
 
 namespace XPC
 {
-	/// A function that handles a message.
-	typedef void(*MessageHandler)(const Message&);
+	class Snapshot;
+	class WriteStage;
+	struct StagedWrite;
 
 	/// Handles incoming messages and manages connections.
 	///
@@ -38,23 +40,89 @@ namespace XPC
 		/// \param msg The message to be processed.
 		static void HandleMessage(Message& msg);
 
+		/// Checks whether a message changes the state of the simulation, e.g. CTRL
+		/// or DREF. Writes are scheduled ahead of other clients' queries, and can
+		/// be handled before the flight model runs so they take effect in the
+		/// same frame.
+		static bool IsWrite(const Message& msg);
+
+		/// Applies every write the network thread has decoded into a stage,
+		/// in the order they arrived. Writes from barrier agents are held
+		/// for the barrier, as HandleMessage would hold them.
+		///
+		/// \param stage The stage to apply writes from.
+		/// \param taken Called with each message taken from the stage, and
+		///              whether its writes were held for the barrier instead
+		///              of applied.
+		/// \returns     The number of messages applied.
+		static int ApplyStagedWrites(WriteStage& stage, void (*taken)(const Message& msg, bool held));
+
+		/// Records a request that the network thread has already answered
+		/// from the snapshot against its sender's connection, as handling it
+		/// would have: the connection is kept alive, and a GETD request
+		/// becomes the request that an empty GETD repeats.
+		///
+		/// \param msg The request.
+		static void RecordAnswered(const Message& msg);
+
 		/// Sets the socket that message handlers use to send responses.
 		static void SetSocket(ISocket* socket);
+
+		/// Sets the socket used to send the discovery beacon. The beacon is sent
+		/// from a timer thread, so this socket must be safe to use concurrently
+		/// with the response socket.
+		static void SetBeaconSocket(ISocket* socket);
 		
 		static void SendBeacon(const std::string& pluginVersion, unsigned short pluginReceivePort, int xplaneVersion);
 
+		/// Pushes every subscribed query that is due to its client. Called once
+		/// per frame from the flight loop.
+		static void SendSubscriptions();
+
+		/// Counts a flight model step towards the STEP command in progress, if
+		/// any. When the last frame has run, pauses the simulation again and
+		/// notifies the client. Called once per frame, after the flight model.
+		static void AdvanceStep();
+
+		/// Releases the multi-agent barrier if it has waited for its timeout
+		/// since the first agent submitted. Called once per frame.
+		static void AdvanceBarrier();
+
+		/// Sets the snapshot that learns which datarefs clients ask for, so
+		/// that later requests can be answered off the flight loop.
+		///
+		/// \param snapshot The snapshot, or NULL to stop watching requests.
+		static void SetSnapshot(Snapshot* snapshot);
+
+		/// Flags in GETD and GETQ requests.
+		enum ResponseFlags
+		{
+			DeltaResponse = 1, // Reply with RESD instead of RESP
+			DeltaKeyframe = 2, // Send every value in the RESD response
+			FragmentedResponse = 4, // Reply with RESF instead of RESP
+			TypedResponse = 8, // Reply with REST, which keeps each dataref's type
+			FrameResponse = 16 // Follow the values with the frame they were read in. Not for RESD.
+		};
+
 	private:
 		// One handler per message type. Message types are descripbed on the
 		// wiki at https://github.com/nasa/XPlaneConnect/wiki/Network-Information
+		static void HandleBarr(const Message& msg);
 		static void HandleConn(const Message& msg);
 		static void HandleCtrl(const Message& msg);
 		static void HandleData(const Message& msg);
 		static void HandleDref(const Message& msg);
+		static void HandleDrft(const Message& msg);
 		static void HandleGetC(const Message& msg);
 		static void HandleGetD(const Message& msg);
+		static void HandleGetQ(const Message& msg);
 		static void HandleGetP(const Message& msg);
 		static void HandlePosi(const Message& msg);
+		static void HandlePosb(const Message& msg);
+		static void HandlePrep(const Message& msg);
 		static void HandleSimu(const Message& msg);
+		static void HandleStep(const Message& msg);
+		static void HandleSubs(const Message& msg);
 		static void HandleText(const Message& msg);
 		static void HandleWypt(const Message& msg);
 		static void HandleView(const Message& msg);
@@ -62,6 +130,69 @@ namespace XPC
 
 		static void HandleXPlaneData(const Message& msg);
 		static void HandleUnknown(const Message& msg);
+
+		// Sets the current connection to the sender of a message.
+		static void SetConnection(const Message& msg);
+		// Holds a write from a barrier agent until every agent has acted.
+		// Returns false if the write should be applied now.
+		static bool HoldForBarrier(const Message& msg);
+		static void ApplyStaged(const StagedWrite& write);
+
+		// Resolves the length-prefixed dataref names in a GETD or PREP request.
+		// Returns the number of bytes read.
+		static std::size_t ReadQuery(const unsigned char* buffer, std::size_t size, unsigned char drefCount,
+			ConnectionRegistry::Query& query);
+		// Looks up the types and sizes of a query's datarefs again if an
+		// aircraft has been loaded since they were resolved.
+		static void RefreshQuery(ConnectionRegistry::Query& query);
+		// Sends a response to a GETD or GETQ request in the format selected
+		// by flags, a combination of ResponseFlags.
+		static void SendQuery(ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn,
+			unsigned char flags);
+		// Reads every dataref in a query and sends the values to a client. The
+		// values are sent as a RESP message, or as a SUBD message tagged with
+		// the query id when pushed for a subscription. If frame is set, the
+		// values are followed by the current frame number.
+		static void SendResponse(const ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn,
+			int subscription = -1, bool frame = false);
+		// Sends only the values in a query that changed since the last delta
+		// response as a RESD message. Every few responses, or when keyframe
+		// is set, all values are sent instead so the client can recover from
+		// lost responses.
+		static void SendDelta(ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn, bool keyframe);
+		// Sends every value in a query, split across as many RESF messages as
+		// it takes. Unlike RESP, rows are not limited to 255 values. Typed
+		// responses are sent as REST messages, with each row in the native
+		// type of its dataref.
+		static void SendFragments(const ConnectionRegistry::Query& query, ConnectionRegistry::Connection& conn,
+			bool typed, bool frame);
+
+		// Commands in BARR messages.
+		enum BarrierCommand
+		{
+			BarrierLeave = 0,
+			BarrierJoin = 1,
+			BarrierSubmit = 2 // The agent has sent all of its actions for a frame
+		};
+
+		// The status of the barrier, in BARD messages.
+		enum BarrierStatus
+		{
+			BarrierAdvanced = 0, // Every agent acted and the sim has advanced
+			BarrierTimedOut = 1, // The sim advanced without the agents that did not submit in time
+			BarrierJoined = 2,
+			BarrierLeft = 3,
+			BarrierStale = 4, // Actions were submitted for a frame that has already run
+			BarrierInvalid = 5 // The request was malformed
+		};
+
+		// The status of a STEP command, in STPD messages.
+		enum StepStatus
+		{
+			StepDone = 0,
+			StepBusy = 1,   // Another step was in progress
+			StepInvalid = 2 // The request was malformed
+		};
 		
 		static int CamFunc( XPLMCameraPosition_t * outCameraPosition, int inIsLosingControl, void *inRefcon);
 		
@@ -71,19 +202,64 @@ namespace XPC
 			float zoom;
 		};
 
-		typedef struct
+		// A STEP command in progress.
+		struct Step
 		{
-			unsigned char id;
-			sockaddr addr;
-			unsigned char getdCount;
-			std::string getdRequest[255];
-		} ConnectionInfo;
-
-		static std::map<std::string, ConnectionInfo> connections;
-		static std::map<std::string, MessageHandler> handlers;
-		static std::string connectionKey; // The current connection ip:port string
-		static ConnectionInfo connection; // The current connection record
+			ConnectionRegistry::Handle client;
+			std::uint32_t remaining; // Frames left to run, 0 if no step is in progress
+			int query; // Prepared query to send when done, or -1
+			unsigned char flags; // ResponseFlags for the query
+			bool barrier; // Started by the barrier, which notifies its agents when done
+		};
+
+		// A client taking part in the barrier.
+		struct Agent
+		{
+			ConnectionRegistry::Handle client;
+			std::vector<Message> held; // Writes waiting for the barrier, in arrival order
+			bool submitted; // The agent has finished acting for the current frame
+		};
+
+		// Holds the writes from a group of agents until all of them have acted,
+		// then applies them together and advances the sim.
+		struct Barrier
+		{
+			std::vector<Agent> agents;
+			std::uint32_t frame; // The frame the agents are acting for
+			std::uint32_t frames; // Flight model frames to run each time the barrier is released
+			std::chrono::steady_clock::duration timeout;
+			std::chrono::steady_clock::time_point deadline; // When to release without every agent
+			bool armed; // At least one agent has submitted, so the deadline applies
+			bool timedOut; // The last release was forced by the timeout
+			bool releasing; // Held writes are being applied, so must not be held again
+			int held; // Writes held by all agents together
+
+			Barrier() : frame(0), frames(1), timeout(std::chrono::seconds(1)), armed(false), timedOut(false),
+				releasing(false), held(0) {}
+		};
+		static Agent* FindAgent(ConnectionRegistry::Handle client);
+		static void DropAgent(std::size_t index);
+		// Applies the held writes of every agent that submitted, then runs the
+		// sim for the barrier's frame count. Does nothing while a STEP runs.
+		static void ReleaseBarrier(bool timedOut);
+		// Sends a BARD message with the barrier's status.
+		static void SendBarrierStatus(ConnectionRegistry::Connection& conn, unsigned char status);
+		// Sends a STPD message with the status of a STEP command.
+		static void SendStepDone(ConnectionRegistry::Connection& conn, unsigned char status);
+		static void SetPaused(bool paused);
+		// Hands the specified multiplayer aircraft over to the plugin, so
+		// X-Plane's AI stops moving them. Aircraft 0 is ignored.
+		static void OverrideAI(const char aircraft[], int count);
+
+		static ConnectionRegistry connections;
+		static Step step;
+		static Barrier barrier;
+		static std::uint32_t steppedFrames; // Frames run by STEP commands since the plugin started
+		static ConnectionRegistry::Connection* connection; // The current connection record
+		static std::vector<ConnectionRegistry::Handle> subscribers; // Connections with subscriptions
 		static ISocket* sock; // Outgoing network socket
+		static ISocket* beaconSock; // Socket used by SendBeacon
+		static Snapshot* snapshot; // Learns the datarefs requested with GETD, or NULL
 	};
 }
 #endif
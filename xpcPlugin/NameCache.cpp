@@ -0,0 +1,199 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "NameCache.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace XPC
+{
+	const std::uint32_t NameCache::none;
+
+	NameCache::NameCache(std::size_t capacity, std::chrono::seconds negativeRetry)
+		: capacity(capacity), negativeRetry(negativeRetry), newest(none), oldest(none)
+	{
+		// Keep the table at most half full so probe sequences stay short.
+		std::size_t size = 16;
+		while (size < capacity * 2)
+		{
+			size *= 2;
+		}
+		table.assign(size, none);
+		entries.reserve(capacity);
+		counters.hits = 0;
+		counters.negativeHits = 0;
+		counters.misses = 0;
+		counters.evictions = 0;
+	}
+
+	std::uint64_t NameCache::Hash(const std::string& name)
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		for (std::size_t i = 0; i < name.size(); ++i)
+		{
+			hash = (hash ^ (unsigned char)name[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::size_t NameCache::Probe(const std::string& name, std::uint64_t hash) const
+	{
+		std::size_t mask = table.size() - 1;
+		std::size_t i = hash & mask;
+		while (table[i] != none)
+		{
+			const Entry& entry = entries[table[i]];
+			if (entry.hash == hash && entry.name == name)
+			{
+				break;
+			}
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+	void NameCache::Reset(ResolvedDref& dref, XPLMDataRef xdref)
+	{
+		dref.xdref = xdref;
+		dref.type = xplmType_Unknown;
+		dref.size = xdref ? -1 : 0;
+		dref.types = xplmType_Unknown;
+		dref.writable = false;
+		dref.generation = 0;
+	}
+
+	ResolvedDref& NameCache::Find(const std::string& name)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::uint64_t hash = Hash(name);
+		std::size_t pos = Probe(name, hash);
+		if (table[pos] != none)
+		{
+			std::uint32_t index = table[pos];
+			Entry& entry = entries[index];
+			Touch(index);
+			if (entry.dref.xdref != NULL)
+			{
+				++counters.hits;
+				return entry.dref;
+			}
+			if (now - entry.checked < negativeRetry)
+			{
+				++counters.negativeHits;
+				return entry.dref;
+			}
+			// Another plugin may have registered it since.
+			++counters.misses;
+			Reset(entry.dref, XPLMFindDataRef(name.c_str()));
+			entry.checked = now;
+			return entry.dref;
+		}
+
+		++counters.misses;
+		XPLMDataRef xdref = XPLMFindDataRef(name.c_str());
+
+		std::uint32_t index;
+		if (entries.size() < capacity)
+		{
+			index = (std::uint32_t)entries.size();
+			entries.push_back(Entry());
+		}
+		else
+		{
+			index = oldest;
+			Log::FormatLine(LOG_DEBUG, "NAME", "Evicting %s", entries[index].name.c_str());
+			Erase(Probe(entries[index].name, entries[index].hash));
+			Unlink(index);
+			++counters.evictions;
+			// Erasing may have shifted entries into the position found above.
+			pos = Probe(name, hash);
+		}
+
+		Entry& entry = entries[index];
+		entry.name = name;
+		entry.hash = hash;
+		Reset(entry.dref, xdref);
+		entry.checked = now;
+		entry.newer = none;
+		entry.older = none;
+		table[pos] = index;
+		Touch(index);
+		return entry.dref;
+	}
+
+	void NameCache::Clear()
+	{
+		entries.clear();
+		std::fill(table.begin(), table.end(), none);
+		newest = none;
+		oldest = none;
+	}
+
+	const NameCache::Counters& NameCache::GetCounters() const
+	{
+		return counters;
+	}
+
+	void NameCache::Erase(std::size_t pos)
+	{
+		std::size_t mask = table.size() - 1;
+		table[pos] = none;
+		for (std::size_t i = pos, j = (pos + 1) & mask; table[j] != none; j = (j + 1) & mask)
+		{
+			// An entry can stay where it is if its home position is cyclically
+			// after the hole. Otherwise, it moves into the hole.
+			std::size_t home = entries[table[j]].hash & mask;
+			bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+			if (!stays)
+			{
+				table[i] = table[j];
+				table[j] = none;
+				i = j;
+			}
+		}
+	}
+
+	void NameCache::Touch(std::uint32_t index)
+	{
+		if (newest == index)
+		{
+			return;
+		}
+		Unlink(index);
+		Entry& entry = entries[index];
+		entry.older = newest;
+		if (newest != none)
+		{
+			entries[newest].newer = index;
+		}
+		newest = index;
+		if (oldest == none)
+		{
+			oldest = index;
+		}
+	}
+
+	void NameCache::Unlink(std::uint32_t index)
+	{
+		Entry& entry = entries[index];
+		if (entry.newer != none)
+		{
+			entries[entry.newer].older = entry.older;
+		}
+		else if (newest == index)
+		{
+			newest = entry.older;
+		}
+		if (entry.older != none)
+		{
+			entries[entry.older].newer = entry.newer;
+		}
+		else if (oldest == index)
+		{
+			oldest = entry.newer;
+		}
+		entry.newer = none;
+		entry.older = none;
+	}
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_NAMECACHE_H_
+#define XPCPLUGIN_NAMECACHE_H_
+
+#include "DataManager.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace XPC
+{
+	/// Remembers the X-Plane handles and metadata of datarefs looked up by
+	/// name.
+	///
+	/// \details Names are interned in an open-addressing hash table keyed on
+	///          a 64-bit hash of the name, with linear probing. Names that
+	///          X-Plane does not know are cached as well, so a client asking
+	///          for a misspelled dataref over and over costs one SDK lookup
+	///          per retry interval instead of one per request. The retry
+	///          interval lets datarefs registered later by other plugins be
+	///          found eventually.
+	///
+	///          The cache holds a fixed number of names. Once it is full, the
+	///          least recently used name is forgotten to make room, so
+	///          clients that scan thousands of distinct names can't grow it
+	///          without bound.
+	class NameCache
+	{
+	public:
+		/// Counts how lookups were answered.
+		struct Counters
+		{
+			/// Lookups answered from the cache with a valid handle.
+			int hits;
+			/// Lookups answered from the cache for a name X-Plane doesn't know.
+			int negativeHits;
+			/// Lookups that called XPLMFindDataRef.
+			int misses;
+			/// Names forgotten to make room for new ones.
+			int evictions;
+		};
+
+		/// Initializes an empty cache.
+		///
+		/// \param capacity      The maximum number of names to remember.
+		/// \param negativeRetry The time after which a name X-Plane didn't know
+		///                      is looked up again.
+		NameCache(std::size_t capacity, std::chrono::seconds negativeRetry);
+
+		/// Gets the cached record of a dataref, looking up its handle in
+		/// X-Plane only if it is not cached.
+		///
+		/// \param name The name of the dataref.
+		/// \returns    The record. The xdref member is NULL if X-Plane does
+		///             not know the name. Otherwise, the other members are
+		///             left for the caller to fill in; size is -1 until they
+		///             are. The
+		///             record remains valid until the next call to Find or
+		///             Clear.
+		ResolvedDref& Find(const std::string& name);
+
+		/// Forgets every name, e.g. after an aircraft is loaded and the
+		/// datarefs of its plugins may have changed.
+		void Clear();
+
+		/// Gets the lookup counters. The counters never move, so they can be
+		/// published in place.
+		const Counters& GetCounters() const;
+
+	private:
+		static const std::uint32_t none = 0xFFFFFFFF;
+
+		struct Entry
+		{
+			std::string name;
+			std::uint64_t hash;
+			ResolvedDref dref; // dref.xdref is NULL if X-Plane didn't know the name
+			std::chrono::steady_clock::time_point checked; // When dref.xdref was looked up
+			std::uint32_t newer; // Neighbors in least recently used order
+			std::uint32_t older;
+		};
+
+		static std::uint64_t Hash(const std::string& name);
+		static void Reset(ResolvedDref& dref, XPLMDataRef xdref);
+
+		/// Finds the table position holding name, or the empty position where
+		/// it would be inserted.
+		std::size_t Probe(const std::string& name, std::uint64_t hash) const;
+		/// Removes the entry at a table position, shifting later entries in
+		/// the same probe sequence back so no tombstones are needed.
+		void Erase(std::size_t pos);
+		/// Moves an entry to the most recently used end of the list.
+		void Touch(std::uint32_t entry);
+		void Unlink(std::uint32_t entry);
+
+		std::size_t capacity;
+		std::chrono::seconds negativeRetry;
+		std::vector<Entry> entries;
+		std::vector<std::uint32_t> table; // Entry indices, or none
+		std::uint32_t newest;
+		std::uint32_t oldest;
+		Counters counters;
+	};
+}
+#endif
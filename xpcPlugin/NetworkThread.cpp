@@ -0,0 +1,282 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "NetworkThread.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+namespace XPC
+{
+	const int NetworkThread::sendWaitMs;
+
+	NetworkThread::NetworkThread(UDPSocket* udp, ISocket* ws, ReceivePool& pool, Snapshot* snapshot,
+		WriteStage* stage)
+		: udp(udp), ws(ws), pool(pool), snapshot(snapshot), stage(stage), droppedMessages(0), droppedResponses(0),
+		  snapshotAnswers(0), running(true)
+	{
+		std::fill(passed, passed + sourceSlots, 0);
+		std::fill(connected, connected + sourceSlots, false);
+		std::fill(lastStaged, lastStaged + sourceSlots, false);
+		std::fill(finishing, finishing + sourceSlots, 0);
+		for (std::size_t i = 0; i < sourceSlots; ++i)
+		{
+			finished[i].store(0, std::memory_order_relaxed);
+		}
+		dirtySlots.reserve(sourceSlots);
+		// Blocking reads time out after a fraction of a millisecond, which
+		// bounds how long a queued response waits before it is sent.
+		udp->SetNonBlocking(false);
+		udp->SetDeferred(true);
+		thread = std::thread(&NetworkThread::Run, this);
+		Log::WriteLine(LOG_INFO, "NETW", "Network thread started");
+	}
+
+	NetworkThread::~NetworkThread()
+	{
+		running = false;
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+		Log::WriteLine(LOG_INFO, "NETW", "Network thread stopped");
+	}
+
+	Message* NetworkThread::Peek(bool& answered)
+	{
+		Received* received = incoming.Front();
+		if (received == NULL)
+		{
+			return NULL;
+		}
+		answered = received->answered;
+		return &received->msg;
+	}
+
+	void NetworkThread::Pop()
+	{
+		incoming.PopFront();
+	}
+
+	void NetworkThread::Finish(const Message& msg)
+	{
+		std::size_t slot = SourceSlot(msg.GetSource());
+		if (finishing[slot] == finished[slot].load(std::memory_order_relaxed))
+		{
+			dirtySlots.push_back(slot);
+		}
+		++finishing[slot];
+	}
+
+	void NetworkThread::PublishFinished()
+	{
+		// The snapshot was published before this, so a sender with nothing
+		// left to finish is answered with values its writes are part of.
+		for (std::size_t i = 0; i < dirtySlots.size(); ++i)
+		{
+			finished[dirtySlots[i]].store(finishing[dirtySlots[i]], std::memory_order_release);
+		}
+		dirtySlots.clear();
+	}
+
+	void NetworkThread::SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote)
+	{
+		if (len > UDPSocket::Datagram::capacity)
+		{
+			Log::FormatLine(LOG_ERROR, "NETW", "ERROR: Response of %u bytes is too large to send", (unsigned int)len);
+			return;
+		}
+		UDPSocket::Datagram* dg = outgoing.BeginPush();
+		if (dg == NULL)
+		{
+			// A fragmented response can fill the queue on its own. Give the
+			// network thread a moment to drain it before dropping anything.
+			std::chrono::steady_clock::time_point deadline =
+				std::chrono::steady_clock::now() + std::chrono::milliseconds(sendWaitMs);
+			while (dg == NULL && running && std::chrono::steady_clock::now() < deadline)
+			{
+				std::this_thread::yield();
+				dg = outgoing.BeginPush();
+			}
+		}
+		if (dg == NULL)
+		{
+			++droppedResponses;
+			Log::WriteLine(LOG_WARN, "NETW", "Send queue full. Dropping response.");
+			return;
+		}
+		std::memcpy(dg->data, buffer, len);
+		dg->size = (int)len;
+		dg->addr = *remote;
+		outgoing.EndPush();
+	}
+
+	int NetworkThread::Read(unsigned char* /*buffer*/, int /*size*/, sockaddr* /*remoteAddr*/)
+	{
+		return -1;
+	}
+
+	int NetworkThread::GetDroppedMessages() const
+	{
+		return droppedMessages.load(std::memory_order_relaxed);
+	}
+
+	int NetworkThread::GetDroppedResponses() const
+	{
+		return droppedResponses;
+	}
+
+	int NetworkThread::GetSnapshotAnswers() const
+	{
+		return snapshotAnswers.load(std::memory_order_relaxed);
+	}
+
+	std::size_t NetworkThread::SourceSlot(const sockaddr& addr)
+	{
+		// FNV-1a over the same bytes the scheduler compares.
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&addr);
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < sizeof(sockaddr); ++i)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash % sourceSlots;
+	}
+
+	bool NetworkThread::CanAnswer(std::size_t slot) const
+	{
+		return !connected[slot] && passed[slot] == finished[slot].load(std::memory_order_acquire);
+	}
+
+	bool NetworkThread::CanStage(std::size_t slot) const
+	{
+		// A message is only staged when everything before it was, so if the
+		// last one was, everything still waiting was.
+		return lastStaged[slot] || passed[slot] == finished[slot].load(std::memory_order_acquire);
+	}
+
+	void NetworkThread::Enqueue(UDPSocket::Datagram* datagram, Message msgs[], bool answer)
+	{
+		int count = Message::Parse(datagram, pool, msgs, Message::maxPerDatagram);
+		// Answer what the snapshot can right away, decode the writes the stage
+		// can take, and pass the rest on. Only this thread pushes, so the free
+		// space in the receive queue can only grow until the pushes below.
+		static unsigned char response[UDPSocket::Datagram::capacity];
+		static bool answered[Message::maxPerDatagram];
+		std::size_t room = incoming.Capacity() - incoming.Size();
+		int kept = 0;
+		int staged = 0;
+		int dropped = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			sockaddr source = msgs[i].GetSource();
+			std::size_t slot = SourceSlot(source);
+			std::size_t len = 0;
+			if (answer && snapshot != NULL && (std::size_t)kept < room && CanAnswer(slot))
+			{
+				len = snapshot->Answer(msgs[i], response);
+			}
+			if (len > 0)
+			{
+				udp->SendTo(response, len, &source);
+				snapshotAnswers.fetch_add(1, std::memory_order_relaxed);
+				answered[kept] = true;
+				msgs[kept++] = msgs[i];
+			}
+			else if (stage != NULL && CanStage(slot) && stage->Stage(msgs[i]))
+			{
+				lastStaged[slot] = true;
+				++passed[slot];
+				++staged;
+			}
+			else if ((std::size_t)kept < room)
+			{
+				if (msgs[i].GetOpcode() == Opcode("CONN"))
+				{
+					connected[slot] = true;
+				}
+				lastStaged[slot] = false;
+				++passed[slot];
+				answered[kept] = false;
+				msgs[kept++] = msgs[i];
+			}
+			else
+			{
+				++dropped;
+			}
+		}
+		if (dropped > 0)
+		{
+			droppedMessages.fetch_add(dropped, std::memory_order_relaxed);
+			Log::WriteLine(LOG_WARN, "NETW", "Receive queue full. Dropping messages.");
+		}
+		if (kept + staged == 0)
+		{
+			pool.Recycle(datagram);
+			return;
+		}
+		// Every reference must be counted before the flight loop can see any
+		// of them and release its own.
+		pool.Retain(datagram, kept + staged);
+		if (staged > 0)
+		{
+			stage->Publish();
+		}
+		for (int i = 0; i < kept; ++i)
+		{
+			Received* received = incoming.BeginPush();
+			received->msg = msgs[i];
+			received->answered = answered[i];
+			incoming.EndPush();
+		}
+	}
+
+	void NetworkThread::Run()
+	{
+		static const int batchSize = 32;
+		UDPSocket::Datagram* datagrams[batchSize];
+		std::vector<Message> msgs(Message::maxPerDatagram);
+
+		while (running)
+		{
+			int acquired = pool.Acquire(datagrams, batchSize);
+			if (acquired == 0)
+			{
+				// Every buffer is waiting on the flight loop. Leave new data in
+				// the socket until some are released.
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			int count = acquired == 0 ? 0 : udp->ReadBatch(datagrams, acquired);
+			for (int i = 0; i < count; ++i)
+			{
+				Enqueue(datagrams[i], &msgs[0], true);
+			}
+			for (int i = count; i < acquired; ++i)
+			{
+				pool.Recycle(datagrams[i]);
+			}
+
+			UDPSocket::Datagram* dg;
+			while (ws != NULL && (dg = pool.Acquire()) != NULL)
+			{
+				dg->size = ws->Read(dg->data, UDPSocket::Datagram::capacity, &dg->addr);
+				if (dg->size <= 0)
+				{
+					pool.Recycle(dg);
+					break;
+				}
+				Enqueue(dg, &msgs[0], false);
+			}
+
+			const UDPSocket::Datagram* response;
+			while ((response = outgoing.Front()) != NULL)
+			{
+				udp->SendTo(response->data, response->size, const_cast<sockaddr*>(&response->addr));
+				outgoing.PopFront();
+			}
+			udp->Flush();
+		}
+	}
+}
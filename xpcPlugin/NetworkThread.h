@@ -0,0 +1,156 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_NETWORKTHREAD_H_
+#define XPCPLUGIN_NETWORKTHREAD_H_
+
+#include "ISocket.h"
+#include "Message.h"
+#include "ReceivePool.h"
+#include "RingBuffer.h"
+#include "Snapshot.h"
+#include "UDPSocket.h"
+#include "WriteStage.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace XPC
+{
+	/// Moves all socket I/O off of the X-Plane flight loop.
+	///
+	/// \details A NetworkThread owns reads from the UDP socket and the
+	///          WebSocket server. Datagrams are parsed into messages on the
+	///          network thread and handed to the flight loop through a bounded
+	///          lock-free queue. Responses written with SendTo are queued in a
+	///          second ring and sent by the network thread, so the flight loop
+	///          never blocks in a system call.
+	///
+	///          If a snapshot is provided, GETP, GETC and GETD requests it can
+	///          answer are answered on the network thread. A request is only
+	///          answered this way if every earlier message from its sender
+	///          has been handled and captured in the snapshot, and the sender
+	///          has never sent CONN, so that the answer can neither overtake
+	///          the sender's writes nor go to the wrong port. Answered
+	///          requests are still passed to the flight loop, marked as
+	///          answered, so the sender's connection stays alive and
+	///          remembers its last GETD request.
+	///
+	///          If a write stage is provided, CTRL, DREF and POSI messages are
+	///          decoded into it instead of the receive queue. Staged writes
+	///          are applied ahead of the scheduler's backlog, so a write is
+	///          only staged if every message its sender still has waiting
+	///          was staged as well.
+	///
+	///          Peek, Pop and SendTo must only be called from one thread,
+	///          normally the flight loop. Other threads that need to send
+	///          (e.g. the beacon timer) should use the UDPSocket directly.
+	class NetworkThread : public ISocket
+	{
+	public:
+		/// Starts a network thread reading from the specified sockets.
+		///
+		/// \param udp  The UDP socket to read from and send responses on. The
+		///             socket is switched to blocking reads so the network
+		///             thread sleeps while no data is available.
+		/// \param ws   The WebSocket server to read from, or NULL.
+		/// \param pool The pool to read datagrams into. The network thread is
+		///             the only thread that acquires buffers from the pool.
+		/// \param snapshot The snapshot to answer read requests from, or NULL.
+		/// \param stage    The stage to decode writes into, or NULL.
+		NetworkThread(UDPSocket* udp, ISocket* ws, ReceivePool& pool, Snapshot* snapshot = NULL,
+			WriteStage* stage = NULL);
+
+		/// Stops the network thread and waits for it to exit.
+		~NetworkThread();
+
+		/// Gets the oldest message received by the network thread without
+		/// removing it from the queue.
+		///
+		/// \param answered Set to true if the message is a request that has
+		///                 already been answered from the snapshot.
+		/// \returns A pointer to the message, or NULL if no messages are waiting.
+		Message* Peek(bool& answered);
+
+		/// Removes the message returned by the last call to Peek. The caller
+		/// takes over the message's reference to its datagram.
+		void Pop();
+
+		/// Records that the flight loop is done with a message that was not
+		/// answered from the snapshot, whether it came from the receive queue
+		/// or the write stage, and whether it was handled, held for the
+		/// barrier or shed. Takes effect at the next call to PublishFinished.
+		void Finish(const Message& msg);
+
+		/// Lets the network thread see every message finished since the last
+		/// call. Called once per frame, after the snapshot is captured.
+		void PublishFinished();
+
+		/// Queues a response to be sent by the network thread. If the send
+		/// queue is full, waits briefly for the network thread to drain it.
+		void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote);
+
+		/// Not supported. Use Peek and Pop to read parsed messages.
+		///
+		/// \returns -1
+		int Read(unsigned char* buffer, int size, sockaddr* remoteAddr);
+
+		/// Gets the number of messages dropped because the flight loop fell
+		/// behind and the receive queue was full.
+		int GetDroppedMessages() const;
+
+		/// Gets the number of responses dropped because the send queue was full.
+		int GetDroppedResponses() const;
+
+		/// Gets the number of requests answered from the snapshot.
+		int GetSnapshotAnswers() const;
+
+	private:
+		static const std::size_t receiveQueueSize = 1024;
+		static const std::size_t sendQueueSize = 256;
+		// Senders are hashed into this many slots to track their messages.
+		// Senders that share a slot only answer fewer requests early.
+		static const std::size_t sourceSlots = 1024;
+		// How long SendTo waits for room in a full send queue.
+		static const int sendWaitMs = 5;
+
+		/// A message waiting for the flight loop.
+		struct Received
+		{
+			Message msg;
+			bool answered;
+		};
+
+		static std::size_t SourceSlot(const sockaddr& addr);
+
+		void Run();
+		void Enqueue(UDPSocket::Datagram* datagram, Message msgs[], bool answer);
+		// Checks whether the sender in a slot can be answered from the snapshot.
+		bool CanAnswer(std::size_t slot) const;
+		// Checks whether the sender in a slot can have its writes staged.
+		bool CanStage(std::size_t slot) const;
+
+		UDPSocket* udp;
+		ISocket* ws;
+		ReceivePool& pool;
+		Snapshot* snapshot;
+		WriteStage* stage;
+		RingBuffer<Received, receiveQueueSize> incoming;
+		// Per sender slot. passed and connected are only used by the network
+		// thread, finishing and dirtySlots by the flight loop.
+		std::uint32_t passed[sourceSlots]; // Messages handed to the flight loop, not counting answered ones
+		bool connected[sourceSlots]; // The sender has sent CONN, so its responses may go elsewhere
+		bool lastStaged[sourceSlots]; // The last message passed from the sender was staged
+		std::uint32_t finishing[sourceSlots]; // Messages finished by the flight loop
+		std::atomic<std::uint32_t> finished[sourceSlots]; // finishing, as of the last PublishFinished
+		std::vector<std::size_t> dirtySlots; // Slots where finishing and finished differ
+		RingBuffer<UDPSocket::Datagram, sendQueueSize> outgoing;
+		std::atomic<int> droppedMessages;
+		int droppedResponses;
+		std::atomic<int> snapshotAnswers;
+		std::atomic<bool> running;
+		std::thread thread;
+	};
+}
+#endif
@@ -0,0 +1,69 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "ReceivePool.h"
+#include "Log.h"
+
+namespace XPC
+{
+	ReceivePool::ReceivePool()
+		: buffers(size), refs(size, 0)
+	{
+		spare.reserve(size);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			spare.push_back(&buffers[size - 1 - i]);
+		}
+	}
+
+	UDPSocket::Datagram* ReceivePool::Acquire()
+	{
+		if (!spare.empty())
+		{
+			UDPSocket::Datagram* buffer = spare.back();
+			spare.pop_back();
+			return buffer;
+		}
+		UDPSocket::Datagram* buffer;
+		if (released.Pop(buffer))
+		{
+			return buffer;
+		}
+		Log::WriteLine(LOG_WARN, "POOL", "Receive pool exhausted");
+		return NULL;
+	}
+
+	int ReceivePool::Acquire(UDPSocket::Datagram* out[], int count)
+	{
+		int acquired = 0;
+		while (acquired < count && (out[acquired] = Acquire()) != NULL)
+		{
+			++acquired;
+		}
+		return acquired;
+	}
+
+	void ReceivePool::Retain(UDPSocket::Datagram* buffer, int count)
+	{
+		refs[buffer - &buffers[0]] = count;
+	}
+
+	void ReceivePool::Recycle(UDPSocket::Datagram* buffer)
+	{
+		spare.push_back(buffer);
+	}
+
+	void ReceivePool::AddRef(const UDPSocket::Datagram* buffer)
+	{
+		++refs[buffer - &buffers[0]];
+	}
+
+	void ReceivePool::Release(const UDPSocket::Datagram* buffer)
+	{
+		std::size_t index = buffer - &buffers[0];
+		if (--refs[index] == 0)
+		{
+			// The ring has a slot for every buffer, so this never fails.
+			released.Push(&buffers[index]);
+		}
+	}
+}
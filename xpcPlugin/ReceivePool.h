@@ -0,0 +1,74 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_RECEIVEPOOL_H_
+#define XPCPLUGIN_RECEIVEPOOL_H_
+
+#include "RingBuffer.h"
+#include "UDPSocket.h"
+
+#include <vector>
+
+namespace XPC
+{
+	/// A fixed slab of datagram buffers that received messages point into.
+	///
+	/// \details Buffers are allocated once when the pool is created. The
+	///          receiving side acquires a buffer, reads a datagram into it and
+	///          parses it into Message views with Message::Parse. It then calls
+	///          Retain with the number of messages that refer to the buffer, or
+	///          Recycle if the buffer is not needed after all. The handling
+	///          side calls Release once per message, and the buffer returns to
+	///          the pool when the last message is released.
+	///
+	///          Acquire, Retain and Recycle must all be called from one thread,
+	///          and Release from one (possibly different) thread. Free buffers
+	///          are passed between the two through a lock-free ring.
+	class ReceivePool
+	{
+	public:
+		/// The number of buffers in the pool.
+		static const std::size_t size = 1024;
+
+		/// Allocates the buffers in the pool.
+		ReceivePool();
+
+		/// Takes a buffer out of the pool.
+		///
+		/// \returns A free buffer, or NULL if every buffer is in use.
+		UDPSocket::Datagram* Acquire();
+
+		/// Takes up to count buffers out of the pool.
+		///
+		/// \param out   The array to store the buffers in.
+		/// \param count The number of elements in out.
+		/// \returns     The number of buffers acquired.
+		int Acquire(UDPSocket::Datagram* out[], int count);
+
+		/// Hands a buffer over to the messages that point into it.
+		///
+		/// \param buffer The buffer returned by Acquire.
+		/// \param count  The number of messages referring to buffer. Must be
+		///               positive.
+		void Retain(UDPSocket::Datagram* buffer, int count);
+
+		/// Returns a buffer that was acquired but never retained.
+		void Recycle(UDPSocket::Datagram* buffer);
+
+		/// Releases one message's reference to a buffer.
+		void Release(const UDPSocket::Datagram* buffer);
+
+		/// Adds a reference to a buffer that has already been retained. Must
+		/// be called from the thread that calls Release.
+		void AddRef(const UDPSocket::Datagram* buffer);
+
+	private:
+		ReceivePool(const ReceivePool&);
+		ReceivePool& operator=(const ReceivePool&);
+
+		std::vector<UDPSocket::Datagram> buffers;
+		std::vector<int> refs;
+		RingBuffer<UDPSocket::Datagram*, size> released;
+		std::vector<UDPSocket::Datagram*> spare;
+	};
+}
+#endif
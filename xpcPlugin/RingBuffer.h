@@ -0,0 +1,123 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_RINGBUFFER_H_
+#define XPCPLUGIN_RINGBUFFER_H_
+
+#include <atomic>
+#include <cstdlib>
+
+namespace XPC
+{
+	/// A bounded, lock-free queue with a single producer and a single
+	/// consumer.
+	///
+	/// \details Slots are allocated once when the buffer is constructed and
+	///          are reused for the lifetime of the buffer. The producer fills
+	///          a slot in place with BeginPush/EndPush and the consumer reads
+	///          it in place with Front/PopFront, so large elements never need
+	///          to be copied through the queue. Push and Pop are provided for
+	///          small elements. Each end of the buffer must only be used from
+	///          one thread at a time.
+	///
+	/// \tparam T The element type. Must be default constructible.
+	/// \tparam N The number of slots. Must be a power of two.
+	template <typename T, std::size_t N>
+	class RingBuffer
+	{
+		static_assert(N > 0 && (N & (N - 1)) == 0, "RingBuffer size must be a power of two");
+
+	public:
+		RingBuffer() : head(0), tail(0) {}
+
+		/// Gets the next free slot without publishing it to the consumer.
+		///
+		/// \returns A pointer to the slot, or NULL if the buffer is full.
+		T* BeginPush()
+		{
+			std::size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == N)
+			{
+				return NULL;
+			}
+			return &items[t & (N - 1)];
+		}
+
+		/// Publishes the slot returned by the last call to BeginPush.
+		void EndPush()
+		{
+			tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/// Copies an element into the buffer.
+		///
+		/// \returns true if the element was added; false if the buffer is full.
+		bool Push(const T& item)
+		{
+			T* slot = BeginPush();
+			if (slot == NULL)
+			{
+				return false;
+			}
+			*slot = item;
+			EndPush();
+			return true;
+		}
+
+		/// Gets the oldest element without removing it.
+		///
+		/// \returns A pointer to the element, or NULL if the buffer is empty.
+		T* Front()
+		{
+			std::size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+			{
+				return NULL;
+			}
+			return &items[h & (N - 1)];
+		}
+
+		/// Removes the element returned by the last call to Front.
+		void PopFront()
+		{
+			head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/// Copies the oldest element out of the buffer and removes it.
+		///
+		/// \returns true if an element was removed; false if the buffer is empty.
+		bool Pop(T& item)
+		{
+			T* slot = Front();
+			if (slot == NULL)
+			{
+				return false;
+			}
+			item = *slot;
+			PopFront();
+			return true;
+		}
+
+		/// Gets the number of elements currently in the buffer. The result is
+		/// only a snapshot when called while the other end is active.
+		std::size_t Size() const
+		{
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		}
+
+		/// Gets the number of slots in the buffer.
+		static std::size_t Capacity() { return N; }
+
+	private:
+		RingBuffer(const RingBuffer&);
+		RingBuffer& operator=(const RingBuffer&);
+
+		// head is written by the consumer and tail by the producer. Keep them on
+		// separate cache lines so the two threads don't contend for one line.
+		std::atomic<std::size_t> head;
+		char headPad[64 - sizeof(std::atomic<std::size_t>)];
+		std::atomic<std::size_t> tail;
+		char tailPad[64 - sizeof(std::atomic<std::size_t>)];
+		T items[N];
+	};
+}
+#endif
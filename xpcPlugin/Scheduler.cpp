@@ -0,0 +1,442 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "Scheduler.h"
+#include "DataManager.h"
+#include "Log.h"
+#include "MessageHandlers.h"
+#include "Stats.h"
+#include "UDPSocket.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace XPC
+{
+	static const std::size_t none = (std::size_t)-1;
+	static const int quantum = 1500; // Bytes a client may send per turn
+	static const int waitWindow = 100; // Messages over which the peak wait is tracked
+
+	Scheduler::Scheduler(std::size_t capacity, ShedPolicy policy, int maxAgeMs, std::chrono::seconds idleTimeout,
+		void (*removed)(const Message& msg))
+		: capacity(capacity), policy(policy), maxAge(maxAgeMs), idleTimeout(idleTimeout), removed(removed),
+		  entries(capacity), lastClient(NULL), nextClient(NULL), nextLane(ControlLane), shedCount(0), collapsedCount(0)
+	{
+		freeEntries.reserve(capacity);
+		for (std::size_t i = capacity; i-- > 0;)
+		{
+			freeEntries.push_back(i);
+		}
+		for (int i = 0; i < LaneCount; ++i)
+		{
+			lanes[i].current = 0;
+			lanes[i].count = 0;
+		}
+		Stats::Publish("shed_messages", &shedCount);
+		Stats::Publish("collapsed_writes", &collapsedCount);
+	}
+
+	bool Scheduler::Source::operator<(const Source& other) const
+	{
+		return memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+	}
+
+	void Scheduler::Push(const Message& msg)
+	{
+		if (freeEntries.empty())
+		{
+			Client* deepest = NULL;
+			for (std::map<Source, Client>::iterator it = clients.begin(); it != clients.end(); ++it)
+			{
+				if (deepest == NULL || it->second.depth > deepest->depth)
+				{
+					deepest = &it->second;
+				}
+			}
+			Shed(*deepest, deepest->head[QueryLane] != none ? QueryLane : ControlLane, "backlog full");
+		}
+
+		Client& client = GetClient(msg);
+		client.lastSeen = msg.GetReceiveTime();
+		Lane lane = MessageHandlers::IsWrite(msg) ? ControlLane : QueryLane;
+		std::size_t index = freeEntries.back();
+		freeEntries.pop_back();
+		Entry& entry = entries[index];
+		if (GetTarget(msg, entry.target))
+		{
+			Collapse(client, entry.target);
+			client.lastWrite = index;
+		}
+		else
+		{
+			// Anything else, such as a read, STEP, BARR or SIMU, may depend
+			// on the writes before it, so none of them can collapse now.
+			client.lastWrite = none;
+		}
+		entry.msg = msg;
+		entry.next = none;
+		entry.sequence = client.sequence++;
+
+		if (client.head[lane] == none)
+		{
+			client.head[lane] = index;
+			lanes[lane].active.push_back(&client);
+		}
+		else
+		{
+			entries[client.tail[lane]].next = index;
+		}
+		client.tail[lane] = index;
+		++client.depth;
+		++lanes[lane].count;
+	}
+
+	Message* Scheduler::Next()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (;;)
+		{
+			Lane lane = ControlLane;
+			Client* ready = NextReady(ControlLane);
+			if (ready == NULL)
+			{
+				lane = QueryLane;
+				ready = NextReady(QueryLane);
+			}
+			if (ready == NULL)
+			{
+				return NULL;
+			}
+
+			LaneState& state = lanes[lane];
+			Client& client = *ready;
+			Entry& entry = entries[client.head[lane]];
+			if (entry.target.superseded)
+			{
+				++collapsedCount;
+				Log::FormatLine(LOG_DEBUG, "SCHD", "Collapsed %.4s message from %s",
+					(const char*)entry.msg.GetBuffer(), client.host.c_str());
+				Remove(client, lane);
+			}
+			else if (policy == ShedStale && now - entry.msg.GetReceiveTime() > maxAge)
+			{
+				Shed(client, lane, "stale");
+			}
+			else if (client.deficit[lane] < (int)entry.msg.GetSize())
+			{
+				// Not enough credit left for this message. Top it up for the
+				// client's next turn and move on to the next client.
+				client.deficit[lane] += quantum;
+				state.current = (state.current + 1) % state.active.size();
+			}
+			else
+			{
+				nextClient = &client;
+				nextLane = lane;
+				return &entry.msg;
+			}
+		}
+	}
+
+	void Scheduler::Pop()
+	{
+		Client& client = *nextClient;
+		const Message& msg = entries[client.head[nextLane]].msg;
+		client.deficit[nextLane] -= (int)msg.GetSize();
+
+		int waitUs = (int)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - msg.GetReceiveTime()).count();
+		client.waitAvgUs += (waitUs - client.waitAvgUs) / 16.0F;
+		client.windowMaxUs = std::max(client.windowMaxUs, waitUs);
+		if (++client.windowCount == waitWindow)
+		{
+			client.waitMaxUs = client.windowMaxUs;
+			client.windowMaxUs = 0;
+			client.windowCount = 0;
+		}
+
+		Remove(client, nextLane);
+	}
+
+	std::size_t Scheduler::Size() const
+	{
+		return capacity - freeEntries.size();
+	}
+
+	int Scheduler::GetShedCount() const
+	{
+		return shedCount;
+	}
+
+	int Scheduler::GetCollapsedCount() const
+	{
+		return collapsedCount;
+	}
+
+	bool Scheduler::WriteIsNext(const Client& client) const
+	{
+		return client.head[QueryLane] == none ||
+			entries[client.head[ControlLane]].sequence < entries[client.head[QueryLane]].sequence;
+	}
+
+	Scheduler::Client* Scheduler::NextReady(Lane lane)
+	{
+		LaneState& state = lanes[lane];
+		for (std::size_t i = 0; i < state.active.size(); ++i)
+		{
+			Client* client = state.active[state.current];
+			// A client's write waits behind its earlier queries. Its queries
+			// never wait here: while any write is ready, the query lane isn't
+			// served at all.
+			if (lane == QueryLane || WriteIsNext(*client))
+			{
+				return client;
+			}
+			state.current = (state.current + 1) % state.active.size();
+		}
+		return NULL;
+	}
+
+	Scheduler::Client& Scheduler::GetClient(const Message& msg)
+	{
+		sockaddr addr = msg.GetSource();
+		Source source;
+		memcpy(source.bytes, &addr, sizeof(source.bytes));
+		if (lastClient != NULL && memcmp(lastSource.bytes, source.bytes, sizeof(source.bytes)) == 0)
+		{
+			return *lastClient;
+		}
+
+		std::map<Source, Client>::iterator it = clients.find(source);
+		if (it == clients.end())
+		{
+			// Only new clients grow the map, so this is where to make room.
+			EvictIdle(msg.GetReceiveTime());
+
+			Client client;
+			client.host = UDPSocket::GetHost(&addr);
+			for (int i = 0; i < LaneCount; ++i)
+			{
+				client.head[i] = none;
+				client.tail[i] = none;
+				client.deficit[i] = 0;
+			}
+			client.lastWrite = none;
+			client.depth = 0;
+			client.sequence = 0;
+			client.shed = 0;
+			client.waitAvgUs = 0;
+			client.waitMaxUs = 0;
+			client.windowMaxUs = 0;
+			client.windowCount = 0;
+			// std::map never moves its elements, so the counters can be
+			// published in place.
+			it = clients.insert(std::make_pair(source, client)).first;
+			Client& added = it->second;
+			Stats::Publish("queue/" + added.host + "/depth", &added.depth);
+			Stats::Publish("queue/" + added.host + "/wait_avg_us", &added.waitAvgUs);
+			Stats::Publish("queue/" + added.host + "/wait_max_us", &added.waitMaxUs);
+		}
+		lastClient = &it->second;
+		lastSource = source;
+		return it->second;
+	}
+
+	bool Scheduler::GetTarget(const Message& msg, Target& target)
+	{
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		target.key = 0;
+		target.opcode = msg.GetOpcode();
+		target.aircraft = 0;
+		target.name = NULL;
+		target.nameLength = 0;
+		target.fields = 0;
+		target.superseded = false;
+		switch (target.opcode)
+		{
+		case Opcode("POSI"):
+		{
+			// [5]=aircraft, then lat/lon/h as floats (34 bytes) or doubles
+			// (46 bytes), then pitch/roll/heading and gear as floats.
+			if (size != 34 && size != 46)
+			{
+				return false;
+			}
+			target.aircraft = buffer[5];
+			std::size_t pos = 6;
+			for (int i = 0; i < 7; ++i)
+			{
+				double value;
+				if (i < 3 && size == 46)
+				{
+					memcpy(&value, buffer + pos, 8);
+					pos += 8;
+				}
+				else
+				{
+					float f;
+					memcpy(&f, buffer + pos, 4);
+					value = f;
+					pos += 4;
+				}
+				bool set = i == 6 ? value >= 0 : !DataManager::IsDefault(value);
+				target.fields |= set ? 1u << i : 0;
+			}
+			break;
+		}
+		case Opcode("CTRL"):
+		{
+			// [5-20]=pitch/roll/yaw/throttle, [21]=gear, [22-25]=flaps, then
+			// optionally [26]=aircraft and [27-30]=speedbrake.
+			if (size != 26 && size != 27 && size != 31)
+			{
+				return false;
+			}
+			const std::size_t offsets[] = { 5, 9, 13, 17, 22, 27 };
+			for (int i = 0; i < 6 && offsets[i] + 4 <= size; ++i)
+			{
+				float value;
+				memcpy(&value, buffer + offsets[i], 4);
+				target.fields |= DataManager::IsDefault(value) ? 0 : 1u << i;
+			}
+			target.fields |= (char)buffer[21] != -1 ? 1u << 6 : 0;
+			target.aircraft = size >= 27 ? buffer[26] : 0;
+			break;
+		}
+		case Opcode("DREF"):
+		{
+			// Only messages that set a single dataref can collapse.
+			// [5]=name length, then the name, the value count and the values.
+			if (size < 7)
+			{
+				return false;
+			}
+			std::size_t length = buffer[5];
+			if (7 + length > size || 7 + length + 4 * buffer[6 + length] != size)
+			{
+				return false;
+			}
+			target.name = buffer + 6;
+			target.nameLength = length + 1;
+			target.fields = 1;
+			break;
+		}
+		default:
+			return false;
+		}
+
+		// FNV-1a over everything that identifies the target. Each client has
+		// its own queue, so the sender is not part of it.
+		std::uint64_t hash = 14695981039346656037ull;
+		hash = (hash ^ target.opcode) * 1099511628211ull;
+		hash = (hash ^ (std::uint32_t)target.aircraft) * 1099511628211ull;
+		for (std::size_t i = 0; i < target.nameLength; ++i)
+		{
+			hash = (hash ^ target.name[i]) * 1099511628211ull;
+		}
+		target.key = hash == 0 ? 1 : hash;
+		return true;
+	}
+
+	bool Scheduler::SameTarget(const Target& a, const Target& b)
+	{
+		return a.opcode == b.opcode && a.aircraft == b.aircraft && a.nameLength == b.nameLength &&
+			(a.nameLength == 0 || memcmp(a.name, b.name, a.nameLength) == 0);
+	}
+
+	void Scheduler::Collapse(Client& client, const Target& target)
+	{
+		if (client.lastWrite == none)
+		{
+			return;
+		}
+		Target& waiting = entries[client.lastWrite].target;
+		if (!waiting.superseded && waiting.key == target.key && (waiting.fields & ~target.fields) == 0 &&
+			SameTarget(waiting, target))
+		{
+			waiting.superseded = true;
+		}
+	}
+
+	void Scheduler::Remove(Client& client, Lane lane)
+	{
+		std::size_t index = client.head[lane];
+		Entry& entry = entries[index];
+		if (removed != NULL)
+		{
+			removed(entry.msg);
+		}
+		entry.msg.Release();
+		if (client.lastWrite == index)
+		{
+			client.lastWrite = none;
+		}
+		client.head[lane] = entry.next;
+		if (entry.next == none)
+		{
+			// The client has nothing left in this lane, so it gives up its
+			// turn and any credit it had.
+			client.tail[lane] = none;
+			client.deficit[lane] = 0;
+			LaneState& state = lanes[lane];
+			std::size_t i = std::find(state.active.begin(), state.active.end(), &client) - state.active.begin();
+			state.active.erase(state.active.begin() + i);
+			if (i < state.current)
+			{
+				--state.current;
+			}
+			if (state.current >= state.active.size())
+			{
+				state.current = 0;
+			}
+		}
+		freeEntries.push_back(index);
+		--client.depth;
+		--lanes[lane].count;
+	}
+
+	void Scheduler::EvictIdle(std::chrono::steady_clock::time_point now)
+	{
+		if (now - lastSweep < std::chrono::seconds(1))
+		{
+			return;
+		}
+		lastSweep = now;
+		for (std::map<Source, Client>::iterator it = clients.begin(); it != clients.end();)
+		{
+			Client& client = it->second;
+			if (client.depth == 0 && now - client.lastSeen > idleTimeout)
+			{
+				Log::FormatLine(LOG_DEBUG, "SCHD", "Forgetting idle client %s", client.host.c_str());
+				Stats::Unpublish("queue/" + client.host + "/depth");
+				Stats::Unpublish("queue/" + client.host + "/wait_avg_us");
+				Stats::Unpublish("queue/" + client.host + "/wait_max_us");
+				if (client.shed > 0)
+				{
+					Stats::Unpublish("shed/" + client.host);
+				}
+				if (lastClient == &client)
+				{
+					lastClient = NULL;
+				}
+				clients.erase(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void Scheduler::Shed(Client& client, Lane lane, const char* reason)
+	{
+		if (client.shed++ == 0)
+		{
+			Stats::Publish("shed/" + client.host, &client.shed);
+		}
+		++shedCount;
+		Log::FormatLine(LOG_DEBUG, "SCHD", "Shed %.4s message from %s (%s)",
+			(const char*)entries[client.head[lane]].msg.GetBuffer(), client.host.c_str(), reason);
+		Remove(client, lane);
+	}
+}
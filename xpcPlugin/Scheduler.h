@@ -0,0 +1,219 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_SCHEDULER_H_
+#define XPCPLUGIN_SCHEDULER_H_
+
+#include "Message.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace XPC
+{
+	/// Holds messages that have been received but not yet handled, and
+	/// decides which of them to handle next and which are worth handling at
+	/// all when the plugin falls behind.
+	///
+	/// \details Each client has its own queue, split into two lanes. Writes
+	///          (see MessageHandlers::IsWrite), such as CTRL, POSI and SIMU,
+	///          go in the control lane, and everything else in the query
+	///          lane. The control lane only takes priority between clients:
+	///          a client's write is handled before any other client's query,
+	///          but never before a query the same client sent earlier, so
+	///          each client's messages are still handled in the order they
+	///          were sent. Within a lane, clients take turns with deficit
+	///          round-robin weighted by message size, so a client polling
+	///          large queries can't starve a client that is flying the
+	///          aircraft.
+	///
+	///          The backlog is bounded; once it is full, the oldest message of
+	///          the client with the most messages waiting is shed to make
+	///          room for each new one, starting with its queries. With the
+	///          ShedStale policy, messages that have waited longer than the
+	///          maximum age are also shed when they come up, since their
+	///          senders have most likely timed out already. Shed messages are
+	///          counted per client and published as xpc/stats/shed/<host>,
+	///          and the total is published as xpc/stats/shed_messages. The
+	///          number of messages each client has waiting and the time its
+	///          messages wait are published as xpc/stats/queue/<host>/depth,
+	///          xpc/stats/queue/<host>/wait_avg_us and
+	///          xpc/stats/queue/<host>/wait_max_us.
+	///
+	///          A client with nothing waiting that has been silent for longer
+	///          than the idle timeout is forgotten, and its counters
+	///          unpublished, the next time a new client sends a message, as
+	///          in ConnectionRegistry.
+	///
+	///          Writes are also collapsed: when a client sends a POSI, CTRL or
+	///          single-dataref DREF for the same aircraft or dataref as the
+	///          message it sent just before, that message is still waiting,
+	///          and the new message sets at least the same fields, the older
+	///          one is discarded when it comes up. Any other message in
+	///          between, including a different write, keeps both. Collapsed
+	///          writes are published as xpc/stats/collapsed_writes.
+	class Scheduler
+	{
+	public:
+		/// Determines which messages are shed when the plugin falls behind.
+		enum ShedPolicy
+		{
+			/// Only shed the oldest messages when the backlog is full.
+			ShedOldest,
+			/// Also shed messages older than the maximum age.
+			ShedStale
+		};
+
+		/// Initializes a new scheduler.
+		///
+		/// \param capacity The maximum number of messages in the backlog.
+		/// \param policy   The shedding policy.
+		/// \param maxAgeMs The maximum age of a message, in milliseconds, before
+		///                 it is shed under the ShedStale policy.
+		/// \param idleTimeout The time after which a silent client is forgotten.
+		/// \param removed  Called with each message as it leaves the backlog,
+		///                 whether it was handled, shed or collapsed, or NULL.
+		Scheduler(std::size_t capacity, ShedPolicy policy, int maxAgeMs, std::chrono::seconds idleTimeout,
+			void (*removed)(const Message& msg) = NULL);
+
+		/// Adds a message to the end of its client's queue, shedding a message
+		/// if the backlog is full. The scheduler takes over the message's
+		/// reference to its datagram.
+		void Push(const Message& msg);
+
+		/// Gets the next message to handle, shedding any stale messages that
+		/// come up before it.
+		///
+		/// \returns A pointer to the message, or NULL if the backlog is empty.
+		Message* Next();
+
+		/// Removes the message returned by the last call to Next and releases
+		/// it.
+		void Pop();
+
+		/// Gets the number of messages waiting in the backlog.
+		std::size_t Size() const;
+
+		/// Gets the total number of messages shed from all clients.
+		int GetShedCount() const;
+
+		/// Gets the total number of writes discarded because a newer write
+		/// replaced them.
+		int GetCollapsedCount() const;
+
+	private:
+		enum Lane
+		{
+			ControlLane = 0,
+			QueryLane = 1,
+			LaneCount = 2
+		};
+
+		/// What a write message changes, for finding writes it supersedes.
+		struct Target
+		{
+			std::uint64_t key; // Hash of the fields below, or 0 if the message can't collapse
+			std::uint32_t opcode;
+			int aircraft;
+			const unsigned char* name; // The dataref name and value count for DREF, or NULL
+			std::size_t nameLength;
+			std::uint32_t fields; // Bit mask of the values the message sets
+			bool superseded; // A newer write replaces this one
+		};
+
+		/// A waiting message. Entries are allocated once and linked into
+		/// their client's queues by index.
+		struct Entry
+		{
+			Message msg;
+			Target target;
+			std::size_t next; // The next entry in the same queue, or none
+			std::uint64_t sequence; // The order in which the client sent its messages
+		};
+
+		/// The sender address of a client, compared byte for byte.
+		struct Source
+		{
+			unsigned char bytes[sizeof(sockaddr)];
+			bool operator<(const Source& other) const;
+		};
+
+		/// The queues and counters of one client. Clients are only removed
+		/// by EvictIdle, so their counters can be published in place until
+		/// then.
+		struct Client
+		{
+			std::string host;
+			std::size_t head[LaneCount]; // The oldest entry in each lane, or none
+			std::size_t tail[LaneCount];
+			int deficit[LaneCount]; // Bytes the client may still send in its turn
+			std::size_t lastWrite; // The client's last message if it is a write that can collapse, or none
+			int depth; // Messages waiting in both lanes
+			std::uint64_t sequence; // The sequence number of the client's next message
+			std::chrono::steady_clock::time_point lastSeen; // When the client's last message arrived
+			int shed;
+			float waitAvgUs;
+			int waitMaxUs;
+			int windowMaxUs; // The longest wait in the current window
+			int windowCount; // Messages handled in the current window
+		};
+
+		/// The clients with messages waiting in a lane, in turn order.
+		struct LaneState
+		{
+			std::vector<Client*> active;
+			std::size_t current; // The client whose turn it is
+			std::size_t count; // Messages waiting in the lane
+		};
+
+		static bool GetTarget(const Message& msg, Target& target);
+		static bool SameTarget(const Target& a, const Target& b);
+
+		Client& GetClient(const Message& msg);
+
+		/// Checks whether a client's oldest write was sent before its oldest
+		/// query, so it can be handled ahead of it.
+		bool WriteIsNext(const Client& client) const;
+
+		/// Gives the turn in a lane to the next client whose message at the
+		/// front of the lane can be handled now.
+		///
+		/// \returns The client, or NULL if there is none.
+		Client* NextReady(Lane lane);
+
+		/// Marks the client's last message as superseded if it is a write
+		/// that the specified target replaces.
+		void Collapse(Client& client, const Target& target);
+
+		/// Unlinks the entry at the front of a client's lane and releases its
+		/// message.
+		void Remove(Client& client, Lane lane);
+
+		/// Forgets the clients that have nothing waiting and have been silent
+		/// for longer than the idle timeout. Sweeps at most once a second.
+		void EvictIdle(std::chrono::steady_clock::time_point now);
+
+		/// Counts and releases the message at the front of a client's lane.
+		void Shed(Client& client, Lane lane, const char* reason);
+
+		std::size_t capacity;
+		ShedPolicy policy;
+		std::chrono::milliseconds maxAge;
+		std::chrono::seconds idleTimeout;
+		void (*removed)(const Message& msg);
+		std::chrono::steady_clock::time_point lastSweep;
+		std::vector<Entry> entries; // Allocated once
+		std::vector<std::size_t> freeEntries;
+		std::map<Source, Client> clients;
+		Client* lastClient; // The client of the last message pushed
+		Source lastSource;
+		LaneState lanes[LaneCount];
+		Client* nextClient; // The client and lane of the message returned by Next
+		Lane nextLane;
+		int shedCount;
+		int collapsedCount;
+	};
+}
+#endif
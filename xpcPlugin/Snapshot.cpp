@@ -0,0 +1,407 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "Snapshot.h"
+#include "Log.h"
+#include "MessageHandlers.h"
+
+#include "XPLMProcessing.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define MAX_FRAGMENT_SIZE 1472 // The largest UDP payload that fits in a 1500 byte Ethernet frame
+
+namespace XPC
+{
+	const int Snapshot::maxAircraft;
+	const int Snapshot::maxDrefs;
+	const int Snapshot::maxValues;
+	const std::size_t Snapshot::responseIdSlots;
+
+	Snapshot::Snapshot(int aircraft)
+		: aircraft(std::max(0, std::min(aircraft, maxAircraft))), latest(-1), rowCopies(maxDrefs)
+	{
+		for (std::size_t i = 0; i < responseIdSlots; ++i)
+		{
+			responseIds[i].store(0, std::memory_order_relaxed);
+		}
+		for (int i = 0; i < 2; ++i)
+		{
+			buffers[i].sequence = 0;
+			buffers[i].frame = 0;
+			buffers[i].rowCount = 0;
+			for (int j = 0; j < maxDrefs; ++j)
+			{
+				buffers[i].rows[j].hash = 0;
+			}
+		}
+	}
+
+	std::uint8_t Snapshot::NextResponseId(const sockaddr& addr)
+	{
+		// FNV-1a over the address bytes, as compared by the scheduler.
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&addr);
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < sizeof(sockaddr); ++i)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return (std::uint8_t)(responseIds[hash % responseIdSlots].fetch_add(1, std::memory_order_relaxed) + 1);
+	}
+
+	std::uint64_t Snapshot::Hash(const char* name, std::size_t length)
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		for (std::size_t i = 0; i < length; ++i)
+		{
+			hash = (hash ^ (unsigned char)name[i]) * 1099511628211ull;
+		}
+		return hash == 0 ? 1 : hash; // 0 marks an unused row
+	}
+
+	void Snapshot::Watch(const std::string& name)
+	{
+		if (watched.size() >= (std::size_t)maxDrefs || name.size() > 255)
+		{
+			return;
+		}
+		std::uint64_t hash = Hash(name.data(), name.size());
+		for (std::size_t i = 0; i < watched.size(); ++i)
+		{
+			if (watched[i].hash == hash && watched[i].name == name)
+			{
+				return;
+			}
+		}
+		ResolvedDref dref = DataManager::Resolve(name);
+		if (!dref.xdref || dref.size > maxValues)
+		{
+			return;
+		}
+		Watched added = { name, hash, dref };
+		watched.push_back(added);
+		Log::FormatLine(LOG_DEBUG, "SNAP", "Capturing %s every frame", name.c_str());
+	}
+
+	void Snapshot::ReadPosition(PositionState& state, char aircraft)
+	{
+		state.gearHandle = DataManager::GetInt(DREF_GearHandle, aircraft);
+		state.position[0] = DataManager::GetDouble(DREF_Latitude, aircraft);
+		state.position[1] = DataManager::GetDouble(DREF_Longitude, aircraft);
+		state.position[2] = DataManager::GetDouble(DREF_Elevation, aircraft);
+		state.orientation[0] = DataManager::GetFloat(DREF_Pitch, aircraft);
+		state.orientation[1] = DataManager::GetFloat(DREF_Roll, aircraft);
+		state.orientation[2] = DataManager::GetFloat(DREF_HeadingTrue, aircraft);
+		float gear[10];
+		DataManager::GetFloatArray(DREF_GearDeploy, gear, 10, aircraft);
+		state.gear = gear[0];
+	}
+
+	void Snapshot::ReadControls(ControlState& state, char aircraft)
+	{
+		state.elevator = DataManager::GetFloat(DREF_Elevator, aircraft);
+		state.aileron = DataManager::GetFloat(DREF_Aileron, aircraft);
+		state.rudder = DataManager::GetFloat(DREF_Rudder, aircraft);
+		float throttle[8];
+		DataManager::GetFloatArray(DREF_ThrottleSet, throttle, 8, aircraft);
+		state.throttle = throttle[0];
+		if (aircraft == 0)
+		{
+			state.gear = (unsigned char)DataManager::GetInt(DREF_GearHandle, aircraft);
+		}
+		else
+		{
+			float mpGear[10];
+			DataManager::GetFloatArray(DREF_GearDeploy, mpGear, 10, aircraft);
+			state.gear = mpGear[0] > 0.5 ? 1 : 0;
+		}
+		state.flaps = DataManager::GetFloat(DREF_FlapSetting, aircraft);
+		state.speedBrake = DataManager::GetFloat(DREF_SpeedBrakeSet, aircraft);
+	}
+
+	std::size_t Snapshot::FormatPosition(const PositionState& state, unsigned char flags, std::uint32_t frame,
+		unsigned char response[])
+	{
+		std::memcpy(response, "POSI", 5);
+		response[5] = (unsigned char)state.gearHandle;
+		std::size_t cur = 6;
+		if (flags & PreciseState)
+		{
+			std::memcpy(response + cur, state.position, sizeof(state.position));
+			cur += sizeof(state.position);
+		}
+		else
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				float value = (float)state.position[i];
+				std::memcpy(response + cur, &value, sizeof(float));
+				cur += sizeof(float);
+			}
+		}
+		std::memcpy(response + cur, state.orientation, sizeof(state.orientation));
+		cur += sizeof(state.orientation);
+		std::memcpy(response + cur, &state.gear, sizeof(float));
+		cur += sizeof(float);
+		if (flags & StateFrame)
+		{
+			std::memcpy(response + cur, &frame, 4);
+			cur += 4;
+		}
+		return cur;
+	}
+
+	std::size_t Snapshot::FormatControls(const ControlState& state, unsigned char aircraft, unsigned char flags,
+		std::uint32_t frame, unsigned char response[])
+	{
+		std::memcpy(response, "CTRL", 5);
+		std::memcpy(response + 5, &state.elevator, sizeof(float));
+		std::memcpy(response + 9, &state.aileron, sizeof(float));
+		std::memcpy(response + 13, &state.rudder, sizeof(float));
+		std::memcpy(response + 17, &state.throttle, sizeof(float));
+		response[21] = state.gear;
+		std::memcpy(response + 22, &state.flaps, sizeof(float));
+		response[26] = aircraft;
+		std::memcpy(response + 27, &state.speedBrake, sizeof(float));
+		std::size_t cur = 31;
+		if (flags & StateFrame)
+		{
+			std::memcpy(response + cur, &frame, 4);
+			cur += 4;
+		}
+		return cur;
+	}
+
+	void Snapshot::Capture()
+	{
+		int next = latest.load(std::memory_order_relaxed) == 0 ? 1 : 0;
+		Buffer& buffer = buffers[next];
+		std::uint32_t sequence = buffer.sequence.load(std::memory_order_relaxed);
+		buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		buffer.frame = (std::uint32_t)XPLMGetCycleNumber();
+		for (int i = 0; i < aircraft; ++i)
+		{
+			ReadPosition(buffer.positions[i], (char)i);
+			ReadControls(buffer.controls[i], (char)i);
+		}
+		buffer.rowCount = (int)watched.size();
+		for (std::size_t i = 0; i < watched.size(); ++i)
+		{
+			Watched& source = watched[i];
+			DataManager::Refresh(source.dref);
+			Row& row = buffer.rows[i];
+			if (row.hash != source.hash)
+			{
+				row.hash = source.hash;
+				row.nameLength = (unsigned char)source.name.size();
+				std::memcpy(row.name, source.name.data(), source.name.size());
+			}
+			row.count = DataManager::Get(source.dref, row.values, maxValues);
+		}
+
+		buffer.sequence.store(sequence + 2, std::memory_order_release);
+		latest.store(next, std::memory_order_release);
+	}
+
+	bool Snapshot::CopyRows(const Buffer& buffer, const unsigned char* names, std::size_t size, unsigned char count)
+	{
+		// The buffer may be overwritten while this runs, so nothing read from
+		// it can be trusted until the sequence has been checked. Only bound
+		// every index so that a torn read can't go out of range.
+		int rowCount = std::min(std::max(buffer.rowCount, 0), maxDrefs);
+		std::size_t ptr = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (ptr >= size || ptr + 1 + names[ptr] > size)
+			{
+				return false;
+			}
+			const char* name = (const char*)names + ptr + 1;
+			unsigned char length = names[ptr];
+			std::uint64_t hash = Hash(name, length);
+			ptr += 1 + length;
+
+			int found = -1;
+			for (int j = 0; j < rowCount; ++j)
+			{
+				const Row& row = buffer.rows[j];
+				if (row.hash == hash && row.nameLength == length && std::memcmp(row.name, name, length) == 0)
+				{
+					found = j;
+					break;
+				}
+			}
+			if (found < 0)
+			{
+				return false;
+			}
+			Row& copy = rowCopies[i];
+			const Row& row = buffer.rows[found];
+			copy.count = std::min(std::max(row.count, 0), maxValues);
+			std::memcpy(copy.values, row.values, copy.count * sizeof(float));
+		}
+		return true;
+	}
+
+	std::size_t Snapshot::AnswerDrefs(const Message& msg, unsigned char response[])
+	{
+		const unsigned char* request = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		unsigned char count = size < 6 ? 0 : request[5];
+		if (count == 0 || count > maxDrefs)
+		{
+			// Repeating the last request needs the client's connection.
+			return 0;
+		}
+		// Find the flags after the names without trusting the lengths yet.
+		std::size_t end = 6;
+		for (int i = 0; i < count && end < size; ++i)
+		{
+			end += 1 + request[end];
+		}
+		if (end > size)
+		{
+			return 0;
+		}
+		unsigned char flags = size > end ? request[end] : 0;
+		const unsigned char supported = MessageHandlers::FragmentedResponse | MessageHandlers::FrameResponse;
+		if ((flags & ~supported) != 0)
+		{
+			return 0;
+		}
+
+		std::uint32_t frame = 0;
+		bool copied = false;
+		for (int attempt = 0; attempt < 3 && !copied; ++attempt)
+		{
+			int index = latest.load(std::memory_order_acquire);
+			if (index < 0)
+			{
+				return 0;
+			}
+			const Buffer& buffer = buffers[index];
+			std::uint32_t sequence = buffer.sequence.load(std::memory_order_acquire);
+			if (sequence & 1)
+			{
+				continue;
+			}
+			bool found = CopyRows(buffer, request + 6, end - 6, count);
+			frame = buffer.frame;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (buffer.sequence.load(std::memory_order_relaxed) != sequence)
+			{
+				continue;
+			}
+			if (!found)
+			{
+				return 0;
+			}
+			copied = true;
+		}
+		if (!copied)
+		{
+			return 0;
+		}
+
+		// Same formats as MessageHandlers::SendResponse and SendFragments,
+		// limited to what fits in one datagram.
+		bool fragmented = (flags & MessageHandlers::FragmentedResponse) != 0;
+		std::size_t header = fragmented ? 16 : 5;
+		std::size_t limit = fragmented ? MAX_FRAGMENT_SIZE : UDPSocket::Datagram::capacity;
+		std::size_t cur = header;
+		response[cur++] = count;
+		for (int i = 0; i < count; ++i)
+		{
+			const Row& row = rowCopies[i];
+			std::size_t rowSize = (fragmented ? 2 : 1) + row.count * sizeof(float);
+			if (cur + rowSize + 4 > limit)
+			{
+				return 0;
+			}
+			response[cur++] = (unsigned char)row.count;
+			if (fragmented)
+			{
+				response[cur++] = 0;
+			}
+			std::memcpy(response + cur, row.values, row.count * sizeof(float));
+			cur += row.count * sizeof(float);
+		}
+		if (flags & MessageHandlers::FrameResponse)
+		{
+			std::memcpy(response + cur, &frame, 4);
+			cur += 4;
+		}
+
+		if (fragmented)
+		{
+			// A single fragment: [5]=response id, [6]=fragment index,
+			// [7]=fragment count, [8-11]=offset, [12-15]=total length.
+			std::memcpy(response, "RESF", 5);
+			response[5] = NextResponseId(msg.GetSource());
+			response[6] = 0;
+			response[7] = 1;
+			std::uint32_t offset = 0;
+			std::uint32_t total = (std::uint32_t)(cur - header);
+			std::memcpy(response + 8, &offset, 4);
+			std::memcpy(response + 12, &total, 4);
+		}
+		else
+		{
+			std::memcpy(response, "RESP", 5);
+		}
+		return cur;
+	}
+
+	std::size_t Snapshot::Answer(const Message& msg, unsigned char response[])
+	{
+		const unsigned char* request = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		std::uint32_t opcode = msg.GetOpcode();
+		if (opcode == Opcode("GETD"))
+		{
+			return AnswerDrefs(msg, response);
+		}
+		if ((opcode != Opcode("GETP") && opcode != Opcode("GETC")) || (size != 6 && size != 7))
+		{
+			return 0;
+		}
+		unsigned char ac = request[5];
+		unsigned char flags = size == 7 ? request[6] : 0;
+		if (ac >= aircraft)
+		{
+			return 0;
+		}
+
+		for (int attempt = 0; attempt < 3; ++attempt)
+		{
+			int index = latest.load(std::memory_order_acquire);
+			if (index < 0)
+			{
+				return 0;
+			}
+			const Buffer& buffer = buffers[index];
+			std::uint32_t sequence = buffer.sequence.load(std::memory_order_acquire);
+			if (sequence & 1)
+			{
+				continue;
+			}
+			PositionState position = buffer.positions[ac];
+			ControlState controls = buffer.controls[ac];
+			std::uint32_t frame = buffer.frame;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (buffer.sequence.load(std::memory_order_relaxed) != sequence)
+			{
+				continue;
+			}
+			if (opcode == Opcode("GETP"))
+			{
+				return FormatPosition(position, flags, frame, response);
+			}
+			return FormatControls(controls, ac, flags, frame, response);
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,194 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_SNAPSHOT_H_
+#define XPCPLUGIN_SNAPSHOT_H_
+
+#include "DataManager.h"
+#include "Message.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace XPC
+{
+	/// The position of an aircraft, as sent in response to GETP.
+	struct PositionState
+	{
+		int gearHandle;
+		double position[3]; // Latitude, longitude, elevation
+		float orientation[3]; // Pitch, roll, true heading
+		float gear; // Deployment of the first gear
+	};
+
+	/// The control surfaces of an aircraft, as sent in response to GETC.
+	struct ControlState
+	{
+		float elevator;
+		float aileron;
+		float rudder;
+		float throttle;
+		unsigned char gear;
+		float flaps;
+		float speedBrake;
+	};
+
+	/// Flags in GETP and GETC requests.
+	enum StateFlags
+	{
+		PreciseState = 1, // Send lat/lon/h as doubles. GETP only.
+		StateFrame = 2    // Follow the response with the frame number
+	};
+
+	/// A copy of the simulation state taken at the end of each frame, which
+	/// other threads can read without waiting for the flight loop.
+	///
+	/// \details The state of the first few aircraft and the values of a set
+	///          of datarefs are captured by the flight loop once per frame
+	///          into one of two buffers, alternately. Each buffer is guarded
+	///          by a sequence lock: the writer makes the sequence odd while
+	///          it writes, and a reader retries if the sequence was odd or
+	///          changed while it copied. Readers never block the flight loop,
+	///          and the flight loop only contends with a reader that is still
+	///          copying a buffer two frames old.
+	///
+	///          The set of datarefs is learned from GETD requests handled by
+	///          the flight loop. Once a client has asked for a dataref, later
+	///          requests for it can be answered from the snapshot.
+	///
+	///          Capture and Watch must only be called from the flight loop.
+	///          Answer must only be called from one other thread, normally the
+	///          network thread.
+	class Snapshot
+	{
+	public:
+		/// The largest number of aircraft that can be captured.
+		static const int maxAircraft = 20;
+		/// The largest number of datarefs that can be captured.
+		static const int maxDrefs = 64;
+		/// The largest number of values captured for each dataref. Larger
+		/// datarefs are always read by the flight loop.
+		static const int maxValues = 64;
+
+		/// Initializes an empty snapshot.
+		///
+		/// \param aircraft The number of aircraft to capture, starting with
+		///                 the player aircraft.
+		explicit Snapshot(int aircraft);
+
+		/// Adds a dataref to the set captured every frame. Does nothing if
+		/// the dataref is already captured, does not exist, is too large, or
+		/// the set is full.
+		void Watch(const std::string& name);
+
+		/// Reads the state of every captured aircraft and dataref and
+		/// publishes it to readers. Called at the end of each frame.
+		void Capture();
+
+		/// Builds the response to a GETP, GETC or GETD request from the last
+		/// published snapshot.
+		///
+		/// \param msg      The request.
+		/// \param response A buffer of at least UDPSocket::Datagram::capacity
+		///                 bytes in which to build the response.
+		/// \returns        The size of the response, or 0 if the request
+		///                 must be handled by the flight loop instead.
+		///
+		/// \remarks The response is meant for the address the request came
+		///          from. The caller must leave requests from clients that
+		///          moved their responses elsewhere with CONN, or that have
+		///          writes the snapshot does not include yet, to the flight
+		///          loop.
+		std::size_t Answer(const Message& msg, unsigned char response[]);
+
+		/// Gets the id for the next fragmented response to an address.
+		///
+		/// \details Responses built by the flight loop and answers from the
+		///          snapshot go to the same clients, so both take their ids
+		///          from here, and each client sees a single sequence. The
+		///          counters are kept per hashed address; a client that shares
+		///          a counter with another sees its ids skip ahead.
+		///          Safe to call from any thread.
+		///
+		/// \param addr The address the response is sent to.
+		std::uint8_t NextResponseId(const sockaddr& addr);
+
+		/// Reads the position of an aircraft from X-Plane.
+		static void ReadPosition(PositionState& state, char aircraft);
+
+		/// Reads the controls of an aircraft from X-Plane.
+		static void ReadControls(ControlState& state, char aircraft);
+
+		/// Formats a POSI response.
+		///
+		/// \param state    The position to send.
+		/// \param flags    The StateFlags in the request.
+		/// \param frame    The frame the position was read in.
+		/// \param response A buffer of at least 50 bytes.
+		/// \returns        The size of the response.
+		static std::size_t FormatPosition(const PositionState& state, unsigned char flags, std::uint32_t frame,
+			unsigned char response[]);
+
+		/// Formats a CTRL response.
+		///
+		/// \param state    The controls to send.
+		/// \param aircraft The aircraft the controls were read from.
+		/// \param flags    The StateFlags in the request.
+		/// \param frame    The frame the controls were read in.
+		/// \param response A buffer of at least 35 bytes.
+		/// \returns        The size of the response.
+		static std::size_t FormatControls(const ControlState& state, unsigned char aircraft, unsigned char flags,
+			std::uint32_t frame, unsigned char response[]);
+
+	private:
+		struct Row
+		{
+			std::uint64_t hash; // Hash of the name, 0 if the row is unused
+			unsigned char nameLength;
+			char name[255];
+			int count;
+			float values[maxValues];
+		};
+
+		struct Buffer
+		{
+			std::atomic<std::uint32_t> sequence; // Odd while the buffer is being written
+			std::uint32_t frame;
+			PositionState positions[maxAircraft];
+			ControlState controls[maxAircraft];
+			int rowCount;
+			Row rows[maxDrefs];
+		};
+
+		struct Watched
+		{
+			std::string name;
+			std::uint64_t hash;
+			ResolvedDref dref;
+		};
+
+		static const std::size_t responseIdSlots = 1024;
+
+		static std::uint64_t Hash(const char* name, std::size_t length);
+
+		// Copies the rows for the dataref names in a GETD request out of a
+		// buffer into rowCopies. Returns false if any dataref is not captured.
+		bool CopyRows(const Buffer& buffer, const unsigned char* names, std::size_t size, unsigned char count);
+		std::size_t AnswerDrefs(const Message& msg, unsigned char response[]);
+
+		// Flight loop only
+		int aircraft;
+		std::vector<Watched> watched;
+
+		Buffer buffers[2];
+		std::atomic<int> latest; // The most recently published buffer, or -1
+
+		// Reader only
+		std::vector<Row> rowCopies;
+
+		// Any thread
+		std::atomic<std::uint8_t> responseIds[responseIdSlots];
+	};
+}
+#endif
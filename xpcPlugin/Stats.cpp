@@ -0,0 +1,121 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "Stats.h"
+#include "Log.h"
+
+#include "XPLMDataAccess.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace XPC
+{
+	struct IntArray
+	{
+		const int* values;
+		int count;
+	};
+
+	struct Published
+	{
+		std::string name;
+		XPLMDataRef dref;
+		IntArray* array; // Owned by this entry, or NULL
+	};
+
+	static std::vector<Published> published;
+
+	static int GetInt(void* refcon)
+	{
+		return *static_cast<const int*>(refcon);
+	}
+
+	static float GetFloat(void* refcon)
+	{
+		return *static_cast<const float*>(refcon);
+	}
+
+	static int GetIntArray(void* refcon, int* values, int offset, int max)
+	{
+		const IntArray* arr = static_cast<const IntArray*>(refcon);
+		if (values == NULL)
+		{
+			return arr->count;
+		}
+		int count = std::max(0, std::min(max, arr->count - offset));
+		for (int i = 0; i < count; ++i)
+		{
+			values[i] = arr->values[offset + i];
+		}
+		return count;
+	}
+
+	static void Register(const std::string& name, XPLMDataTypeID type,
+		XPLMGetDatai_f geti, XPLMGetDataf_f getf, XPLMGetDatavi_f getvi, void* refcon, IntArray* array)
+	{
+		std::string fullName = "xpc/stats/" + name;
+		XPLMDataRef dref = XPLMRegisterDataAccessor(fullName.c_str(), type, 0,
+			geti, NULL, getf, NULL, NULL, NULL, getvi, NULL, NULL, NULL, NULL, NULL,
+			refcon, NULL);
+		if (dref == NULL)
+		{
+			Log::FormatLine(LOG_ERROR, "STAT", "ERROR: Failed to publish %s", fullName.c_str());
+			delete array;
+			return;
+		}
+		Log::FormatLine(LOG_TRACE, "STAT", "Published %s", fullName.c_str());
+		Published entry;
+		entry.name = name;
+		entry.dref = dref;
+		entry.array = array;
+		published.push_back(entry);
+	}
+
+	static void Unregister(const Published& entry)
+	{
+		XPLMUnregisterDataAccessor(entry.dref);
+		delete entry.array;
+	}
+
+	void Stats::Publish(const std::string& name, const int* value)
+	{
+		Register(name, xplmType_Int, GetInt, NULL, NULL, const_cast<int*>(value), NULL);
+	}
+
+	void Stats::Publish(const std::string& name, const float* value)
+	{
+		Register(name, xplmType_Float, NULL, GetFloat, NULL, const_cast<float*>(value), NULL);
+	}
+
+	void Stats::Publish(const std::string& name, const int* values, int count)
+	{
+		IntArray* arr = new IntArray();
+		arr->values = values;
+		arr->count = count;
+		Register(name, xplmType_IntArray, NULL, NULL, GetIntArray, arr, arr);
+	}
+
+	void Stats::Unpublish(const std::string& name)
+	{
+		for (std::size_t i = 0; i < published.size(); ++i)
+		{
+			if (published[i].name == name)
+			{
+				Unregister(published[i]);
+				Log::FormatLine(LOG_TRACE, "STAT", "Unpublished xpc/stats/%s", name.c_str());
+				published[i] = published.back();
+				published.pop_back();
+				return;
+			}
+		}
+	}
+
+	void Stats::Clear()
+	{
+		for (std::size_t i = 0; i < published.size(); ++i)
+		{
+			Unregister(published[i]);
+		}
+		published.clear();
+	}
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_STATS_H_
+#define XPCPLUGIN_STATS_H_
+
+#include <string>
+
+namespace XPC
+{
+	/// Publishes plugin performance counters as read-only datarefs.
+	///
+	/// \details Every counter is published under the name xpc/stats/<name>,
+	///          so clients can read it with a regular GETD request and it
+	///          shows up in dataref browsing tools inside X-Plane. Published
+	///          values are read directly from the memory passed to Publish,
+	///          which must remain valid until the counter is unpublished or
+	///          Clear is called.
+	class Stats
+	{
+	public:
+		/// Publishes an integer counter.
+		///
+		/// \param name  The name of the counter, without the xpc/stats/ prefix.
+		/// \param value A pointer to the value to publish.
+		static void Publish(const std::string& name, const int* value);
+
+		/// Publishes a float counter.
+		///
+		/// \param name  The name of the counter, without the xpc/stats/ prefix.
+		/// \param value A pointer to the value to publish.
+		static void Publish(const std::string& name, const float* value);
+
+		/// Publishes an array of integer counters.
+		///
+		/// \param name   The name of the counter, without the xpc/stats/ prefix.
+		/// \param values A pointer to the first value to publish.
+		/// \param count  The number of elements in values.
+		static void Publish(const std::string& name, const int* values, int count);
+
+		/// Unregisters a single counter. Does nothing if no counter with that
+		/// name is published.
+		///
+		/// \param name The name of the counter, without the xpc/stats/ prefix.
+		static void Unpublish(const std::string& name);
+
+		/// Unregisters every dataref published by this class.
+		static void Clear();
+	};
+}
+#endif
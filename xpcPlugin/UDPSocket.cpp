@@ -10,7 +10,11 @@ namespace XPC
 {
 	const static std::string tag = "SOCK";
 
+	// Upper bound on the number of datagrams moved by a single recvmmsg/sendmmsg call.
+	const static int maxBatch = 64;
+
 	UDPSocket::UDPSocket(unsigned short recvPort)
+		: nonBlocking(false), deferred(false), sendQueue(sendQueueSize), sendCount(0)
 	{
 		Log::FormatLine(LOG_TRACE, tag, "Opening socket (port:%d)",	recvPort);
 		// Setup Port
@@ -76,6 +80,7 @@ namespace XPC
 
 	UDPSocket::~UDPSocket()
 	{
+		Flush();
 		Log::FormatLine(LOG_TRACE, tag, "Closing socket (%d)", this->sock);
 #ifdef _WIN32
 		closesocket(this->sock);
@@ -104,7 +109,7 @@ namespace XPC
 		FD_ZERO(&stExceptFDS);
 		FD_SET(sock, &stExceptFDS);
 		tv.tv_sec = 0;
-		tv.tv_usec = 250;
+		tv.tv_usec = nonBlocking ? 0 : 250;
 
 		// Select Command
 		int result = select(-1, &stReadFDS, (FD_SET *)0, &stExceptFDS, &tv);
@@ -121,14 +126,190 @@ namespace XPC
 		// If no error: Read Data
 		status = recvfrom(sock, (char*)dst, maxLen, 0, recvAddr, &recvaddrlen);
 #else
-		// For apple or linux-just read - will timeout in 0.5 ms
-		status = (int)recvfrom(sock, dst, 5000, 0, recvAddr, &recvaddrlen);
+		// For apple or linux-just read - will timeout in 0.5 ms, or return
+		// immediately in non-blocking mode.
+		status = (int)recvfrom(sock, dst, maxLen, 0, recvAddr, &recvaddrlen);
 #endif
 		return status;
 	}
 
-	void UDPSocket::SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) const
+	int UDPSocket::ReadNow(unsigned char* dst, int maxLen, sockaddr* recvAddr)
+	{
+		socklen_t recvaddrlen = sizeof(*recvAddr);
+#ifdef _WIN32
+		FD_SET stReadFDS;
+		FD_ZERO(&stReadFDS);
+		FD_SET(sock, &stReadFDS);
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		if (select(-1, &stReadFDS, (FD_SET *)0, (FD_SET *)0, &tv) <= 0)
+		{
+			return -1;
+		}
+		return recvfrom(sock, (char*)dst, maxLen, 0, recvAddr, &recvaddrlen);
+#else
+		return (int)recvfrom(sock, dst, maxLen, MSG_DONTWAIT, recvAddr, &recvaddrlen);
+#endif
+	}
+
+	int UDPSocket::ReadBatch(Datagram* datagrams[], int count)
+	{
+		if (count > maxBatch)
+		{
+			count = maxBatch;
+		}
+#ifdef __linux
+		// MSG_WAITFORONE makes recvmmsg honor the receive timeout for the first
+		// datagram only, and then return whatever else is already queued.
+		mmsghdr msgs[maxBatch];
+		iovec iovs[maxBatch];
+		for (int i = 0; i < count; ++i)
+		{
+			iovs[i].iov_base = datagrams[i]->data;
+			iovs[i].iov_len = Datagram::capacity;
+			memset(&msgs[i], 0, sizeof(mmsghdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &datagrams[i]->addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+		}
+		int received = recvmmsg(sock, msgs, count, MSG_WAITFORONE, NULL);
+		if (received <= 0)
+		{
+			return 0;
+		}
+		for (int i = 0; i < received; ++i)
+		{
+			datagrams[i]->size = (int)msgs[i].msg_len;
+		}
+#else
+		int received = 0;
+		while (received < count)
+		{
+			Datagram& d = *datagrams[received];
+			d.size = received == 0 ? Read(d.data, Datagram::capacity, &d.addr)
+			                       : ReadNow(d.data, Datagram::capacity, &d.addr);
+			if (d.size <= 0)
+			{
+				break;
+			}
+			++received;
+		}
+#endif
+		Log::FormatLine(LOG_TRACE, tag, "Read %d datagrams", received);
+		return received;
+	}
+
+	void UDPSocket::SetNonBlocking(bool nonBlocking)
+	{
+#ifdef _WIN32
+		u_long mode = nonBlocking ? 1 : 0;
+		if (ioctlsocket(sock, FIONBIO, &mode) != 0)
+		{
+			int err = WSAGetLastError();
+			Log::FormatLine(LOG_ERROR, tag, "ERROR: Failed to set non-blocking mode. (Error code %i)", err);
+			return;
+		}
+#else
+		int flags = fcntl(sock, F_GETFL, 0);
+		flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+		if (flags < 0 || fcntl(sock, F_SETFL, flags) != 0)
+		{
+			Log::WriteLine(LOG_ERROR, tag, "ERROR: Failed to set non-blocking mode.");
+			return;
+		}
+#endif
+		this->nonBlocking = nonBlocking;
+		Log::FormatLine(LOG_DEBUG, tag, "Non-blocking reads %s", nonBlocking ? "enabled" : "disabled");
+	}
+
+	void UDPSocket::SetDeferred(bool deferred)
+	{
+		if (!deferred)
+		{
+			Flush();
+		}
+		this->deferred = deferred;
+	}
+
+	int UDPSocket::Flush()
+	{
+		std::lock_guard<std::mutex> guard(sendMutex);
+		return FlushLocked();
+	}
+
+	int UDPSocket::FlushLocked()
 	{
+		if (sendCount == 0)
+		{
+			return 0;
+		}
+		int sent = 0;
+#ifdef __linux
+		mmsghdr msgs[sendQueueSize];
+		iovec iovs[sendQueueSize];
+		for (std::size_t i = 0; i < sendCount; ++i)
+		{
+			iovs[i].iov_base = sendQueue[i].data;
+			iovs[i].iov_len = sendQueue[i].size;
+			memset(&msgs[i], 0, sizeof(mmsghdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &sendQueue[i].addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+		}
+		while (sent < (int)sendCount)
+		{
+			int result = sendmmsg(sock, msgs + sent, (unsigned int)sendCount - sent, 0);
+			if (result <= 0)
+			{
+				// Skip the datagram that failed and keep going with the rest.
+				Log::FormatLine(LOG_ERROR, tag, "Send failed. (remote: %s)", GetHost(&sendQueue[sent].addr).c_str());
+				++sent;
+				continue;
+			}
+			sent += result;
+		}
+#else
+		for (std::size_t i = 0; i < sendCount; ++i)
+		{
+			Datagram& d = sendQueue[i];
+			if (sendto(sock, (char*)d.data, d.size, 0, &d.addr, sizeof(d.addr)) < 0)
+			{
+				Log::FormatLine(LOG_ERROR, tag, "Send failed. (remote: %s)", GetHost(&d.addr).c_str());
+			}
+			else
+			{
+				++sent;
+			}
+		}
+#endif
+		Log::FormatLine(LOG_TRACE, tag, "Flushed %d/%u queued datagrams", sent, (unsigned int)sendCount);
+		sendCount = 0;
+		return sent;
+	}
+
+	void UDPSocket::SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote)
+	{
+		if (deferred)
+		{
+			if (len > Datagram::capacity)
+			{
+				Log::FormatLine(LOG_ERROR, tag, "Send failed. Datagram too large to queue (%u bytes)", (unsigned int)len);
+				return;
+			}
+			std::lock_guard<std::mutex> guard(sendMutex);
+			if (sendCount == sendQueue.size())
+			{
+				FlushLocked();
+			}
+			Datagram& d = sendQueue[sendCount++];
+			memcpy(d.data, buffer, len);
+			d.size = (int)len;
+			d.addr = *remote;
+			return;
+		}
 		if (sendto(sock, (char*)buffer, (int)len, 0, remote, sizeof(*remote)) < 0)
 		{
 			Log::FormatLine(LOG_ERROR, tag, "Send failed. (remote: %s)", GetHost(remote).c_str());
@@ -5,6 +5,8 @@
 
 #include <cstdlib>
 #include <string>
+#include <mutex>
+#include <vector>
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -14,6 +16,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 #endif
 
 #include "ISocket.h"
@@ -32,6 +35,15 @@ namespace XPC
 	class UDPSocket : public ISocket
 	{
 	public:
+		/// A single datagram received from or queued for a remote host.
+		struct Datagram
+		{
+			static const std::size_t capacity = 4096;
+			unsigned char data[capacity];
+			int size;
+			sockaddr addr;
+		};
+
 		/// Initializes a new instance of the XPCSocket class bound to the
 		/// specified receive port.
 		///
@@ -52,12 +64,43 @@ namespace XPC
 		///                   an error occurs.
 		int Read(unsigned char* buffer, int size, sockaddr* remoteAddr);
 
-		/// Sends data to the specified remote endpoint.
+		/// Reads as many pending datagrams as are available, up to count.
+		///
+		/// \details On Linux, this uses recvmmsg to drain the socket in a single
+		///          system call. On other platforms, the socket is read in a loop
+		///          that stops as soon as no more data is immediately available.
+		/// \param datagrams The buffers to read datagrams into. Buffers are
+		///                  filled in order, so only the first n are written
+		///                  when n datagrams are read.
+		/// \param count     The number of elements in datagrams.
+		/// \returns         The number of datagrams read.
+		int ReadBatch(Datagram* datagrams[], int count);
+
+		/// Sends data to the specified remote endpoint. If deferred sending is
+		/// enabled, the data is queued and sent on the next call to Flush.
 		///
 		/// \param data   The data to be sent.
 		/// \param len    The number of bytes to send.
 		/// \param remote The destination socket.
-		void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) const;
+		void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote);
+
+		/// Enables or disables non-blocking reads.
+		///
+		/// \details By default, a read waits up to half a millisecond for data to
+		///          arrive. In non-blocking mode, reads check whether data is
+		///          ready and return immediately if it is not, so polling an idle
+		///          socket costs a single system call.
+		void SetNonBlocking(bool nonBlocking);
+
+		/// Enables or disables deferred sending. While enabled, SendTo only
+		/// queues outgoing datagrams.
+		void SetDeferred(bool deferred);
+
+		/// Sends all queued datagrams. On Linux, this uses sendmmsg to send the
+		/// whole queue in as few system calls as possible.
+		///
+		/// \returns The number of datagrams sent.
+		int Flush();
 		
 		/// Gets a string containing the IP address and port contained in the given sockaddr.
 		///
@@ -67,11 +110,21 @@ namespace XPC
 		
 		static sockaddr GetAddr(std::string address, unsigned short port);
 	private:
+		int ReadNow(unsigned char* buffer, int size, sockaddr* remoteAddr);
+		int FlushLocked();
+
+		static const std::size_t sendQueueSize = 64;
+
 #ifdef _WIN32
 		SOCKET sock;
 #else
 		int sock;
 #endif
+		bool nonBlocking;
+		bool deferred;
+		std::vector<Datagram> sendQueue;
+		std::size_t sendCount;
+		std::mutex sendMutex;
 	};
 }
 #endif
@@ -82,7 +82,7 @@ namespace XPC
 	/// \param data   The data to be sent.
 	/// \param len    The number of bytes to send.
 	/// \param remote The destination socket.
-	void WebSocket::SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) const
+	void WebSocket::SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote)
 	{
 		throw std::runtime_error("Not Implemented");
 	}
@@ -63,7 +63,7 @@ namespace XPC
 		/// \param data   The data to be sent.
 		/// \param len    The number of bytes to send.
 		/// \param remote The destination socket.
-		void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote) const;
+		void SendTo(const unsigned char* buffer, std::size_t len, sockaddr* remote);
 	};
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,269 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#include "WriteStage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace XPC
+{
+	const int WriteStage::maxRecords;
+
+	WriteStage::WriteStage()
+	{
+		pending.reserve(queueSize);
+	}
+
+	bool WriteStage::Stage(const Message& msg)
+	{
+		const unsigned char* buffer = msg.GetBuffer();
+		std::size_t size = msg.GetSize();
+		StagedWrite decoded[maxRecords + 1];
+		int count;
+		switch (msg.GetOpcode())
+		{
+		case Opcode("CTRL"): count = DecodeCtrl(buffer, size, decoded + 1); break;
+		case Opcode("DREF"): count = DecodeDref(buffer, size, decoded + 1); break;
+		case Opcode("POSI"): count = DecodePosi(buffer, size, decoded + 1); break;
+		default: return false;
+		}
+		// Only this thread pushes, so the free space can only grow before
+		// Publish.
+		if (count == 0 || records.Capacity() - records.Size() < pending.size() + count + 1)
+		{
+			return false;
+		}
+
+		decoded[0].kind = StagedMessage;
+		decoded[0].count = count;
+		decoded[0].msg = msg;
+		pending.insert(pending.end(), decoded, decoded + count + 1);
+		return true;
+	}
+
+	void WriteStage::Publish()
+	{
+		for (std::size_t i = 0; i < pending.size(); ++i)
+		{
+			records.Push(pending[i]);
+		}
+		pending.clear();
+	}
+
+	bool WriteStage::Next(Message& msg, int& count)
+	{
+		const StagedWrite* head = records.Front();
+		// The network thread publishes a message's records one at a time.
+		// Leave the message for the next pass if it is not done yet.
+		if (head == NULL || records.Size() < (std::size_t)head->count + 1)
+		{
+			return false;
+		}
+		msg = head->msg;
+		count = head->count;
+		records.PopFront();
+		return true;
+	}
+
+	const StagedWrite* WriteStage::Front()
+	{
+		return records.Front();
+	}
+
+	void WriteStage::Pop()
+	{
+		records.PopFront();
+	}
+
+	int WriteStage::DecodeCtrl(const unsigned char* buffer, std::size_t size, StagedWrite out[])
+	{
+		// Same format and rules as MessageHandlers::HandleCtrl.
+		if (size != 26 && size != 27 && size != 31)
+		{
+			return 0;
+		}
+		float pitch, roll, yaw, throttle, flaps;
+		std::memcpy(&pitch, buffer + 5, 4);
+		std::memcpy(&roll, buffer + 9, 4);
+		std::memcpy(&yaw, buffer + 13, 4);
+		std::memcpy(&throttle, buffer + 17, 4);
+		char gear = (char)buffer[21];
+		std::memcpy(&flaps, buffer + 22, 4);
+		char aircraft = size >= 27 ? (char)buffer[26] : 0;
+		float speedBrake = DataManager::GetDefaultValue();
+		if (size >= 31)
+		{
+			std::memcpy(&speedBrake, buffer + 27, 4);
+		}
+		if (aircraft < 0 || aircraft >= 20)
+		{
+			return 0;
+		}
+
+		int count = 0;
+		const DREF axes[3] = { DREF_YokePitch, DREF_YokeRoll, DREF_YokeHeading };
+		const float values[3] = { pitch, roll, yaw };
+		for (int i = 0; i < 3; ++i)
+		{
+			if (!DataManager::IsDefault(values[i]))
+			{
+				StagedWrite& write = out[count++];
+				write.kind = StagedFloat;
+				write.dref = axes[i];
+				write.aircraft = aircraft;
+				write.values[0] = values[i];
+			}
+		}
+		if (!DataManager::IsDefault(throttle))
+		{
+			const DREF throttles[2] = { DREF_ThrottleSet, DREF_ThrottleActual };
+			for (int i = 0; i < 2; ++i)
+			{
+				StagedWrite& write = out[count++];
+				write.kind = StagedFloats;
+				write.dref = throttles[i];
+				write.aircraft = aircraft;
+				write.count = 8;
+				std::fill(write.values, write.values + 8, throttle);
+			}
+			if (aircraft == 0)
+			{
+				static const char overrideName[] = "sim/flightmodel/engine/ENGN_thro_override";
+				StagedWrite& write = out[count++];
+				write.kind = StagedNamed;
+				write.name = overrideName;
+				write.nameLength = sizeof(overrideName) - 1;
+				write.count = 1;
+				write.values[0] = throttle;
+			}
+		}
+		if (gear != -1 && !DecodeGear(gear, false, aircraft, out, count))
+		{
+			return 0;
+		}
+		if (!DataManager::IsDefault(flaps))
+		{
+			StagedWrite& write = out[count++];
+			write.kind = StagedFloat;
+			write.dref = DREF_FlapSetting;
+			write.aircraft = aircraft;
+			write.values[0] = flaps;
+		}
+		if (!DataManager::IsDefault(speedBrake))
+		{
+			StagedWrite& write = out[count++];
+			write.kind = StagedFloat;
+			write.dref = DREF_SpeedBrakeSet;
+			write.aircraft = aircraft;
+			write.values[0] = speedBrake;
+		}
+		return count;
+	}
+
+	int WriteStage::DecodeDref(const unsigned char* buffer, std::size_t size, StagedWrite out[])
+	{
+		// Same format as MessageHandlers::HandleDref, but the whole message
+		// must be well formed, since nothing is applied from a message that
+		// isn't staged.
+		int count = 0;
+		std::size_t pos = 5;
+		while (pos < size)
+		{
+			unsigned char len = buffer[pos++];
+			if (pos + len + 1 > size || count == maxRecords)
+			{
+				return 0;
+			}
+			const char* name = (const char*)buffer + pos;
+			pos += len;
+
+			unsigned char valueCount = buffer[pos++];
+			if (valueCount == 0 || pos + 4 * valueCount > size)
+			{
+				return 0;
+			}
+			float first;
+			std::memcpy(&first, buffer + pos, 4);
+			if (std::isnan(first))
+			{
+				return 0;
+			}
+
+			StagedWrite& write = out[count++];
+			write.kind = StagedNamed;
+			write.name = name;
+			write.nameLength = len;
+			write.count = valueCount;
+			write.data = (const float*)(buffer + pos);
+			pos += 4 * valueCount;
+		}
+		return pos == size ? count : 0;
+	}
+
+	int WriteStage::DecodePosi(const unsigned char* buffer, std::size_t size, StagedWrite out[])
+	{
+		// Only the double precision form is staged. MessageHandlers::HandlePosi
+		// reads the gear of the single precision form from beyond the end of
+		// the message, which is left to it.
+		if (size != 46)
+		{
+			return 0;
+		}
+		char aircraft = (char)buffer[5];
+		if (aircraft < 0 || aircraft >= 20)
+		{
+			return 0;
+		}
+		float gear;
+		std::memcpy(&gear, buffer + 42, 4);
+
+		int count = 0;
+		StagedWrite& pose = out[count++];
+		pose.kind = StagedPose;
+		pose.aircraft = aircraft;
+		std::memcpy(pose.position, buffer + 6, 3 * 8);
+		std::memcpy(pose.values, buffer + 30, 3 * 4);
+		if (gear >= 0 && !DecodeGear(gear, true, aircraft, out, count))
+		{
+			return 0;
+		}
+		if (aircraft > 0)
+		{
+			StagedWrite& write = out[count++];
+			write.kind = StagedOverrideAI;
+			write.aircraft = aircraft;
+		}
+		return count;
+	}
+
+	bool WriteStage::DecodeGear(float gear, bool immediate, char aircraft, StagedWrite out[], int& count)
+	{
+		if ((gear < -8.5 && gear > -9.5) || DataManager::IsDefault(gear))
+		{
+			return true;
+		}
+		if (std::isnan(gear) || gear < 0 || gear > 1)
+		{
+			return false;
+		}
+		if (aircraft == 0)
+		{
+			StagedWrite& handle = out[count++];
+			handle.kind = StagedInt;
+			handle.dref = DREF_GearHandle;
+			handle.aircraft = 0;
+			handle.values[0] = (float)(int)gear;
+		}
+		if (aircraft != 0 || immediate)
+		{
+			StagedWrite& deploy = out[count++];
+			deploy.kind = StagedFloats;
+			deploy.dref = DREF_GearDeploy;
+			deploy.aircraft = aircraft;
+			deploy.count = 10;
+			std::fill(deploy.values, deploy.values + 10, gear);
+		}
+		return true;
+	}
+}
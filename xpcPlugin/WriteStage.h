@@ -0,0 +1,123 @@
+// Copyright (c) 2013-2018 United States Government as represented by the Administrator of the
+// National Aeronautics and Space Administration. All Rights Reserved.
+#ifndef XPCPLUGIN_WRITESTAGE_H_
+#define XPCPLUGIN_WRITESTAGE_H_
+
+#include "DataManager.h"
+#include "Message.h"
+#include "RingBuffer.h"
+
+#include <vector>
+
+namespace XPC
+{
+	/// What a staged write does when it is applied.
+	enum StagedWriteKind
+	{
+		StagedMessage,    // Starts the writes decoded from one message
+		StagedFloat,      // DataManager::Set(dref, values[0], aircraft)
+		StagedInt,        // DataManager::Set(dref, (int)values[0], aircraft)
+		StagedFloats,     // DataManager::Set(dref, values, count, aircraft)
+		StagedNamed,      // DataManager::Set(name, data, count)
+		StagedPose,       // DataManager::SetPose(position, values, aircraft)
+		StagedOverrideAI  // Hands aircraft over to the plugin, as POSI does
+	};
+
+	/// A write decoded from a CTRL, DREF or POSI message, ready to be applied
+	/// without any further parsing or validation.
+	struct StagedWrite
+	{
+		StagedWriteKind kind;
+		/// The dataref to set, for StagedFloat, StagedInt and StagedFloats.
+		DREF dref;
+		char aircraft;
+		/// The number of values, or for StagedMessage, the number of records
+		/// that follow.
+		int count;
+		float values[10];
+		double position[3];
+		/// The name of the dataref to set, for StagedNamed. Not terminated.
+		const char* name;
+		std::size_t nameLength;
+		/// The values to set for StagedNamed, or NULL to use values.
+		const float* data;
+		/// The message the writes were decoded from, for StagedMessage. The
+		/// names and data of the records that follow point into it.
+		Message msg;
+
+		StagedWrite() : kind(StagedMessage), dref(DREF_None), aircraft(0), count(0), name(NULL), nameLength(0),
+			data(NULL) {}
+	};
+
+	/// Decodes writes on the network thread so that the flight loop only has
+	/// to apply them.
+	///
+	/// \details CTRL, DREF and POSI messages are parsed and validated as
+	///          they arrive, and turned into records that name the exact
+	///          DataManager call to make. The records of each message are
+	///          preceded by a StagedMessage record that holds the message
+	///          itself, so the flight loop can still tell which client sent
+	///          it, and can hold it for the barrier.
+	///
+	///          Messages that fail validation are not staged. They take the
+	///          normal path through the scheduler, so the flight loop rejects
+	///          and logs them exactly as before.
+	///
+	///          Stage and Publish must only be called from the network
+	///          thread; Next and Pop from the flight loop.
+	class WriteStage
+	{
+	public:
+		/// The largest number of records one message can be decoded into.
+		static const int maxRecords = 16;
+
+		/// Initializes an empty stage.
+		WriteStage();
+
+		/// Decodes a message into records, which are kept back until Publish
+		/// is called.
+		///
+		/// \param msg The message to decode. The caller must retain one
+		///            reference to its datagram for every staged message
+		///            before calling Publish.
+		/// \returns   true if the message was staged; false if it must be
+		///            handled by the flight loop instead.
+		bool Stage(const Message& msg);
+
+		/// Hands every record staged since the last call over to the flight
+		/// loop.
+		void Publish();
+
+		/// Removes the StagedMessage record of the oldest staged message,
+		/// if all of its records have been published.
+		///
+		/// \param msg   Set to the message the records were decoded from.
+		///              The caller takes over its reference to its datagram.
+		/// \param count Set to the number of records that follow, which must
+		///              each be read with Front and removed with Pop.
+		/// \returns     true if a message was removed.
+		bool Next(Message& msg, int& count);
+
+		/// Gets the oldest record without removing it.
+		const StagedWrite* Front();
+
+		/// Removes the record returned by the last call to Front.
+		void Pop();
+
+	private:
+		static const std::size_t queueSize = 2048;
+
+		// Each returns the number of records written, or 0 if the message
+		// can't be staged.
+		static int DecodeCtrl(const unsigned char* buffer, std::size_t size, StagedWrite out[]);
+		static int DecodeDref(const unsigned char* buffer, std::size_t size, StagedWrite out[]);
+		static int DecodePosi(const unsigned char* buffer, std::size_t size, StagedWrite out[]);
+		// Adds the records for a gear value, as DataManager::SetGear would
+		// set them. Returns false if the value is out of range.
+		static bool DecodeGear(float gear, bool immediate, char aircraft, StagedWrite out[], int& count);
+
+		RingBuffer<StagedWrite, queueSize> records;
+		std::vector<StagedWrite> pending; // Staged but not yet published
+	};
+}
+#endif
@@ -59,16 +59,25 @@
 #include "Drawing.h"
 #include "Log.h"
 #include "MessageHandlers.h"
+#include "NetworkThread.h"
+#include "ReceivePool.h"
+#include "Scheduler.h"
+#include "Snapshot.h"
+#include "Stats.h"
 #include "UDPSocket.h"
 #include "Timer.h"
 #include "HTTPServer.h"
 #include "WebSocket.h"
+#include "WriteStage.h"
 
 // XPLM Includes
+#include "XPLMPlugin.h"
 #include "XPLMProcessing.h"
 #include "XPLMUtilities.h"
 
 // System Includes
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
@@ -79,7 +88,12 @@
 #define RECVPORT 49009 // Port that the plugin receives commands on
 #define RECVPORT_HTTP 49010
 #define WSPORT 49011
-#define OPS_PER_CYCLE 20 // Max Number of operations per cycle
+#define FRAME_BUDGET_US 2000 // Max time spent handling messages per frame
+#define READ_BATCH 32 // Max datagrams read per system call
+#define MAX_BACKLOG 256 // Max messages waiting to be handled before the oldest are shed
+#define MAX_MESSAGE_AGE_MS 500 // Age after which waiting messages are shed under ShedStale
+#define CLIENT_IDLE_TIMEOUT 300 // Seconds without a message before a client's queues are forgotten
+#define CALLBACK_WINDOW 100 // Number of frames over which the peak callback time is tracked
 
 #define XPC_PLUGIN_VERSION "1.3-rc.1"
 
@@ -89,11 +103,48 @@ XPC::UDPSocket* sock = NULL;
 XPC::HTTPServer* server = NULL;
 XPC::WebSocket* wsServer = NULL;
 XPC::Timer* timer = NULL;
+XPC::NetworkThread* net = NULL;
+XPC::Scheduler* scheduler = NULL;
+XPC::ReceivePool* pool = NULL;
+XPC::Snapshot* snapshot = NULL;
+XPC::WriteStage* stage = NULL;
 
 double start;
 double lap;
 static double timeConvert = 0.0;
 int benchmarkingSwitch = 0; // 1 = time for operations, 2 = time for op + cycle;
+bool nonBlockingIngress = true; // Poll the socket instead of waiting for data on every frame
+bool ioThreadSwitch = false; // Read and send on a dedicated network thread instead of the flight loop
+bool phasedLoopSwitch = false; // Apply writes before the flight model instead of after it
+bool snapshotSwitch = false; // Answer GETP, GETC and GETD on the network thread from a per-frame snapshot (needs ioThreadSwitch)
+int snapshotAircraft = 1; // Aircraft whose position and controls are captured in the snapshot
+bool writeStagingSwitch = false; // Decode CTRL, DREF and POSI on the network thread (needs ioThreadSwitch)
+XPC::Scheduler::ShedPolicy shedPolicy = XPC::Scheduler::ShedStale; // Which messages to drop when overloaded
+
+// Time spent in XPCFlightLoopCallback, published as xpc/stats/callback_*.
+static int callbackTimeUs = 0; // Most recent frame
+static float callbackTimeAvgUs = 0; // Exponential moving average
+static int callbackTimeMaxUs = 0; // Peak over the previous CALLBACK_WINDOW frames
+
+// Network thread queue overflows, published as xpc/stats/io_dropped_*.
+static int ioDroppedMessages = 0;
+static int ioDroppedResponses = 0;
+static int snapshotAnswers = 0; // Requests answered from the snapshot, published as xpc/stats/snapshot_answers
+static int backlogSize = 0; // Messages left waiting at the end of the frame
+static int stagedWrites = 0; // Messages applied from the write stage, published as xpc/stats/staged_writes
+
+// Time from receiving a write (CTRL, DREF, POSI...) until the end of the first
+// flight model step that sees it, published as xpc/stats/write_latency_*.
+static float writeLatencyAvgUs = 0; // Exponential moving average
+static int writeLatencyMaxUs = 0; // Peak over the previous CALLBACK_WINDOW frames
+static int pendingWrites = 0; // Writes applied since the last flight model step
+static chrono::steady_clock::time_point pendingWritesOldest;
+static chrono::steady_clock::duration pendingWritesAge; // Sum of the writes' receive times after the oldest
+
+#if defined(XPLM210)
+static XPLMFlightLoopID writeLoop = NULL;
+static chrono::steady_clock::duration writePassTime; // Time spent before the flight model this frame
+#endif
 
 PLUGIN_API int XPluginStart(char* outName, char* outSig, char* outDesc);
 PLUGIN_API void	XPluginStop(void);
@@ -101,6 +152,15 @@ PLUGIN_API void XPluginDisable(void);
 PLUGIN_API int XPluginEnable(void);
 PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFromWho, int inMessage, void* inParam);
 static float XPCFlightLoopCallback(float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop, int inCounter, void* inRefcon);
+static float XPCWriteLoopCallback(float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop, int inCounter, void* inRefcon);
+static void RecordCallbackTime(chrono::steady_clock::duration elapsed);
+static void RecordWriteLatency();
+static void CountWrite(chrono::steady_clock::time_point received);
+static void FinishMessage(const XPC::Message& msg);
+static void TakeStagedWrite(const XPC::Message& msg, bool held);
+static void Ingest();
+static void HandleMessages(chrono::steady_clock::time_point deadline, bool writesOnly);
+static void Receive(XPC::UDPSocket::Datagram* datagram);
 
 PLUGIN_API int XPluginStart(char* outName, char* outSig, char* outDesc)
 {
@@ -134,6 +194,31 @@ PLUGIN_API void	XPluginStop(void)
 PLUGIN_API void XPluginDisable(void)
 {
 	XPLMUnregisterFlightLoopCallback(XPCFlightLoopCallback, NULL);
+#if defined(XPLM210)
+	if (writeLoop != NULL)
+	{
+		XPLMDestroyFlightLoop(writeLoop);
+		writeLoop = NULL;
+	}
+#endif
+	XPC::Stats::Clear();
+
+	// Stop the network thread before closing the sockets it reads from.
+	delete net;
+	net = NULL;
+
+	XPC::MessageHandlers::SetSnapshot(NULL);
+	delete snapshot;
+	snapshot = NULL;
+
+	delete stage;
+	stage = NULL;
+
+	delete scheduler;
+	scheduler = NULL;
+
+	delete pool;
+	pool = NULL;
 
 	// Close sockets
 	delete sock;
@@ -162,11 +247,41 @@ PLUGIN_API int XPluginEnable(void)
 {
 	// Open sockets
 	sock = new XPC::UDPSocket(RECVPORT);
+	sock->SetNonBlocking(nonBlockingIngress);
+	// Responses are queued while handling messages and flushed once per frame.
+	sock->SetDeferred(true);
 
 	wsServer = new XPC::WebSocket(WSPORT);
 	timer = new XPC::Timer();
+	scheduler = new XPC::Scheduler(MAX_BACKLOG, shedPolicy, MAX_MESSAGE_AGE_MS,
+		std::chrono::seconds(CLIENT_IDLE_TIMEOUT), FinishMessage);
+	pool = new XPC::ReceivePool();
 	
-	XPC::MessageHandlers::SetSocket(sock);
+	XPC::MessageHandlers::SetBeaconSocket(sock);
+	if (ioThreadSwitch)
+	{
+		if (snapshotSwitch)
+		{
+			snapshot = new XPC::Snapshot(snapshotAircraft);
+			XPC::MessageHandlers::SetSnapshot(snapshot);
+			XPC::Stats::Publish("snapshot_answers", &snapshotAnswers);
+			XPC::Log::FormatLine(LOG_INFO, "EXEC", "Answering reads from a snapshot of %i aircraft", snapshotAircraft);
+		}
+		if (writeStagingSwitch)
+		{
+			stage = new XPC::WriteStage();
+			XPC::Stats::Publish("staged_writes", &stagedWrites);
+			XPC::Log::WriteLine(LOG_INFO, "EXEC", "Decoding writes on the network thread");
+		}
+		net = new XPC::NetworkThread(sock, wsServer, *pool, snapshot, stage);
+		XPC::MessageHandlers::SetSocket(net);
+		XPC::Stats::Publish("io_dropped_messages", &ioDroppedMessages);
+		XPC::Stats::Publish("io_dropped_responses", &ioDroppedResponses);
+	}
+	else
+	{
+		XPC::MessageHandlers::SetSocket(sock);
+	}
 
 	XPC::Log::WriteLine(LOG_INFO, "EXEC", "Plugin Enabled, sockets opened");
 	if (benchmarkingSwitch > 0)
@@ -175,9 +290,32 @@ PLUGIN_API int XPluginEnable(void)
 	}
 	XPC::Log::FormatLine(LOG_INFO, "EXEC", "Debug Logging Enabled (Verbosity: %i)", LOG_LEVEL);
 
+	XPC::Stats::Publish("callback_us", &callbackTimeUs);
+	XPC::Stats::Publish("callback_avg_us", &callbackTimeAvgUs);
+	XPC::Stats::Publish("callback_max_us", &callbackTimeMaxUs);
+	XPC::Stats::Publish("backlog", &backlogSize);
+	XPC::Stats::Publish("write_latency_avg_us", &writeLatencyAvgUs);
+	XPC::Stats::Publish("write_latency_max_us", &writeLatencyMaxUs);
+	XPC::DataManager::PublishStats();
+
 	float interval = -1; // Call every frame
 	void* refcon = NULL; // Don't pass anything to the callback directly
 	XPLMRegisterFlightLoopCallback(XPCFlightLoopCallback, interval, refcon);
+#if defined(XPLM210)
+	if (phasedLoopSwitch)
+	{
+		// Writes handled before the flight model take effect in the same
+		// frame. Reads are still served after it, so they see the result.
+		XPLMCreateFlightLoop_t params;
+		params.structSize = sizeof(params);
+		params.phase = xplm_FlightLoop_Phase_BeforeFlightModel;
+		params.callbackFunc = XPCWriteLoopCallback;
+		params.refcon = refcon;
+		writeLoop = XPLMCreateFlightLoop(&params);
+		XPLMScheduleFlightLoop(writeLoop, interval, 1);
+		XPC::Log::WriteLine(LOG_INFO, "EXEC", "Writes are applied before the flight model");
+	}
+#endif
 
 	
 	int xpVer;
@@ -196,8 +334,13 @@ PLUGIN_API int XPluginEnable(void)
 
 PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFromWho, int inMessage, void* inParam)
 {
-	// XPC doesn't have anything useful to say to other plugins, so simply ignore
-	// any messages received.
+	// The only message XPC acts on is XPLM_MSG_PLANE_LOADED. Loading an
+	// aircraft can add, remove or resize the datarefs its plugins provide,
+	// so everything cached about datarefs is forgotten and looked up again.
+	if (inMessage == XPLM_MSG_PLANE_LOADED)
+	{
+		XPC::DataManager::Invalidate();
+	}
 }
 
 float XPCFlightLoopCallback(float inElapsedSinceLastCall,
@@ -205,48 +348,190 @@ float XPCFlightLoopCallback(float inElapsedSinceLastCall,
 	int inCounter,
 	void* inRefcon)
 {
-#if (__APPLE__)
-	double diff_t;
-#endif
+	chrono::steady_clock::time_point callbackStart = chrono::steady_clock::now();
+	XPC::DataManager::BeginPass();
 
 	if (benchmarkingSwitch > 1)
 	{
 		XPC::Log::FormatLine(LOG_DEBUG, "EXEC", "Cycle time %.6f", inElapsedSinceLastCall);
 	}
 
-	int ops;
-	for (ops = 0; ops < OPS_PER_CYCLE; ops++)
+	// This callback runs after the flight model, so every write applied
+	// since the last one has now taken effect.
+	RecordWriteLatency();
+
+	// Likewise, a STEP command in progress has now run one more frame.
+	XPC::MessageHandlers::AdvanceStep();
+	XPC::MessageHandlers::AdvanceBarrier();
+
+	// Handle messages until the frame budget is spent. Whatever is left waits
+	// for the next frame, where the scheduler sheds it if it has gone stale.
+	// Time already spent before the flight model counts against the budget.
+	chrono::steady_clock::duration elapsed = chrono::steady_clock::duration::zero();
+#if defined(XPLM210)
+	elapsed = writePassTime;
+	writePassTime = chrono::steady_clock::duration::zero();
+#endif
+	Ingest();
+	HandleMessages(callbackStart + chrono::microseconds(FRAME_BUDGET_US) - elapsed, false);
+	backlogSize = (int)scheduler->Size();
+
+	XPC::MessageHandlers::SendSubscriptions();
+
+	// The values are final for this frame, so publish them to the network
+	// thread.
+	if (snapshot != NULL)
 	{
-		if (benchmarkingSwitch > 0)
-		{
-#if (__APPLE__)
-			start = (double)mach_absolute_time( ) * timeConvert;
+		snapshot->Capture();
+	}
+	if (net != NULL)
+	{
+		// Clients whose messages have all been handled can now be answered
+		// from the snapshot.
+		net->PublishFinished();
+	}
+	else
+	{
+		// Send every response queued while handling this frame's messages.
+		sock->Flush();
+	}
+
+	XPC::DataManager::EndPass();
+	RecordCallbackTime(elapsed + (chrono::steady_clock::now() - callbackStart));
+	return -1;
+}
+
+float XPCWriteLoopCallback(float inElapsedSinceLastCall,
+	float inElapsedTimeSinceLastFlightLoop,
+	int inCounter,
+	void* inRefcon)
+{
+#if defined(XPLM210)
+	chrono::steady_clock::time_point callbackStart = chrono::steady_clock::now();
+	XPC::DataManager::BeginPass();
+
+	// Apply the waiting writes so the flight model about to run sees them.
+	// The scheduler hands out every write before any query, except a write
+	// that a query from the same client has to go before. Either way the
+	// first query ends this pass, and it and everything after it wait for
+	// the after-flight-model pass.
+	Ingest();
+	HandleMessages(callbackStart + chrono::microseconds(FRAME_BUDGET_US), true);
+	if (net == NULL)
+	{
+		sock->Flush();
+	}
+	XPC::DataManager::EndPass();
+	writePassTime = chrono::steady_clock::now() - callbackStart;
 #endif
-		}
-		
-		bool messageExists = false;
-		std::list<XPC::Message> msg = XPC::Message::ReadFrom(*sock);
-		for (auto it = msg.begin(); it != msg.end(); ++it) {
-			if (it->GetHead() != "")
+	return -1;
+}
+
+void Ingest()
+{
+	if (net != NULL)
+	{
+		// The network thread has already read and parsed everything waiting on
+		// the sockets.
+		XPC::Message* msg;
+		bool answered;
+		while ((msg = net->Peek(answered)) != NULL)
+		{
+			if (answered)
 			{
-				messageExists = true;
-				XPC::MessageHandlers::HandleMessage(*it);
+				XPC::MessageHandlers::RecordAnswered(*msg);
+				msg->Release();
 			}
+			else
+			{
+				scheduler->Push(*msg);
+			}
+			net->Pop();
 		}
 
+		// Writes the network thread has already decoded only need to be
+		// applied. They still go ahead of the backlog: the network thread
+		// only stages a write when everything its sender has waiting was
+		// staged too, and publishes staged writes before the messages that
+		// follow them, so a client's messages stay in order.
+		if (stage != NULL)
+		{
+			stagedWrites += XPC::MessageHandlers::ApplyStagedWrites(*stage, TakeStagedWrite);
+		}
+		ioDroppedMessages = net->GetDroppedMessages();
+		ioDroppedResponses = net->GetDroppedResponses();
+		snapshotAnswers = net->GetSnapshotAnswers();
+		return;
+	}
 
-		msg = XPC::Message::ReadFrom(*wsServer);
-		for (auto it = msg.begin(); it != msg.end(); ++it) {
-			if (it->GetHead() != "")
-			{
-				messageExists = true;
-				XPC::MessageHandlers::HandleMessage(*it);
-			}
+	// Drain the sockets into the backlog in as few system calls as
+	// possible. A short batch means the socket is empty. Never read more
+	// than the backlog can hold in a single frame; anything beyond that
+	// would only be shed again.
+	XPC::UDPSocket::Datagram* datagrams[READ_BATCH];
+	int count = READ_BATCH;
+	for (int read = 0; count == READ_BATCH && read < MAX_BACKLOG; read += count)
+	{
+		int acquired = pool->Acquire(datagrams, READ_BATCH);
+		count = acquired == 0 ? 0 : sock->ReadBatch(datagrams, acquired);
+		for (int i = 0; i < count; ++i)
+		{
+			Receive(datagrams[i]);
+		}
+		for (int i = count; i < acquired; ++i)
+		{
+			pool->Recycle(datagrams[i]);
+		}
+	}
+
+	for (int read = 0; read < MAX_BACKLOG; ++read)
+	{
+		XPC::UDPSocket::Datagram* datagram = pool->Acquire();
+		if (datagram == NULL)
+		{
+			break;
 		}
+		datagram->size = wsServer->Read(datagram->data, XPC::UDPSocket::Datagram::capacity, &datagram->addr);
+		if (datagram->size <= 0)
+		{
+			pool->Recycle(datagram);
+			break;
+		}
+		Receive(datagram);
+	}
+}
 
-		if (messageExists == false) {
+void HandleMessages(chrono::steady_clock::time_point deadline, bool writesOnly)
+{
+#if (__APPLE__)
+	double diff_t;
+#endif
+	// The deadline is only checked after a message is handled, so the
+	// backlog always makes progress.
+	XPC::Message* msg;
+	while ((msg = scheduler->Next()) != NULL)
+	{
+		bool write = XPC::MessageHandlers::IsWrite(*msg);
+		if (writesOnly && !write)
+		{
 			break;
 		}
+		if (benchmarkingSwitch > 0)
+		{
+#if (__APPLE__)
+			start = (double)mach_absolute_time( ) * timeConvert;
+#endif
+		}
+
+		if (msg->GetOpcode() != 0)
+		{
+			XPC::MessageHandlers::HandleMessage(*msg);
+		}
+		if (write)
+		{
+			CountWrite(msg->GetReceiveTime());
+		}
+		scheduler->Pop();
 
 		if (benchmarkingSwitch > 0)
 		{
@@ -256,20 +541,98 @@ float XPCFlightLoopCallback(float inElapsedSinceLastCall,
 			XPC::Log::FormatLine(LOG_INFO, "EXEC", "Runtime %.6f", diff_t);
 #endif
 		}
+
+		if (chrono::steady_clock::now() > deadline)
+		{
+			XPC::Log::FormatLine(LOG_DEBUG, "EXEC", "Frame budget spent with %u messages waiting",
+				(unsigned int)scheduler->Size());
+			break;
+		}
 	}
+}
 
-	// If we have processed the maximum number of requests in a single frame,
-	// the socket is probably overloaded. Hopefully this is caused by a
-	// transitory event like a long load inside X-Plane that caused us to stop
-	// responding to requests for a while. We drop the current socket and
-	// re-create it to drop any old packets that have probably already timed
-	// out on the client side.
-	if (ops == OPS_PER_CYCLE)
+void CountWrite(chrono::steady_clock::time_point received)
+{
+	if (pendingWrites++ == 0)
 	{
-		XPC::Log::WriteLine(LOG_WARN, "EXEC", "Cleared UDP Buffer");
-		delete sock;
-		sock = new XPC::UDPSocket(RECVPORT);
-		XPC::MessageHandlers::SetSocket(sock);
+		pendingWritesOldest = received;
+		pendingWritesAge = chrono::steady_clock::duration::zero();
+	}
+	pendingWritesAge += received - pendingWritesOldest;
+}
+
+void FinishMessage(const XPC::Message& msg)
+{
+	if (net != NULL)
+	{
+		net->Finish(msg);
+	}
+}
+
+void TakeStagedWrite(const XPC::Message& msg, bool held)
+{
+	net->Finish(msg);
+	if (!held)
+	{
+		CountWrite(msg.GetReceiveTime());
+	}
+}
+
+void RecordWriteLatency()
+{
+	static int frames = 0;
+	static int windowMaxUs = 0;
+
+	if (pendingWrites > 0)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		chrono::steady_clock::duration total = (now - pendingWritesOldest) * pendingWrites - pendingWritesAge;
+		float avgUs = (float)chrono::duration_cast<chrono::microseconds>(total).count() / pendingWrites;
+		writeLatencyAvgUs += (avgUs - writeLatencyAvgUs) / 16.0F;
+		windowMaxUs = max(windowMaxUs, (int)chrono::duration_cast<chrono::microseconds>(now - pendingWritesOldest).count());
+		pendingWrites = 0;
+	}
+	if (++frames == CALLBACK_WINDOW)
+	{
+		writeLatencyMaxUs = windowMaxUs;
+		windowMaxUs = 0;
+		frames = 0;
+	}
+}
+
+void Receive(XPC::UDPSocket::Datagram* datagram)
+{
+	static XPC::Message msgs[XPC::Message::maxPerDatagram];
+	int count = XPC::Message::Parse(datagram, *pool, msgs, XPC::Message::maxPerDatagram);
+	if (count == 0)
+	{
+		pool->Recycle(datagram);
+		return;
+	}
+	pool->Retain(datagram, count);
+	for (int i = 0; i < count; ++i)
+	{
+		scheduler->Push(msgs[i]);
+	}
+}
+
+void RecordCallbackTime(chrono::steady_clock::duration elapsed)
+{
+	static int frames = 0;
+	static int windowMaxUs = 0;
+
+	callbackTimeUs = (int)chrono::duration_cast<chrono::microseconds>(elapsed).count();
+	callbackTimeAvgUs += (callbackTimeUs - callbackTimeAvgUs) / 16.0F;
+	windowMaxUs = max(windowMaxUs, callbackTimeUs);
+	if (++frames == CALLBACK_WINDOW)
+	{
+		callbackTimeMaxUs = windowMaxUs;
+		windowMaxUs = 0;
+		frames = 0;
+	}
+
+	if (benchmarkingSwitch > 1)
+	{
+		XPC::Log::FormatLine(LOG_DEBUG, "EXEC", "Callback time %ius", callbackTimeUs);
 	}
-	return -1;
 }